@@ -0,0 +1,955 @@
+//Office_PDES.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include "office_model.h"
+
+/****************************************************************************
+* Many TA offices at once
+* Every office runs the office_model.c rules; now and then a student walks
+* to a different office, which takes at least transfer_time seconds. That
+* minimum walking time is the lookahead the parallel engine relies on.
+*
+* Engines:
+*   seq  - one thread, one global event order (the reference result)
+*   cons - conservative parallel engine: offices are split across worker
+*          threads, which advance together in windows of length lookahead
+*          and hand students to each other through lock-free mailboxes
+*   tw   - optimistic Time Warp engine: workers run ahead speculatively and
+*          roll an office back when a student shows up in its past
+****************************************************************************/
+
+/****************************************************************************
+* Lock-free mailbox (multi-producer, single-consumer linked queue)
+* Any worker may push into an office's mailbox; only the worker that owns
+* the office pops from it. Messages embed a mail_t as their first member.
+* Messages from one sender come out in the order they were pushed.
+****************************************************************************/
+typedef struct mail {
+    _Atomic(struct mail*) next;
+} mail_t;
+
+typedef struct {
+    _Atomic(mail_t*) head;              //producers swap themselves in here
+    mail_t* tail;                       //consumer pops from here
+    mail_t stub;
+} mailbox_t;
+
+static void mailbox_init(mailbox_t* box) {
+    atomic_store(&box->stub.next, NULL);
+    atomic_store(&box->head, &box->stub);
+    box->tail = &box->stub;
+}
+
+static void mailbox_push(mailbox_t* box, mail_t* mail) {
+    mail_t* prev;
+
+    atomic_store_explicit(&mail->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&box->head, mail, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, mail, memory_order_release);
+}
+
+//Returns NULL when empty (or while a producer is halfway through a push)
+static mail_t* mailbox_pop(mailbox_t* box) {
+    mail_t* tail = box->tail;
+    mail_t* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &box->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        box->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        box->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&box->head, memory_order_acquire)) {
+        return NULL;
+    }
+    mailbox_push(box, &box->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        box->tail = next;
+        return tail;
+    }
+    return NULL;
+} //end mailbox_pop
+
+//A student handed to another office by the conservative engine
+typedef struct {
+    mail_t link;
+    event_t ev;
+} msg_t;
+
+/****************************************************************************
+* Global run settings and shared state
+****************************************************************************/
+int num_offices = 200;                  //offices in the department
+int students_per_office = 25;           //students that start at each office
+int num_workers = 0;                    //worker threads (0 = one per core)
+uint64_t run_seed = 521;                //seed for every student's stream
+office_params_t params;                 //rules shared by all offices
+
+office_t* offices;                      //all offices
+mailbox_t* mailboxes;                   //one incoming mailbox per office
+
+typedef struct {
+    office_stats_t stats;
+    double wall_seconds;
+    long windows;                       //conservative windows
+    long processed;                     //Time Warp: events run, including undone ones
+    long rolled_back;                   //Time Warp: events undone
+    long antis;                         //Time Warp: anti-messages sent
+    long gvt_rounds;                    //Time Warp: GVT computations
+} run_result_t;
+
+#define ENGINE_SEQ  0
+#define ENGINE_CONS 1
+#define ENGINE_TW   2
+#define NUM_ENGINES 3
+
+static const char* engine_names[NUM_ENGINES] = { "seq", "cons", "tw" };
+static double tw_window = 10.0;         //how far past GVT Time Warp may run
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static int setup_offices(void);
+static void teardown_offices(void);
+static void run_sequential(run_result_t* result);
+static int run_conservative(run_result_t* result);
+static int run_timewarp(run_result_t* result);
+static int run_engine(int engine, run_result_t* result);
+static int mode_has(const char* mode, const char* name);
+static void print_result(const char* name, const run_result_t* result);
+static double wall_clock(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    const char* mode = "seq,cons";
+    run_result_t results[NUM_ENGINES];
+    int ran[NUM_ENGINES] = { 0 };
+    int first = -1;
+    int status = 0;
+    int opt;
+    int i;
+
+    office_default_params(&params);
+    params.help_requests = 200;         //a semester of visits per student
+    params.program_time.kind = DIST_EXP;  //about two minutes between visits
+    params.program_time.a = 120.0;
+    params.help_time.kind = DIST_EXP;     //keeps each TA about 80% busy
+    params.help_time.a = 4.0;
+    params.transfer_prob = 0.1;
+    params.transfer_time = 2.0;
+
+    while ((opt = getopt(argc, argv, "o:s:c:t:r:p:d:w:m:S:W:A:")) != -1) {
+        switch (opt) {
+        case 'o': num_offices = atoi(optarg); break;
+        case 's': students_per_office = atoi(optarg); break;
+        case 'c': params.num_chairs = atoi(optarg); break;
+        case 't': params.num_tas = atoi(optarg); break;
+        case 'r': params.help_requests = atoi(optarg); break;
+        case 'p': params.transfer_prob = atof(optarg); break;
+        case 'd': params.transfer_time = atof(optarg); break;
+        case 'w': num_workers = atoi(optarg); break;
+        case 'm': mode = optarg; break;
+        case 'S': run_seed = strtoull(optarg, NULL, 10); break;
+        case 'W': tw_window = atof(optarg); break;
+        case 'A':
+            if (dist_parse(&params.patience, optarg) != 0) {
+                printf("Bad patience '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            printf("Usage: %s [-o offices] [-s students/office] [-c chairs] [-t TAs]\n"
+                   "          [-r help requests] [-p transfer prob] [-d transfer time]\n"
+                   "          [-w workers] [-m seq,cons,tw] [-W Time Warp window]\n"
+                   "          [-A patience, e.g. exp:30] [-S seed]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    if (num_offices <= 0 || students_per_office <= 0 || params.num_chairs <= 0 ||
+        params.num_tas <= 0 || params.help_requests <= 0 || tw_window <= 0.0) {
+        printf("Invalid input. Exiting.\n");
+        return 1;
+    }
+    if (num_workers <= 0) {
+        num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_workers > num_offices) {
+        num_workers = num_offices;
+    }
+
+    printf("%d offices x %d students, %d chairs, %d TA(s), %d visits each\n",
+           num_offices, students_per_office, params.num_chairs, params.num_tas,
+           params.help_requests);
+    printf("Transfers: p = %.3f, walking time (lookahead) = %.3f s\n",
+           params.transfer_prob, params.transfer_time);
+
+    for (i = 0; i < NUM_ENGINES; i++) {
+        if (!mode_has(mode, engine_names[i])) {
+            continue;
+        }
+        if (i == ENGINE_CONS && params.transfer_time <= 0.0) {
+            printf("Error: conservative engine needs a walking time > 0 (lookahead).\n");
+            return 1;
+        }
+        if (run_engine(i, &results[i]) != 0) {
+            return 1;
+        }
+        ran[i] = 1;
+        print_result(engine_names[i], &results[i]);
+    }
+
+    //Every engine must commit exactly the same history
+    for (i = 0; i < NUM_ENGINES; i++) {
+        if (!ran[i]) {
+            continue;
+        }
+        if (first < 0) {
+            first = i;
+            printf("\n");
+            continue;
+        }
+        if (memcmp(&results[first].stats, &results[i].stats, sizeof(office_stats_t)) != 0) {
+            printf("Results of %s and %s DIFFER\n", engine_names[first], engine_names[i]);
+            status = 1;
+        }
+        printf("%s vs %s with %d worker(s): %.2fx\n", engine_names[i], engine_names[first],
+               num_workers, results[first].wall_seconds / results[i].wall_seconds);
+    }
+
+    return status;
+} //end main
+
+/****************************************************************************
+* Function: setup_offices
+* What it does: Creates every office and its mailbox and starts each
+*               office's own students programming.
+* Outputs: 0 on success, -1 if memory ran out
+****************************************************************************/
+static int setup_offices(void) {
+    int i;
+    int j;
+
+    offices = (office_t*)calloc((size_t)num_offices, sizeof(office_t));
+    mailboxes = (mailbox_t*)calloc((size_t)num_offices, sizeof(mailbox_t));
+    if (offices == NULL || mailboxes == NULL) {
+        free(offices);
+        free(mailboxes);
+        return -1;
+    }
+
+    for (i = 0; i < num_offices; i++) {
+        if (office_init(&offices[i], i, num_offices, &params) != 0) {
+            return -1;
+        }
+        mailbox_init(&mailboxes[i]);
+        for (j = 0; j < students_per_office; j++) {
+            int id = i * students_per_office + j + 1;
+            office_add_student(&offices[i], office_new_student(id, run_seed, &params));
+        }
+    }
+    return 0;
+} //end setup_offices
+
+static void teardown_offices(void) {
+    int i;
+
+    for (i = 0; i < num_offices; i++) {
+        mail_t* mail;
+        while ((mail = mailbox_pop(&mailboxes[i])) != NULL) {
+            free(mail);
+        }
+        office_free(&offices[i]);
+    }
+    free(offices);
+    free(mailboxes);
+} //end teardown_offices
+
+/****************************************************************************
+* Sequential engine
+* A tournament tree over the offices' next event times always points at
+* the office holding the globally earliest event.
+****************************************************************************/
+static int* tree;                       //tree[1] = office with the earliest event
+static int tree_leaves;
+
+static int earlier_office(int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return office_next_time(&offices[b]) < office_next_time(&offices[a]) ? b : a;
+}
+
+static void tree_update(int office) {
+    int node = tree_leaves + office;
+
+    for (node /= 2; node >= 1; node /= 2) {
+        tree[node] = earlier_office(tree[2 * node], tree[2 * node + 1]);
+    }
+}
+
+static void send_sequential(void* ctx, int dest, const event_t* ev) {
+    office_push(&offices[dest], ev);
+    if (dest != *(int*)ctx) {
+        tree_update(dest);
+    }
+}
+
+static void run_sequential(run_result_t* result) {
+    double start = wall_clock();
+    event_t ev;
+    int i;
+
+    for (tree_leaves = 1; tree_leaves < num_offices; tree_leaves *= 2) {
+    }
+    tree = (int*)malloc(sizeof(int) * 2 * (size_t)tree_leaves);
+    for (i = 0; i < tree_leaves; i++) {
+        tree[tree_leaves + i] = i < num_offices ? i : -1;
+    }
+    for (i = tree_leaves - 1; i >= 1; i--) {
+        tree[i] = earlier_office(tree[2 * i], tree[2 * i + 1]);
+    }
+
+    //Always handle the earliest event of the whole department next
+    while (office_next_time(&offices[tree[1]]) != INFINITY) {
+        int current = tree[1];
+        office_pop(&offices[current], &ev);
+        office_handle(&offices[current], &ev, NULL, send_sequential, &current);
+        tree_update(current);
+    }
+
+    memset(result, 0, sizeof(*result));
+    for (i = 0; i < num_offices; i++) {
+        office_stats_add(&result->stats, &offices[i].stats);
+    }
+    result->wall_seconds = wall_clock() - start;
+    free(tree);
+} //end run_sequential
+
+/****************************************************************************
+* Worker threads shared by the parallel engines
+* Each worker owns a contiguous block of offices; the main thread runs as
+* worker 0 and the others meet it at window_barrier.
+****************************************************************************/
+typedef struct {
+    int id;
+    int first_office;                   //offices [first_office, end_office)
+    int end_office;
+    double next_time;                   //earliest local event, published at barriers
+    double gvt;                         //Time Warp: last agreed global virtual time
+    long windows;
+    long processed;
+    long rolled_back;
+    long antis;
+    long gvt_rounds;
+} worker_t;
+
+static worker_t* workers;
+static pthread_barrier_t window_barrier;
+
+/****************************************************************************
+* Function: run_workers
+* What it does: Starts num_workers copies of body (one on the main thread)
+*               and waits for all of them to return. The workers array is
+*               left in place for the caller to read and free.
+* Outputs: 0 on success, -1 if memory ran out
+****************************************************************************/
+static int run_workers(void* (*body)(void*)) {
+    pthread_t* handles;
+    int created = 0;
+    int i;
+
+    workers = (worker_t*)calloc((size_t)num_workers, sizeof(worker_t));
+    handles = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)num_workers);
+    if (workers == NULL || handles == NULL) {
+        free(workers);
+        free(handles);
+        return -1;
+    }
+    pthread_barrier_init(&window_barrier, NULL, (unsigned)num_workers);
+
+    //Give each worker a contiguous block of offices
+    for (i = 0; i < num_workers; i++) {
+        workers[i].id = i;
+        workers[i].first_office = (int)((long)num_offices * i / num_workers);
+        workers[i].end_office = (int)((long)num_offices * (i + 1) / num_workers);
+    }
+    for (i = 1; i < num_workers; i++) {
+        if (pthread_create(&handles[i], NULL, body, &workers[i]) != 0) {
+            break;
+        }
+        created++;
+    }
+    if (created != num_workers - 1) {
+        //Cannot run with fewer workers than the barrier expects
+        printf("Error: unable to create worker thread %d.\n", created + 1);
+        exit(1);
+    }
+    body(&workers[0]); //main thread is worker 0
+    for (i = 1; i < num_workers; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    pthread_barrier_destroy(&window_barrier);
+    free(handles);
+    return 0;
+} //end run_workers
+
+/****************************************************************************
+* Conservative engine
+* Every window all workers agree on the earliest pending event time T.
+* A student sent to another office arrives at least transfer_time later,
+* so nothing sent during the window [T, T + transfer_time) can land inside
+* it; each worker runs its own offices up to the window end without any
+* further coordination, then everyone meets at a barrier.
+****************************************************************************/
+static void send_conservative(void* ctx, int dest, const event_t* ev) {
+    office_t* from = (office_t*)ctx;
+
+    if (dest == from->id) {
+        office_push(from, ev);
+    } else {
+        msg_t* msg = (msg_t*)malloc(sizeof(msg_t));
+        msg->ev = *ev;
+        mailbox_push(&mailboxes[dest], &msg->link);
+    }
+}
+
+static void* conservative_worker(void* param) {
+    worker_t* self = (worker_t*)param;
+    event_t ev;
+    int i;
+
+    while (1) {
+        double window_end = INFINITY;
+
+        //Everyone has finished the last window: all sends are in mailboxes
+        pthread_barrier_wait(&window_barrier);
+
+        self->next_time = INFINITY;
+        for (i = self->first_office; i < self->end_office; i++) {
+            mail_t* mail;
+            while ((mail = mailbox_pop(&mailboxes[i])) != NULL) {
+                office_push(&offices[i], &((msg_t*)mail)->ev);
+                free(mail);
+            }
+            if (office_next_time(&offices[i]) < self->next_time) {
+                self->next_time = office_next_time(&offices[i]);
+            }
+        }
+
+        //Wait for every worker to publish its earliest event time
+        pthread_barrier_wait(&window_barrier);
+
+        for (i = 0; i < num_workers; i++) {
+            if (workers[i].next_time < window_end) {
+                window_end = workers[i].next_time;
+            }
+        }
+        if (window_end == INFINITY) {
+            break; //no events anywhere: every student is done
+        }
+        window_end += params.transfer_time;
+        self->windows++;
+
+        //Process this worker's offices up to the end of the window
+        for (i = self->first_office; i < self->end_office; i++) {
+            office_t* office = &offices[i];
+            while (office_next_time(office) < window_end) {
+                office_pop(office, &ev);
+                office_handle(office, &ev, NULL, send_conservative, office);
+            }
+        }
+    } //end while
+
+    return NULL;
+} //end conservative_worker
+
+static int run_conservative(run_result_t* result) {
+    double start = wall_clock();
+    int i;
+
+    if (run_workers(conservative_worker) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i < num_offices; i++) {
+        office_stats_add(&result->stats, &offices[i].stats);
+    }
+    result->windows = workers[0].windows;
+    result->wall_seconds = wall_clock() - start;
+    free(workers);
+    return 0;
+} //end run_conservative
+
+/****************************************************************************
+* Optimistic engine (Time Warp)
+* Each office (logical process) handles its events as soon as it can,
+* without waiting to hear from the others. Every handled event keeps the
+* office_undo_t of the hallway/TA state it changed and a list of the
+* events it scheduled. When a student arrives "in the past" (a straggler),
+* the office undoes its newer events, newest first, and sends
+* anti-messages that cancel whatever those events had sent elsewhere.
+*
+* Every so often the workers stop together and agree on the global
+* virtual time (GVT): the earliest time any office could still be rolled
+* back to. Anything before GVT is final, so its saved state is freed
+* (fossil collection). Offices may not run more than tw_window seconds
+* past GVT, which keeps rollbacks and memory bounded.
+****************************************************************************/
+#define TW_PENDING   0
+#define TW_PROCESSED 1
+#define TW_CANCELLED 2
+
+#define TW_BATCH        8               //events per office before moving on
+#define TW_GVT_INTERVAL 20000           //events per worker between GVT rounds
+
+typedef struct tw_event {
+    event_t ev;
+    int dest;                           //office the event belongs to
+    int state;
+    office_undo_t undo;                 //saved when the event is handled
+    struct tw_event* children;          //events this one scheduled
+    struct tw_event* sibling;           //next child of the same parent
+} tw_event_t;
+
+//A student (or the cancellation of one) sent to another office
+typedef struct {
+    mail_t link;
+    tw_event_t* event;
+    int anti;
+} tw_msg_t;
+
+typedef struct {
+    tw_event_t** pending;               //min-heap, cancelled entries dropped lazily
+    int pending_len;
+    int pending_cap;
+    tw_event_t** processed;             //handled events, oldest first
+    long processed_len;
+    long processed_cap;
+} tw_lp_t;
+
+typedef struct {
+    int lp;
+    tw_event_t* parent;
+} tw_ctx_t;
+
+static tw_lp_t* lps;
+static atomic_int gvt_requested;
+static atomic_long msgs_sent;
+static atomic_long msgs_received;
+
+static void tw_heap_push(tw_lp_t* lp, tw_event_t* e) {
+    int i;
+
+    if (lp->pending_len == lp->pending_cap) {
+        lp->pending_cap = lp->pending_cap ? lp->pending_cap * 2 : 64;
+        lp->pending = (tw_event_t**)realloc(lp->pending,
+                                            sizeof(tw_event_t*) * (size_t)lp->pending_cap);
+    }
+    i = lp->pending_len++;
+    while (i > 0 && event_before(&e->ev, &lp->pending[(i - 1) / 2]->ev)) {
+        lp->pending[i] = lp->pending[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    lp->pending[i] = e;
+} //end tw_heap_push
+
+static tw_event_t* tw_heap_pop(tw_lp_t* lp) {
+    tw_event_t* top = lp->pending[0];
+    tw_event_t* last = lp->pending[--lp->pending_len];
+    int i = 0;
+
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= lp->pending_len) {
+            break;
+        }
+        if (child + 1 < lp->pending_len &&
+            event_before(&lp->pending[child + 1]->ev, &lp->pending[child]->ev)) {
+            child++;
+        }
+        if (!event_before(&lp->pending[child]->ev, &last->ev)) {
+            break;
+        }
+        lp->pending[i] = lp->pending[child];
+        i = child;
+    }
+    lp->pending[i] = last;
+    return top;
+} //end tw_heap_pop
+
+//Earliest live pending event time; frees cancelled events found on top
+static double tw_next_time(tw_lp_t* lp) {
+    while (lp->pending_len > 0 && lp->pending[0]->state == TW_CANCELLED) {
+        free(tw_heap_pop(lp));
+    }
+    return lp->pending_len > 0 ? lp->pending[0]->ev.time : INFINITY;
+}
+
+static void tw_post(int dest, tw_event_t* e, int anti) {
+    tw_msg_t* msg = (tw_msg_t*)malloc(sizeof(tw_msg_t));
+
+    msg->event = e;
+    msg->anti = anti;
+    atomic_fetch_add(&msgs_sent, 1);
+    mailbox_push(&mailboxes[dest], &msg->link);
+}
+
+static void send_timewarp(void* ctx, int dest, const event_t* ev) {
+    tw_ctx_t* c = (tw_ctx_t*)ctx;
+    tw_event_t* child = (tw_event_t*)calloc(1, sizeof(tw_event_t));
+
+    child->ev = *ev;
+    child->dest = dest;
+    child->state = TW_PENDING;
+    child->sibling = c->parent->children;
+    c->parent->children = child;
+
+    if (dest == c->lp) {
+        tw_heap_push(&lps[dest], child);
+    } else {
+        tw_post(dest, child, 0);
+    }
+} //end send_timewarp
+
+/****************************************************************************
+* Function: tw_rollback
+* What it does: Undoes handled events of one office, newest first, and
+*               cancels everything they scheduled. Stops before the first
+*               event that is earlier than `target`; when inclusive is set,
+*               `target` itself is undone too.
+****************************************************************************/
+static void tw_rollback(int lp_id, const tw_event_t* target, int inclusive, worker_t* w) {
+    tw_lp_t* lp = &lps[lp_id];
+
+    while (lp->processed_len > 0) {
+        tw_event_t* top = lp->processed[lp->processed_len - 1];
+        tw_event_t* child;
+        tw_event_t* next;
+
+        if (inclusive ? event_before(&top->ev, &target->ev)
+                      : !event_before(&target->ev, &top->ev)) {
+            break;
+        }
+        lp->processed_len--;
+        office_undo(&offices[lp_id], &top->undo);
+
+        //Take back what this event scheduled
+        for (child = top->children; child != NULL; child = next) {
+            next = child->sibling;
+            if (child->dest == lp_id) {
+                child->state = TW_CANCELLED; //still in our heap; freed when it surfaces
+            } else {
+                tw_post(child->dest, child, 1);
+                w->antis++;
+            }
+        }
+        top->children = NULL;
+        top->state = TW_PENDING;
+        tw_heap_push(lp, top);
+        w->rolled_back++;
+    } //end while
+} //end tw_rollback
+
+static void tw_receive(int lp_id, worker_t* w) {
+    tw_lp_t* lp = &lps[lp_id];
+    mail_t* mail;
+
+    while ((mail = mailbox_pop(&mailboxes[lp_id])) != NULL) {
+        tw_msg_t* msg = (tw_msg_t*)mail;
+        tw_event_t* e = msg->event;
+        int anti = msg->anti;
+
+        free(msg);
+        atomic_fetch_add(&msgs_received, 1);
+
+        if (!anti) {
+            //Straggler: undo everything this office did after the arrival time
+            if (lp->processed_len > 0 &&
+                event_before(&e->ev, &lp->processed[lp->processed_len - 1]->ev)) {
+                tw_rollback(lp_id, e, 0, w);
+            }
+            tw_heap_push(lp, e);
+        } else {
+            //Anti-message: the student never came after all
+            if (e->state == TW_PROCESSED) {
+                tw_rollback(lp_id, e, 1, w);
+            }
+            e->state = TW_CANCELLED;
+        }
+    } //end while
+} //end tw_receive
+
+static int tw_process_one(int lp_id, double limit, worker_t* w) {
+    tw_lp_t* lp = &lps[lp_id];
+    tw_ctx_t ctx;
+    tw_event_t* e;
+
+    if (tw_next_time(lp) >= limit) {
+        return 0;
+    }
+    e = tw_heap_pop(lp);
+
+    ctx.lp = lp_id;
+    ctx.parent = e;
+    office_handle(&offices[lp_id], &e->ev, &e->undo, send_timewarp, &ctx);
+    e->state = TW_PROCESSED;
+
+    if (lp->processed_len == lp->processed_cap) {
+        lp->processed_cap = lp->processed_cap ? lp->processed_cap * 2 : 256;
+        lp->processed = (tw_event_t**)realloc(lp->processed,
+                                              sizeof(tw_event_t*) * (size_t)lp->processed_cap);
+    }
+    lp->processed[lp->processed_len++] = e;
+    w->processed++;
+    return 1;
+} //end tw_process_one
+
+/****************************************************************************
+* Function: tw_gvt_round
+* What it does: All workers stop, deliver every message still in flight
+*               (which may cause more rollbacks and anti-messages), agree
+*               on GVT and free handled events older than it.
+* Outputs: 1 once GVT is infinite (every student is done), else 0
+****************************************************************************/
+static int tw_gvt_round(worker_t* self) {
+    double gvt = INFINITY;
+    int quiet;
+    int i;
+
+    pthread_barrier_wait(&window_barrier);
+    if (self->id == 0) {
+        atomic_store(&gvt_requested, 0);
+    }
+
+    //Keep delivering until no message is left anywhere
+    do {
+        for (i = self->first_office; i < self->end_office; i++) {
+            tw_receive(i, self);
+        }
+        pthread_barrier_wait(&window_barrier);
+        quiet = atomic_load(&msgs_sent) == atomic_load(&msgs_received);
+        pthread_barrier_wait(&window_barrier);
+    } while (!quiet);
+
+    self->next_time = INFINITY;
+    for (i = self->first_office; i < self->end_office; i++) {
+        double t = tw_next_time(&lps[i]);
+        if (t < self->next_time) {
+            self->next_time = t;
+        }
+    }
+    pthread_barrier_wait(&window_barrier);
+
+    for (i = 0; i < num_workers; i++) {
+        if (workers[i].next_time < gvt) {
+            gvt = workers[i].next_time;
+        }
+    }
+    self->gvt = gvt;
+    self->gvt_rounds++;
+
+    //Fossil collection: events before GVT can never be rolled back
+    for (i = self->first_office; i < self->end_office; i++) {
+        tw_lp_t* lp = &lps[i];
+        long keep = 0;
+        long j;
+
+        while (keep < lp->processed_len && lp->processed[keep]->ev.time < gvt) {
+            free(lp->processed[keep]);
+            keep++;
+        }
+        for (j = keep; j < lp->processed_len; j++) {
+            lp->processed[j - keep] = lp->processed[j];
+        }
+        lp->processed_len -= keep;
+    }
+
+    return gvt == INFINITY;
+} //end tw_gvt_round
+
+static void* timewarp_worker(void* param) {
+    worker_t* self = (worker_t*)param;
+    long since_gvt = 0;
+    int i;
+    int n;
+
+    while (1) {
+        int progressed = 0;
+
+        if (atomic_load(&gvt_requested)) {
+            if (tw_gvt_round(self)) {
+                break;
+            }
+            since_gvt = 0;
+            continue;
+        }
+
+        for (i = self->first_office; i < self->end_office; i++) {
+            tw_receive(i, self);
+        }
+        for (i = self->first_office; i < self->end_office; i++) {
+            for (n = 0; n < TW_BATCH && tw_process_one(i, self->gvt + tw_window, self); n++) {
+                progressed++;
+            }
+        }
+
+        //Nothing left inside the window, or a lot of saved state: move GVT
+        since_gvt += progressed;
+        if (progressed == 0 || since_gvt >= TW_GVT_INTERVAL) {
+            atomic_store(&gvt_requested, 1);
+        }
+    } //end while
+
+    return NULL;
+} //end timewarp_worker
+
+static int run_timewarp(run_result_t* result) {
+    double start = wall_clock();
+    event_t ev;
+    int i;
+
+    lps = (tw_lp_t*)calloc((size_t)num_offices, sizeof(tw_lp_t));
+    if (lps == NULL) {
+        return -1;
+    }
+    atomic_store(&gvt_requested, 0);
+    atomic_store(&msgs_sent, 0);
+    atomic_store(&msgs_received, 0);
+
+    //Move each office's first arrivals into its Time Warp queue
+    for (i = 0; i < num_offices; i++) {
+        while (office_pop(&offices[i], &ev)) {
+            tw_event_t* e = (tw_event_t*)calloc(1, sizeof(tw_event_t));
+            e->ev = ev;
+            e->dest = i;
+            tw_heap_push(&lps[i], e);
+        }
+    }
+
+    if (run_workers(timewarp_worker) != 0) {
+        free(lps);
+        return -1;
+    }
+
+    for (i = 0; i < num_offices; i++) {
+        office_stats_add(&result->stats, &offices[i].stats);
+    }
+    for (i = 0; i < num_workers; i++) {
+        result->processed += workers[i].processed;
+        result->rolled_back += workers[i].rolled_back;
+        result->antis += workers[i].antis;
+    }
+    result->gvt_rounds = workers[0].gvt_rounds;
+    result->wall_seconds = wall_clock() - start;
+
+    //Only cancelled leftovers remain once GVT reaches infinity
+    for (i = 0; i < num_offices; i++) {
+        while (lps[i].pending_len > 0) {
+            free(tw_heap_pop(&lps[i]));
+        }
+        free(lps[i].pending);
+        free(lps[i].processed);
+    }
+    free(lps);
+    free(workers);
+    return 0;
+} //end run_timewarp
+
+/****************************************************************************
+* Function: run_engine
+* What it does: Builds a fresh department, runs one engine on it and tears
+*               it down again.
+* Outputs: 0 on success, -1 on failure (message already printed)
+****************************************************************************/
+static int run_engine(int engine, run_result_t* result) {
+    int status = 0;
+
+    if (setup_offices() != 0) {
+        printf("Error: unable to allocate offices.\n");
+        return -1;
+    }
+    memset(result, 0, sizeof(*result));
+
+    if (engine == ENGINE_SEQ) {
+        run_sequential(result);
+    } else if (engine == ENGINE_CONS) {
+        status = run_conservative(result);
+    } else {
+        status = run_timewarp(result);
+    }
+    if (status != 0) {
+        printf("Error: unable to allocate worker state.\n");
+    }
+
+    teardown_offices();
+    return status;
+} //end run_engine
+
+//Is `name` one of the comma-separated engines in `mode`?
+static int mode_has(const char* mode, const char* name) {
+    size_t len = strlen(name);
+
+    while (*mode != '\0') {
+        if (strncmp(mode, name, len) == 0 && (mode[len] == ',' || mode[len] == '\0')) {
+            return 1;
+        }
+        mode = strchr(mode, ',');
+        if (mode == NULL) {
+            break;
+        }
+        mode++;
+    }
+    return 0;
+} //end mode_has
+
+/****************************************************************************
+* Reporting helpers
+****************************************************************************/
+static void print_result(const char* name, const run_result_t* result) {
+    const office_stats_t* s = &result->stats;
+
+    printf("\n[%s]\n", name);
+    printf("  events handled    : %ld (%.2f M/s)\n", s->events,
+           s->events / result->wall_seconds / 1e6);
+    printf("  help sessions     : %ld\n", s->helped);
+    printf("  hallway full      : %ld of %ld visits\n", s->rejected, s->arrivals);
+    printf("  gave up waiting   : %ld of %ld seated (%.2f%%)\n", s->reneged, s->seated,
+           s->seated ? 100.0 * s->reneged / s->seated : 0.0);
+    printf("  office transfers  : %ld\n", s->transfers_out);
+    printf("  students finished : %ld\n", s->finished);
+    printf("  mean hallway wait : %.3f s (max %.1f s)\n",
+           s->seated ? s->wait_sum / s->seated : 0.0, s->wait_max);
+    if (result->windows > 0) {
+        printf("  windows           : %ld\n", result->windows);
+    }
+    if (result->gvt_rounds > 0) {
+        printf("  events run/undone : %ld / %ld (%.1f%% wasted)\n", result->processed,
+               result->rolled_back, 100.0 * result->rolled_back / result->processed);
+        printf("  anti-messages     : %ld\n", result->antis);
+        printf("  GVT rounds        : %ld\n", result->gvt_rounds);
+    }
+    printf("  wall time         : %.3f s\n", result->wall_seconds);
+} //end print_result
+
+static double wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,607 @@
+//TA_Batch.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+/****************************************************************************
+* Many independent replications of one office, side by side in SIMD lanes
+* One office with a single TA and num_chairs chairs is a tiny state machine:
+*   - time until the next student shows up
+*   - time until the TA finishes the current student
+*   - how many students sit in the hallway, and whether the TA is busy
+* Students arrive as a Poisson stream (mean gap -a seconds) and are helped
+* for -h seconds on average. A student who finds every chair taken leaves
+* (the "Hallway full" case in TA_Sim.c).
+*
+* Each SIMD lane is one replication. All lanes take one event per step in
+* lockstep; every decision is a mask, so there are no branches in the inner
+* loop. Times are kept as "seconds until", so single precision is enough.
+*
+* Build with -O3 -march=native: 16 lanes with AVX-512, 8 with AVX2.
+****************************************************************************/
+#if defined(__AVX512F__)
+#define LANES 16
+#elif defined(__AVX2__) || defined(__AVX__)
+#define LANES 8
+#else
+#define LANES 4
+#endif
+
+typedef float vfloat __attribute__((vector_size(LANES * 4)));
+typedef int32_t vint __attribute__((vector_size(LANES * 4)));
+typedef uint32_t vuint __attribute__((vector_size(LANES * 4)));
+
+#define FLUSH_STEPS 256                 //steps between single -> double flushes
+#define NUM_MEASURES 5                  //per-replication numbers (see rep_measures)
+#define AGREE_Z 4.0                     //-m both: engines differ beyond this many SEs
+
+/****************************************************************************
+* Global run settings
+****************************************************************************/
+int chairs_lo = 3;                      //chairs to try (lo..hi)
+int chairs_hi = 3;
+double arrival_mean = 6.0;              //mean seconds between students
+double help_mean = 5.0;                 //mean seconds of help (TA_Sim.c: 5)
+int help_exp = 1;                       //exponential help times (0 = always help_mean)
+long events_per_rep = 1000000;          //events simulated in each replication
+int reps_per_config = 256;              //replications per chairs value
+int num_threads = 0;                    //0 = one per core
+uint64_t run_seed = 521;
+
+//Totals of one replication (after warm-up)
+typedef struct {
+    double time;                        //simulated seconds
+    double queue_area;                  //integral of hallway length over time
+    double busy_area;                   //seconds the TA was busy
+    long arrivals;
+    long rejected;
+    long helped;
+} rep_result_t;
+
+typedef struct {
+    int first_batch;                    //batches [first_batch, end_batch)
+    int end_batch;
+    int vector;                         //1 = SIMD engine, 0 = scalar reference
+} job_t;
+
+static rep_result_t* results[2];        //one per replication: [0] scalar, [1] vector
+static int num_configs;
+static int batches_per_config;
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static void run_batch_vector(int batch);
+static void run_batch_scalar(int batch);
+static void* batch_thread(void* param);
+static double run_all(int vector);
+static void config_stats(const rep_result_t* res, int config, double mean[], double se[]);
+static void report(const rep_result_t* res, const char* engine);
+static int check_agreement(void);
+static double wall_clock(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    const char* mode = "vector";
+    double vector_seconds = 0.0;
+    double scalar_seconds = 0.0;
+    long helped[2] = { 0, 0 };
+    int mismatches = 0;
+    int total_reps;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "c:a:h:de:R:T:m:S:")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (sscanf(optarg, "%d:%d", &chairs_lo, &chairs_hi) != 2) {
+                chairs_hi = chairs_lo = atoi(optarg);
+            }
+            break;
+        case 'a': arrival_mean = atof(optarg); break;
+        case 'h': help_mean = atof(optarg); break;
+        case 'd': help_exp = 0; break;
+        case 'e': events_per_rep = atol(optarg); break;
+        case 'R': reps_per_config = atoi(optarg); break;
+        case 'T': num_threads = atoi(optarg); break;
+        case 'm': mode = optarg; break;
+        case 'S': run_seed = strtoull(optarg, NULL, 10); break;
+        default:
+            printf("Usage: %s [-c chairs | -c lo:hi] [-a mean arrival gap] [-h mean help]\n"
+                   "          [-d (fixed help time)] [-e events/replication]\n"
+                   "          [-R replications] [-T threads] [-m vector|scalar|both] [-S seed]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    if (chairs_lo < 1 || chairs_hi < chairs_lo || arrival_mean <= 0.0 || help_mean <= 0.0 ||
+        events_per_rep <= 0 || reps_per_config <= 0) {
+        printf("Invalid input. Exiting.\n");
+        return 1;
+    }
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    //Round replications up to whole SIMD batches
+    batches_per_config = (reps_per_config + LANES - 1) / LANES;
+    reps_per_config = batches_per_config * LANES;
+    num_configs = chairs_hi - chairs_lo + 1;
+    total_reps = num_configs * reps_per_config;
+
+    results[0] = (rep_result_t*)calloc((size_t)total_reps, sizeof(rep_result_t));
+    results[1] = (rep_result_t*)calloc((size_t)total_reps, sizeof(rep_result_t));
+    if (results[0] == NULL || results[1] == NULL) {
+        printf("Error: unable to allocate results.\n");
+        free(results[0]);
+        free(results[1]);
+        return 1;
+    }
+
+    printf("%d lanes, %d thread(s), %d replication(s) x %ld events per chairs value\n",
+           LANES, num_threads, reps_per_config, events_per_rep);
+
+    if (strcmp(mode, "scalar") == 0 || strcmp(mode, "both") == 0) {
+        scalar_seconds = run_all(0);
+        report(results[0], "scalar");
+    }
+    if (strcmp(mode, "vector") == 0 || strcmp(mode, "both") == 0) {
+        vector_seconds = run_all(1);
+        report(results[1], "vector");
+    }
+    if (scalar_seconds > 0.0 && vector_seconds > 0.0) {
+        mismatches = check_agreement();
+    }
+
+    for (i = 0; i < total_reps; i++) {
+        helped[0] += results[0][i].helped;
+        helped[1] += results[1][i].helped;
+    }
+    if (scalar_seconds > 0.0) {
+        printf("scalar: %.3f s, %.1f M help sessions/s\n", scalar_seconds,
+               helped[0] / scalar_seconds / 1e6);
+    }
+    if (vector_seconds > 0.0) {
+        printf("vector: %.3f s, %.1f M help sessions/s\n", vector_seconds,
+               helped[1] / vector_seconds / 1e6);
+    }
+    if (scalar_seconds > 0.0 && vector_seconds > 0.0) {
+        printf("SIMD speedup: %.2fx\n", scalar_seconds / vector_seconds);
+    }
+
+    free(results[0]);
+    free(results[1]);
+    return mismatches > 0;
+} //end main
+
+/****************************************************************************
+* Random numbers: xoshiro128+ with one 32-bit state word per lane in each
+* of four vectors, so every lane advances its own stream at once
+****************************************************************************/
+typedef struct {
+    vuint s0, s1, s2, s3;
+} vrng_t;
+
+static uint64_t splitmix(uint64_t* x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+//Seeds the stream of replication `rep` (lane-independent of the engine)
+static void seed_lane(uint32_t state[4], int rep) {
+    uint64_t x = run_seed ^ ((uint64_t)(rep + 1) * 0xD1B54A32D192ED03ULL);
+    uint64_t a = splitmix(&x);
+    uint64_t b = splitmix(&x);
+
+    state[0] = (uint32_t)a;
+    state[1] = (uint32_t)(a >> 32);
+    state[2] = (uint32_t)b;
+    state[3] = (uint32_t)(b >> 32) | 1; //never all zero
+}
+
+static inline vuint vrng_next(vrng_t* r) {
+    vuint result = r->s0 + r->s3;
+    vuint t = r->s1 << 9;
+
+    r->s2 ^= r->s0;
+    r->s3 ^= r->s1;
+    r->s1 ^= r->s2;
+    r->s0 ^= r->s3;
+    r->s2 ^= t;
+    r->s3 = (r->s3 << 11) | (r->s3 >> 21);
+    return result;
+}
+
+static inline uint32_t rng_next(uint32_t s[4]) {
+    uint32_t result = s[0] + s[3];
+    uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 11) | (s[3] >> 21);
+    return result;
+}
+
+static inline vfloat vselect(vint mask, vfloat a, vfloat b) {
+    return (vfloat)(((vint)a & mask) | ((vint)b & ~mask));
+}
+
+/****************************************************************************
+* Function: vexp_draw
+* What it does: Exponential delays with the given mean for every lane:
+*               -mean * ln(u) with u uniform in (0, 1]. ln is computed from
+*               the float's exponent plus a short atanh series on the
+*               mantissa (error around 1e-7), so it stays in registers.
+****************************************************************************/
+static inline vfloat vexp_draw(vrng_t* r, float mean) {
+    const vfloat one = (vfloat){ 0 } + 1.0f;
+    vuint bits = vrng_next(r);
+    vfloat u = __builtin_convertvector((bits >> 8) + 1, vfloat) * (1.0f / 16777216.0f);
+    vint ui = (vint)u;
+    vint e = ((ui >> 23) & 0xff) - 127;
+    vfloat m = (vfloat)((ui & 0x007fffff) | 0x3f800000); //mantissa in [1, 2)
+    vint big = m > 1.41421356f;
+    vfloat s;
+    vfloat s2;
+    vfloat ln;
+
+    //Keep the mantissa within [0.707, 1.414) so the series converges fast
+    m = vselect(big, m * 0.5f, m);
+    e -= big;
+    s = (m - one) / (m + one);
+    s2 = s * s;
+    ln = 2.0f * s * (1.0f + s2 * (1.0f / 3.0f + s2 * (1.0f / 5.0f + s2 * (1.0f / 7.0f))));
+    ln += __builtin_convertvector(e, vfloat) * 0.69314718f;
+    return -mean * ln;
+} //end vexp_draw
+
+static inline float exp_draw(uint32_t s[4], float mean) {
+    float u = (float)((rng_next(s) >> 8) + 1) * (1.0f / 16777216.0f);
+    return -mean * logf(u);
+}
+
+/****************************************************************************
+* Function: run_batch_vector
+* What it does: Runs LANES replications of one chairs value in lockstep.
+* Inputs: batch -> batch number; replications batch*LANES .. +LANES-1
+****************************************************************************/
+static void run_batch_vector(int batch) {
+    int config = batch / batches_per_config;
+    int first_rep = batch * LANES;
+    const float help_f = (float)help_mean;
+    const vfloat idle = (vfloat){ 0 } + INFINITY;
+    const vint chairs = (vint){ 0 } + (chairs_lo + config);
+    double time[LANES] = { 0 };
+    double queue_area[LANES] = { 0 };
+    double busy_area[LANES] = { 0 };
+    uint32_t seeds[4][LANES];
+    vrng_t rng;
+    vfloat until_arrival;
+    vfloat until_done = idle;
+    vfloat acc_time;
+    vfloat acc_queue;
+    vfloat acc_busy;
+    vint waiting = { 0 };
+    vint busy = { 0 };
+    vint arrivals = { 0 };
+    vint rejected = { 0 };
+    vint helped = { 0 };
+    long warmup = events_per_rep / 10;
+    long step = 0;
+    int lane;
+
+    for (lane = 0; lane < LANES; lane++) {
+        uint32_t state[4];
+        seed_lane(state, first_rep + lane);
+        seeds[0][lane] = state[0];
+        seeds[1][lane] = state[1];
+        seeds[2][lane] = state[2];
+        seeds[3][lane] = state[3];
+    }
+    memcpy(&rng.s0, seeds[0], sizeof(vuint));
+    memcpy(&rng.s1, seeds[1], sizeof(vuint));
+    memcpy(&rng.s2, seeds[2], sizeof(vuint));
+    memcpy(&rng.s3, seeds[3], sizeof(vuint));
+    until_arrival = vexp_draw(&rng, (float)arrival_mean);
+
+    while (step < events_per_rep) {
+        long chunk_end = step + FLUSH_STEPS;
+        if (chunk_end > events_per_rep) {
+            chunk_end = events_per_rep;
+        }
+        if (warmup > 0 && chunk_end > warmup) {
+            chunk_end = warmup; //end the warm-up on the same step as the scalar engine
+        }
+        acc_time = acc_queue = acc_busy = (vfloat){ 0 };
+
+        for (; step < chunk_end; step++) {
+            vint arrive = until_arrival <= until_done;
+            vint depart = ~arrive;
+            vfloat dt = vselect(arrive, until_arrival, until_done);
+            vfloat new_arrival = vexp_draw(&rng, (float)arrival_mean);
+            vfloat new_help = help_exp ? vexp_draw(&rng, help_f) : (vfloat){ 0 } + help_f;
+            vint wake = arrive & ~busy;             //TA asleep: help right away
+            vint sit = arrive & busy & (waiting < chairs);
+            vint full = arrive & busy & ~(waiting < chairs);
+            vint call_next = depart & (waiting > 0);
+            vint sleep_again = depart & ~(waiting > 0);
+
+            acc_time += dt;
+            acc_queue += __builtin_convertvector(waiting, vfloat) * dt;
+            acc_busy += vselect(busy, dt, (vfloat){ 0 });
+            until_arrival -= dt;
+            until_done -= dt;
+
+            //Masks are -1 where true, so subtracting one adds 1
+            waiting = waiting - sit + call_next;
+            busy = (busy | wake) & ~sleep_again;
+            arrivals -= arrive;
+            rejected -= full;
+            helped -= depart;
+            until_done = vselect(wake | call_next, new_help,
+                                 vselect(sleep_again, idle, until_done));
+            until_arrival = vselect(arrive, new_arrival, until_arrival);
+        } //end for (each step)
+
+        for (lane = 0; lane < LANES; lane++) {
+            time[lane] += acc_time[lane];
+            queue_area[lane] += acc_queue[lane];
+            busy_area[lane] += acc_busy[lane];
+        }
+
+        //Drop the warm-up period from the statistics
+        if (warmup > 0 && step >= warmup) {
+            memset(time, 0, sizeof(time));
+            memset(queue_area, 0, sizeof(queue_area));
+            memset(busy_area, 0, sizeof(busy_area));
+            arrivals = rejected = helped = (vint){ 0 };
+            warmup = 0;
+        }
+    } //end while
+
+    for (lane = 0; lane < LANES; lane++) {
+        rep_result_t* r = &results[1][first_rep + lane];
+        r->time = time[lane];
+        r->queue_area = queue_area[lane];
+        r->busy_area = busy_area[lane];
+        r->arrivals = arrivals[lane];
+        r->rejected = rejected[lane];
+        r->helped = helped[lane];
+    }
+} //end run_batch_vector
+
+/****************************************************************************
+* Function: run_batch_scalar
+* What it does: Same replications as run_batch_vector, one at a time with
+*               ordinary branches (reference for the speedup).
+****************************************************************************/
+static void run_batch_scalar(int batch) {
+    int config = batch / batches_per_config;
+    int chairs = chairs_lo + config;
+    int lane;
+
+    for (lane = 0; lane < LANES; lane++) {
+        rep_result_t* r = &results[0][batch * LANES + lane];
+        uint32_t s[4];
+        float until_arrival;
+        float until_done = INFINITY;
+        int waiting = 0;
+        int busy = 0;
+        long warmup = events_per_rep / 10;
+        long step;
+
+        seed_lane(s, batch * LANES + lane);
+        until_arrival = exp_draw(s, (float)arrival_mean);
+        memset(r, 0, sizeof(*r));
+
+        for (step = 0; step < events_per_rep; step++) {
+            float dt = until_arrival <= until_done ? until_arrival : until_done;
+
+            if (step == warmup) {
+                memset(r, 0, sizeof(*r));
+            }
+            r->time += dt;
+            r->queue_area += waiting * dt;
+            if (busy) {
+                r->busy_area += dt;
+            }
+            until_arrival -= dt;
+            until_done -= dt;
+
+            if (until_arrival <= 0.0f) {
+                r->arrivals++;
+                if (!busy) {
+                    busy = 1;
+                    until_done = help_exp ? exp_draw(s, (float)help_mean) : (float)help_mean;
+                } else if (waiting < chairs) {
+                    waiting++;
+                } else {
+                    r->rejected++;
+                }
+                until_arrival = exp_draw(s, (float)arrival_mean);
+            } else {
+                r->helped++;
+                if (waiting > 0) {
+                    waiting--;
+                    until_done = help_exp ? exp_draw(s, (float)help_mean) : (float)help_mean;
+                } else {
+                    busy = 0;
+                    until_done = INFINITY;
+                }
+            }
+        } //end for (each step)
+    } //end for (each lane)
+} //end run_batch_scalar
+
+static void* batch_thread(void* param) {
+    job_t* job = (job_t*)param;
+    int batch;
+
+    for (batch = job->first_batch; batch < job->end_batch; batch++) {
+        if (job->vector) {
+            run_batch_vector(batch);
+        } else {
+            run_batch_scalar(batch);
+        }
+    }
+    return NULL;
+} //end batch_thread
+
+/****************************************************************************
+* Function: run_all
+* What it does: Splits every batch of every chairs value over the threads.
+* Outputs: wall-clock seconds taken
+****************************************************************************/
+static double run_all(int vector) {
+    int total_batches = num_configs * batches_per_config;
+    pthread_t* handles = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)num_threads);
+    job_t* jobs = (job_t*)malloc(sizeof(job_t) * (size_t)num_threads);
+    double start = wall_clock();
+    int i;
+
+    for (i = 0; i < num_threads; i++) {
+        jobs[i].first_batch = (int)((long)total_batches * i / num_threads);
+        jobs[i].end_batch = (int)((long)total_batches * (i + 1) / num_threads);
+        jobs[i].vector = vector;
+        if (i > 0 && pthread_create(&handles[i], NULL, batch_thread, &jobs[i]) != 0) {
+            printf("Error: unable to create thread %d; running its share inline.\n", i);
+            batch_thread(&jobs[i]);
+            jobs[i].end_batch = -1; //nothing to join
+        }
+    }
+    batch_thread(&jobs[0]);
+    for (i = 1; i < num_threads; i++) {
+        if (jobs[i].end_batch >= 0) {
+            pthread_join(handles[i], NULL);
+        }
+    }
+
+    free(handles);
+    free(jobs);
+    return wall_clock() - start;
+} //end run_all
+
+/****************************************************************************
+* Function: config_stats
+* What it does: Mean and standard error over the replications of one
+*               chairs value of: P(hallway full), mean hallway length, TA
+*               utilization, mean wait (Little's law) and help sessions
+*               per second.
+* Inputs: res -> one engine's results
+*         config -> chairs value (0 = chairs_lo)
+*         mean, se -> NUM_MEASURES values each
+****************************************************************************/
+static void config_stats(const rep_result_t* res, int config, double mean[], double se[]) {
+    double sum[NUM_MEASURES] = { 0 };
+    double sum_sq[NUM_MEASURES] = { 0 };
+    int n = reps_per_config;
+    int i;
+    int k;
+
+    for (i = 0; i < n; i++) {
+        const rep_result_t* r = &res[config * n + i];
+        double value[NUM_MEASURES];
+        value[0] = r->arrivals ? (double)r->rejected / r->arrivals : 0.0;
+        value[1] = r->time > 0.0 ? r->queue_area / r->time : 0.0;
+        value[2] = r->time > 0.0 ? r->busy_area / r->time : 0.0;
+        value[3] = r->helped ? r->queue_area / r->helped : 0.0; //Little's law
+        value[4] = r->time > 0.0 ? r->helped / r->time : 0.0;
+        for (k = 0; k < NUM_MEASURES; k++) {
+            sum[k] += value[k];
+            sum_sq[k] += value[k] * value[k];
+        }
+    }
+    for (k = 0; k < NUM_MEASURES; k++) {
+        double var;
+        mean[k] = sum[k] / n;
+        var = n > 1 ? (sum_sq[k] - n * mean[k] * mean[k]) / (n - 1) : 0.0;
+        se[k] = sqrt(var > 0.0 ? var / n : 0.0);
+    }
+} //end config_stats
+
+/****************************************************************************
+* Function: report
+* What it does: Prints, for each chairs value, the mean over replications
+*               and a 95% confidence half-width of the key numbers.
+* Inputs: res -> one engine's results
+*         engine -> its name for the heading
+****************************************************************************/
+static void report(const rep_result_t* res, const char* engine) {
+    int config;
+
+    printf("\n%s engine\n", engine);
+    printf("chairs  P(hallway full)        mean waiting        TA busy            mean wait (s)\n");
+    for (config = 0; config < num_configs; config++) {
+        double mean[NUM_MEASURES];
+        double se[NUM_MEASURES];
+        int k;
+
+        config_stats(res, config, mean, se);
+        printf("%6d", chairs_lo + config);
+        for (k = 0; k < 4; k++) {
+            printf("  %8.5f +/- %-7.5f", mean[k], 1.96 * se[k]);
+        }
+        printf("\n");
+    }
+    printf("\n");
+} //end report
+
+/****************************************************************************
+* Function: check_agreement
+* What it does: With -m both, compares the two engines chairs value by
+*               chairs value. They draw their random numbers differently,
+*               so they agree in distribution, not bit for bit: each
+*               difference is divided by its standard error, and one
+*               beyond AGREE_Z is flagged (a correct pair goes that far by
+*               chance less than once in 10000 checks).
+* Outputs: the number of flagged numbers
+****************************************************************************/
+static int check_agreement(void) {
+    static const int checked[3] = { 0, 1, 4 };
+    int mismatches = 0;
+    int config;
+    int j;
+
+    printf("scalar vs vector (z = difference / standard error, flagged beyond %.0f)\n",
+           AGREE_Z);
+    printf("chairs  P(hallway full)   z      mean waiting      z      helps/s           z\n");
+    for (config = 0; config < num_configs; config++) {
+        double mean[2][NUM_MEASURES];
+        double se[2][NUM_MEASURES];
+        int off = 0;
+
+        config_stats(results[0], config, mean[0], se[0]);
+        config_stats(results[1], config, mean[1], se[1]);
+        printf("%6d", chairs_lo + config);
+        for (j = 0; j < 3; j++) {
+            int k = checked[j];
+            double spread = sqrt(se[0][k] * se[0][k] + se[1][k] * se[1][k]);
+            double z = spread > 0.0 ? (mean[1][k] - mean[0][k]) / spread : 0.0;
+            off += fabs(z) > AGREE_Z;
+            printf("  %7.5f %7.5f %+5.1f", mean[0][k], mean[1][k], z);
+        }
+        printf("%s\n", off ? "  MISMATCH" : "");
+        mismatches += off;
+    }
+    printf("\n");
+    return mismatches;
+} //end check_agreement
+
+static double wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,205 @@
+//TA_Host.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include "office_model.h"
+#include "tasim.h"
+
+/****************************************************************************
+* Many small what-if simulations in one process
+* Generates -n office simulations of very different sizes (a few dozen to
+* a few thousand students, different chairs, TAs and times) and runs them
+* all at once on the libtasim host: a fixed set of threads, one per core,
+* however many simulations there are. Each simulation runs -q events at a
+* time and then waits its turn again, so a small simulation is never stuck
+* behind a big one. -m caps how much memory each simulation may use.
+*
+* -f runs every simulation to the end in one go instead (first come,
+* first served), to compare how long the small ones have to wait.
+****************************************************************************/
+
+/****************************************************************************
+* Global run settings
+****************************************************************************/
+int num_sims = 300;
+int max_students = 3000;                //largest simulation
+int num_threads = 0;                    //0 = one per core
+long quantum = 2000;                    //events per slice
+long quota_kb = 0;                      //memory per simulation (0 = no limit)
+int fifo = 0;                           //-f: no slices, run each to the end
+uint64_t run_seed = 521;
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static void make_config(tasim_config_t* config, uint64_t* rng);
+static int by_events(const void* a, const void* b);
+static int count_threads(void);
+static double wall_clock(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    tasim_config_t* configs;
+    tasim_result_t* results;
+    tasim_result_t** order;
+    tasim_host_t* host;
+    uint64_t rng;
+    double start;
+    double elapsed;
+    double small_wait = 0.0;
+    double large_wait = 0.0;
+    long events = 0;
+    int threads_seen;
+    int over_quota = 0;
+    int failed = 0;
+    int tenth;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:s:T:q:m:fS:")) != -1) {
+        switch (opt) {
+        case 'n': num_sims = atoi(optarg); break;
+        case 's': max_students = atoi(optarg); break;
+        case 'T': num_threads = atoi(optarg); break;
+        case 'q': quantum = atol(optarg); break;
+        case 'm': quota_kb = atol(optarg); break;
+        case 'f': fifo = 1; break;
+        case 'S': run_seed = strtoull(optarg, NULL, 10); break;
+        default:
+            printf("Usage: %s [-n simulations] [-s max students] [-T threads]\n"
+                   "          [-q events per slice] [-m memory quota (KB)] [-f] [-S seed]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+    if (num_sims <= 0 || max_students < 10 || quantum <= 0 || quota_kb < 0) {
+        printf("Invalid input. Exiting.\n");
+        return 1;
+    }
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    configs = (tasim_config_t*)calloc((size_t)num_sims, sizeof(tasim_config_t));
+    results = (tasim_result_t*)calloc((size_t)num_sims, sizeof(tasim_result_t));
+    order = (tasim_result_t**)malloc(sizeof(tasim_result_t*) * (size_t)num_sims);
+    host = tasim_host_create(num_threads, fifo ? LONG_MAX : quantum);
+    if (configs == NULL || results == NULL || order == NULL || host == NULL) {
+        printf("Error: unable to start the host.\n");
+        return 1;
+    }
+    rng = run_seed;
+    for (i = 0; i < num_sims; i++) {
+        make_config(&configs[i], &rng);
+    }
+
+    start = wall_clock();
+    for (i = 0; i < num_sims; i++) {
+        if (tasim_host_submit(host, &configs[i], 1, (size_t)quota_kb * 1024,
+                              &results[i]) != 0) {
+            printf("Error: unable to submit simulation %d.\n", i);
+            return 1;
+        }
+    }
+    threads_seen = count_threads();
+    tasim_host_wait(host);
+    elapsed = wall_clock() - start;
+    tasim_host_destroy(host);
+
+    for (i = 0; i < num_sims; i++) {
+        events += results[i].stats.events;
+        over_quota += results[i].over_quota;
+        failed += !results[i].ok;
+        order[i] = &results[i];
+    }
+
+    //How long the smallest and the largest tenth of the simulations took
+    qsort(order, (size_t)num_sims, sizeof(order[0]), by_events);
+    tenth = num_sims >= 10 ? num_sims / 10 : 1;
+    for (i = 0; i < tenth; i++) {
+        small_wait += order[i]->wall_time;
+        large_wait += order[num_sims - 1 - i]->wall_time;
+    }
+
+    printf("%d simulations on %d host thread(s) (%d threads in the process), %s\n",
+           num_sims, num_threads, threads_seen,
+           fifo ? "each run to the end" : "taking turns");
+    printf("  wall time         : %.3f s\n", elapsed);
+    printf("  events handled    : %ld (%.2f M/s)\n", events, events / elapsed / 1e6);
+    printf("  smallest 10%%      : done after %.3f s on average (%ld events or fewer)\n",
+           small_wait / tenth, order[tenth - 1]->stats.events);
+    printf("  largest 10%%       : done after %.3f s on average (%ld events or more)\n",
+           large_wait / tenth, order[num_sims - tenth]->stats.events);
+    printf("  over memory quota : %d\n", over_quota);
+    if (failed > 0) {
+        printf("  out of memory     : %d\n", failed);
+    }
+
+    free(configs);
+    free(results);
+    free(order);
+    return 0;
+} //end main
+
+/****************************************************************************
+* Function: make_config
+* What it does: Draws one random office. Student counts are spread evenly
+*               on a log scale from 10 to max_students, so most simulations
+*               are small and a few are big.
+****************************************************************************/
+static void make_config(tasim_config_t* config, uint64_t* rng) {
+    office_default_params(&config->params);
+    config->num_students = (int)(10.0 * pow(max_students / 10.0, rng_uniform(rng)));
+    config->params.num_chairs = 1 + (int)(rng_uniform(rng) * 8);
+    config->params.num_tas = 1 + (int)(rng_uniform(rng) * 3);
+    config->params.help_requests = 5 + (int)(rng_uniform(rng) * 16);
+    config->params.program_time.kind = DIST_EXP;
+    config->params.help_time.kind = DIST_EXP;
+    config->params.help_time.a = 2.0 + 8.0 * rng_uniform(rng);
+    //Keep the TAs about 60-90% busy
+    config->params.program_time.a = config->num_students * config->params.help_time.a /
+                                    (config->params.num_tas * (0.6 + 0.3 * rng_uniform(rng)));
+    if (rng_uniform(rng) < 0.3) {
+        config->params.patience.kind = DIST_EXP;
+        config->params.patience.a = 30.0;
+    }
+    config->seed = (uint64_t)(rng_uniform(rng) * 1e18);
+    config->until = INFINITY;
+} //end make_config
+
+static int by_events(const void* a, const void* b) {
+    long x = (*(tasim_result_t* const*)a)->stats.events;
+    long y = (*(tasim_result_t* const*)b)->stats.events;
+    return (x > y) - (x < y);
+}
+
+//Threads in this process right now (Linux)
+static int count_threads(void) {
+    FILE* in = fopen("/proc/self/status", "r");
+    char line[256];
+    int threads = -1;
+
+    if (in == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (sscanf(line, "Threads: %d", &threads) == 1) {
+            break;
+        }
+    }
+    fclose(in);
+    return threads;
+} //end count_threads
+
+static double wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
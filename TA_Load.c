@@ -0,0 +1,423 @@
+//TA_Load.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include "office_model.h"
+#include "ta_wire.h"
+
+/****************************************************************************
+* Load generator for TA_Server
+* Opens -c connections, one per student, all driven from one thread and
+* one epoll loop. Each student programs for a time drawn from -P, sends a
+* help request and waits for the reply; "Hallway full" sends it back to
+* retry after -R seconds, like TA_Sim.c. Student wake-ups are kept in a
+* min-heap and a single timerfd is armed for the earliest one.
+*
+* After -t seconds it prints:
+*   - "Hallway full" turnaround: request sent to reply read, which is
+*     pure server and socket overhead
+*   - lateness of "helped" replies: time to the reply minus the waiting
+*     and help time the server reports, so how late the TA's timer fired
+*     and the reply arrived
+****************************************************************************/
+
+#define MAX_EVENTS 256
+
+typedef struct {
+    int fd;
+    uint32_t seq;
+    double sent_at;                     //0 while programming
+    char in[sizeof(help_reply_t)];      //partial reply
+    size_t in_len;
+    uint64_t rng;
+} student_conn_t;
+
+typedef struct {
+    double time;
+    int student;
+} wakeup_t;
+
+typedef struct {
+    double* v;
+    long count;
+    long cap;
+} samples_t;
+
+/****************************************************************************
+* Global run settings and state
+****************************************************************************/
+int num_conns = 1000;
+double duration = 10.0;
+dist_t program_time = { DIST_EXP, 1.0, 0.0 };
+double retry_time = 0.1;
+
+student_conn_t* students;
+wakeup_t* wakeups;                      //min-heap on time
+int num_wakeups = 0;
+int epoll_fd;
+int timer_fd;
+double armed_for = -1.0;                //deadline the timerfd is set to
+
+samples_t full_turnaround;
+samples_t helped_late;
+long sent = 0;
+long lost = 0;                          //connections the server closed
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static int connect_student(const char* path);
+static void send_request(int s);
+static void read_reply(int s);
+static void wake_at(int s, double time);
+static int pop_wakeup(void);
+static void arm_timer(void);
+static void add_sample(samples_t* samples, double value);
+static void print_percentiles(const char* name, samples_t* samples);
+static int by_value(const void* a, const void* b);
+static double now_sec(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event ev;
+    struct rlimit limit;
+    const char* path = "TA_Server.sock";
+    double start;
+    double stop_at;
+    double elapsed;
+    int opt;
+    int n;
+    int i;
+
+    while ((opt = getopt(argc, argv, "c:t:P:R:")) != -1) {
+        switch (opt) {
+        case 'c': num_conns = atoi(optarg); break;
+        case 't': duration = atof(optarg); break;
+        case 'P':
+            if (dist_parse(&program_time, optarg) != 0) {
+                printf("Bad program time '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R': retry_time = atof(optarg); break;
+        default:
+            printf("Usage: %s [-c connections] [-t seconds] [-P program time] [-R retry]"
+                   " [socket path]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        path = argv[optind];
+    }
+    if (num_conns <= 0 || duration <= 0.0 || retry_time < 0.0 ||
+        program_time.kind == DIST_NEVER) {
+        printf("Invalid input. Exiting.\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);           //a server that went away shows as EPIPE instead
+
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if ((rlim_t)num_conns + 16 > limit.rlim_cur) {
+        printf("Error: only %ld open files allowed, %d connections asked for.\n",
+               (long)limit.rlim_cur, num_conns);
+        return 1;
+    }
+
+    students = (student_conn_t*)calloc((size_t)num_conns, sizeof(student_conn_t));
+    wakeups = (wakeup_t*)malloc(sizeof(wakeup_t) * (size_t)num_conns);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (students == NULL || wakeups == NULL || epoll_fd < 0 || timer_fd < 0) {
+        printf("Error: unable to set up the load generator.\n");
+        return 1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)num_conns; //the timer is the entry past the last student
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    //Connect everyone first, then start the clock
+    for (i = 0; i < num_conns; i++) {
+        students[i].fd = connect_student(path);
+        if (students[i].fd < 0) {
+            printf("Error: connection %d to %s failed (%s).\n", i, path, strerror(errno));
+            return 1;
+        }
+        students[i].rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u32 = (uint32_t)i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, students[i].fd, &ev);
+    }
+    printf("%d students connected to %s.\n", num_conns, path);
+
+    start = now_sec();
+    stop_at = start + duration;
+    for (i = 0; i < num_conns; i++) {
+        wake_at(i, start + dist_draw(&program_time, &students[i].rng));
+    }
+    arm_timer();
+
+    while (now_sec() < stop_at) {
+        n = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
+        for (i = 0; i < n; i++) {
+            int s = (int)events[i].data.u32;
+
+            if (s == num_conns) {
+                uint64_t expirations;
+                double now = now_sec();
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    break;
+                }
+                armed_for = -1.0;
+                //Everyone whose programming time is up asks for help
+                while (num_wakeups > 0 && wakeups[0].time <= now) {
+                    int next = pop_wakeup();
+                    send_request(next);
+                } //end while
+                arm_timer();
+            } else {
+                read_reply(s);
+            }
+        } //end for (each ready fd)
+    } //end while
+    elapsed = now_sec() - start;
+
+    printf("Ran %.2f s: %ld requests (%.0f/s), %ld helped, %ld hallway full",
+           elapsed, sent, sent / elapsed, helped_late.count, full_turnaround.count);
+    if (lost > 0) {
+        printf(", %ld connections lost", lost);
+    }
+    printf("\n");
+    print_percentiles("hallway-full turnaround", &full_turnaround);
+    print_percentiles("helped reply lateness  ", &helped_late);
+
+    for (i = 0; i < num_conns; i++) {
+        if (students[i].fd >= 0) {
+            close(students[i].fd);
+        }
+    }
+    free(students);
+    free(wakeups);
+    free(full_turnaround.v);
+    free(helped_late.v);
+    return 0;
+} //end main
+
+/****************************************************************************
+* Function: connect_student
+* What it does: Opens one connection (a blocking connect, so a full
+*               listen backlog just waits for the server to catch up)
+*               and then makes it non-blocking for the event loop.
+* Outputs: The socket, or -1.
+****************************************************************************/
+static int connect_student(const char* path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+} //end connect_student
+
+/****************************************************************************
+* Function: send_request / read_reply
+* What it does: send_request asks the TA for help. read_reply takes the
+*               answer, records its latency and sends the student back to
+*               programming (helped) or to retry later (hallway full).
+****************************************************************************/
+static void send_request(int s) {
+    student_conn_t* st = &students[s];
+    help_request_t req;
+
+    if (st->fd < 0) {
+        return;
+    }
+    req.seq = ++st->seq;
+    req.student = (uint32_t)s;
+    st->sent_at = now_sec();
+    //8 bytes into an empty socket buffer always go in whole
+    if (write(st->fd, &req, sizeof(req)) != (ssize_t)sizeof(req)) {
+        close(st->fd);
+        st->fd = -1;
+        lost++;
+        return;
+    }
+    sent++;
+} //end send_request
+
+static void read_reply(int s) {
+    student_conn_t* st = &students[s];
+    help_reply_t reply;
+    ssize_t got;
+    double now;
+
+    while (st->fd >= 0) {
+        got = read(st->fd, st->in + st->in_len, sizeof(st->in) - st->in_len);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, st->fd, NULL);
+            close(st->fd);
+            st->fd = -1;
+            lost++;
+            return;
+        }
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        st->in_len += (size_t)got;
+        if (st->in_len < sizeof(reply)) {
+            continue;
+        }
+        memcpy(&reply, st->in, sizeof(reply));
+        st->in_len = 0;
+        if (reply.seq != st->seq) {
+            continue;
+        }
+
+        now = now_sec();
+        if (reply.status == REPLY_FULL) {
+            add_sample(&full_turnaround, now - st->sent_at);
+            wake_at(s, now + retry_time);
+        } else {
+            add_sample(&helped_late, now - st->sent_at - reply.waited - reply.helped_for);
+            wake_at(s, now + dist_draw(&program_time, &st->rng));
+        }
+        st->sent_at = 0.0;
+    } //end while
+} //end read_reply
+
+/****************************************************************************
+* Function: wake_at / pop_wakeup / arm_timer
+* What it does: wake_at puts a student on the wake-up heap and pop_wakeup
+*               takes the earliest one off; arm_timer sets
+*               the timerfd to the earliest wake-up if it is not already.
+****************************************************************************/
+static void wake_at(int s, double time) {
+    int k = num_wakeups++;
+
+    wakeups[k].time = time;
+    wakeups[k].student = s;
+    while (k > 0 && wakeups[(k - 1) / 2].time > wakeups[k].time) {
+        wakeup_t t = wakeups[k];
+        wakeups[k] = wakeups[(k - 1) / 2];
+        wakeups[(k - 1) / 2] = t;
+        k = (k - 1) / 2;
+    }
+    if (k == 0) {
+        arm_timer();
+    }
+} //end wake_at
+
+static int pop_wakeup(void) {
+    int s = wakeups[0].student;
+    int k = 0;
+
+    wakeups[0] = wakeups[--num_wakeups];
+    while (1) {
+        int l = 2 * k + 1;
+        int m = k;
+        wakeup_t t;
+        if (l < num_wakeups && wakeups[l].time < wakeups[m].time) {
+            m = l;
+        }
+        if (l + 1 < num_wakeups && wakeups[l + 1].time < wakeups[m].time) {
+            m = l + 1;
+        }
+        if (m == k) {
+            break;
+        }
+        t = wakeups[k];
+        wakeups[k] = wakeups[m];
+        wakeups[m] = t;
+        k = m;
+    } //end while
+    return s;
+} //end pop_wakeup
+
+static void arm_timer(void) {
+    struct itimerspec when;
+    double t;
+
+    if (num_wakeups == 0 || wakeups[0].time == armed_for) {
+        return;
+    }
+    t = wakeups[0].time;
+    memset(&when, 0, sizeof(when));
+    when.it_value.tv_sec = (time_t)t;
+    when.it_value.tv_nsec = (long)((t - (double)(time_t)t) * 1e9);
+    if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0) {
+        when.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+    armed_for = t;
+} //end arm_timer
+
+/****************************************************************************
+* Function: add_sample / print_percentiles
+* What it does: Collects latencies and prints p50, p99, p99.9 and the
+*               maximum in microseconds.
+****************************************************************************/
+static void add_sample(samples_t* samples, double value) {
+    if (samples->count == samples->cap) {
+        long cap = samples->cap > 0 ? samples->cap * 2 : 4096;
+        double* bigger = (double*)realloc(samples->v, sizeof(double) * (size_t)cap);
+        if (bigger == NULL) {
+            return;
+        }
+        samples->v = bigger;
+        samples->cap = cap;
+    }
+    samples->v[samples->count++] = value;
+} //end add_sample
+
+static void print_percentiles(const char* name, samples_t* samples) {
+    long c = samples->count;
+
+    if (c == 0) {
+        printf("  %s : no samples\n", name);
+        return;
+    }
+    qsort(samples->v, (size_t)c, sizeof(double), by_value);
+    printf("  %s : p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n", name,
+           samples->v[c / 2] * 1e6, samples->v[c * 99 / 100] * 1e6,
+           samples->v[c * 999 / 1000] * 1e6, samples->v[c - 1] * 1e6);
+} //end print_percentiles
+
+static int by_value(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,737 @@
+//TA_Plan.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "office_model.h"
+
+/****************************************************************************
+* Capacity planner for office hours
+* Finds the cheapest number of TAs and hallway chairs that meets a service
+* level objective (SLO) for a day of office hours:
+*   - at most -J of the students who show up are lost: turned away by a
+*     full hallway, or (with -A) out of patience before the TA calls, and
+*   - 95% of the students who get help waited at most -W seconds.
+* Students arrive as a Poisson stream whose rate follows the -a profile
+* (e.g. quiet in the morning, busy before a deadline) and need one help
+* session each. A student who finds the hallway full, or gives up, leaves.
+*
+* Every candidate is simulated with office_model.c on the same -R days:
+* day k has the same arrival times and the same students (with the same
+* help times) for every candidate. Those common random numbers make the
+* differences between candidates far less noisy than the candidates
+* themselves. A candidate only counts as meeting the SLO if the upper end
+* of the 95% confidence interval does.
+*
+* Search: more chairs turn fewer students away but make the line (and the
+* wait) longer, so for a given number of TAs the best choice is the fewest
+* chairs that meet the turn-away target. That is found by bisection, and
+* TA counts are tried in order until even the cheapest hallway for the
+* next count would cost more than the best plan found (branch and bound).
+* The days of each candidate are simulated in parallel.
+*
+* With -s CHAIRS the planner instead finds how many TAs to staff in each
+* -L second slot of the day (one hour by default), for a fixed hallway,
+* using the fewest TA-hours that still meet the SLO. The schedule is
+* searched by simulated annealing: move one slot up or down by one TA,
+* keep the change if it is better, and sometimes keep it even if it is
+* worse, less often as the search cools down. Breaking the SLO costs a
+* penalty far larger than any TA-hour.
+****************************************************************************/
+
+#define MAX_SEGMENTS 64
+#define MAX_SLOTS    96
+
+/****************************************************************************
+* Global run settings
+****************************************************************************/
+double seg_start[MAX_SEGMENTS];         //arrival profile: rate seg_rate[i] from seg_start[i]
+double seg_rate[MAX_SEGMENTS];          //students per second
+int num_segments = 0;
+double day_length = 3.0 * 3600.0;       //arrivals stop after this many seconds
+office_params_t base_params;            //help time and patience
+double slo_wait = 600.0;                //95th percentile wait must be at most this
+double slo_reject = 0.05;               //turned-away fraction must be at most this
+double ta_cost = 20.0;                  //cost of one TA for the day
+double chair_cost = 1.0;                //cost of one chair
+int max_tas = 20;
+int max_chairs = 200;
+int num_days = 20;                      //replications (-R)
+int num_threads = 0;                    //0 = one per core
+uint64_t run_seed = 521;
+int staff_chairs = 0;                   //-s: hallway size for a schedule search (0 = off)
+double slot_length = 3600.0;            //seconds per staffing slot
+int anneal_steps = 3000;                //schedules tried by the annealer
+
+//How one simulated day went
+typedef struct {
+    double reject;                      //fraction of students turned away or gave up
+    double p95_wait;                    //95th percentile hallway wait of helped students
+    double mean_wait;
+} day_result_t;
+
+//One (TAs, chairs) choice and how it did over all days
+typedef struct {
+    int tas;
+    int chairs;
+    double cost;
+    double reject;                      //means over days, and 95% CI half-widths
+    double reject_half;
+    double p95;
+    double p95_half;
+    double mean_wait;
+    int meets_reject;                   //upper CI bound within the SLO
+    int meets_wait;
+} candidate_t;
+
+//Collects hallway waits while one day is simulated
+typedef struct {
+    office_t* office;
+    double* waits;
+    long count;
+    long cap;
+} wait_log_t;
+
+typedef struct {
+    int tas;                            //fixed staffing, or
+    const int* schedule;                //TAs per slot (NULL = use tas)
+    int chairs;
+    day_result_t* days;
+    atomic_int next_day;
+} job_t;
+
+static candidate_t* evaluated;          //every candidate simulated so far
+static int num_evaluated = 0;
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static int parse_profile(const char* text);
+static double next_arrival(uint64_t* rng, double now);
+static void plan_send(void* ctx, int dest, const event_t* ev);
+static int simulate_day(const job_t* job, int day, day_result_t* out);
+static void* day_thread(void* param);
+static int run_days(job_t* job);
+static void summarize(const day_result_t* days, candidate_t* c);
+static const candidate_t* evaluate(int tas, int chairs);
+static int plan_schedule(void);
+static void print_candidate(const candidate_t* c);
+static double wall_clock(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    const candidate_t* best = NULL;
+    double start;
+    int tas;
+    int opt;
+
+    office_default_params(&base_params);
+    base_params.help_time.kind = DIST_EXP;
+    base_params.help_time.a = 300.0;
+    parse_profile("0:0.01");
+
+    while ((opt = getopt(argc, argv, "a:D:H:A:W:J:C:t:c:R:T:S:s:L:I:")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parse_profile(optarg) != 0) {
+                printf("Bad arrival profile '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'D': day_length = atof(optarg); break;
+        case 'H':
+            if (dist_parse(&base_params.help_time, optarg) != 0) {
+                printf("Bad help time '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'A':
+            if (dist_parse(&base_params.patience, optarg) != 0) {
+                printf("Bad patience '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'W': slo_wait = atof(optarg); break;
+        case 'J': slo_reject = atof(optarg); break;
+        case 'C':
+            if (sscanf(optarg, "%lf:%lf", &ta_cost, &chair_cost) != 2) {
+                printf("Costs look like TA:CHAIR, e.g. 20:1.\n");
+                return 1;
+            }
+            break;
+        case 't': max_tas = atoi(optarg); break;
+        case 'c': max_chairs = atoi(optarg); break;
+        case 'R': num_days = atoi(optarg); break;
+        case 'T': num_threads = atoi(optarg); break;
+        case 'S': run_seed = strtoull(optarg, NULL, 10); break;
+        case 's': staff_chairs = atoi(optarg); break;
+        case 'L': slot_length = atof(optarg); break;
+        case 'I': anneal_steps = atoi(optarg); break;
+        default:
+            printf("Usage: %s [-a RATE | -a T0:RATE,T1:RATE,...] [-D day length]\n"
+                   "          [-H help time] [-A patience]\n"
+                   "          [-W p95 wait target] [-J turned-away target] [-C TA:CHAIR costs]\n"
+                   "          [-t max TAs] [-c max chairs] [-R days] [-T threads] [-S seed]\n"
+                   "          [-s CHAIRS: plan TAs per slot] [-L slot length] [-I steps]\n"
+                   "Rates are students per second; times are seconds.\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    if (day_length <= 0.0 || max_tas < 1 || max_chairs < 1 || num_days < 2 ||
+        slo_wait < 0.0 || slo_reject < 0.0 || base_params.help_time.kind == DIST_NEVER ||
+        staff_chairs < 0 || slot_length <= 0.0 || day_length / slot_length > MAX_SLOTS) {
+        printf("Invalid input. Exiting.\n");
+        return 1;
+    }
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (staff_chairs > 0) {
+        return plan_schedule();
+    }
+    evaluated = (candidate_t*)malloc(sizeof(candidate_t) * (size_t)max_tas *
+                                     (size_t)(max_chairs + 1));
+    if (evaluated == NULL) {
+        printf("Error: unable to allocate candidates.\n");
+        return 1;
+    }
+
+    printf("SLO: at most %.1f%% turned away or gave up, 95%% of waits at most %g s; %d days each\n\n",
+           100.0 * slo_reject, slo_wait, num_days);
+    printf("TAs chairs    cost   turned away %%        p95 wait (s)        mean wait (s)  SLO\n");
+    start = wall_clock();
+
+    for (tas = 1; tas <= max_tas; tas++) {
+        const candidate_t* c;
+        int lo = 1;
+        int hi = max_chairs;
+
+        //Even one chair with this many TAs costs more than the best plan
+        if (best != NULL && tas * ta_cost + chair_cost >= best->cost) {
+            break;
+        }
+
+        //Fewest chairs that meet the turn-away target (it only gets easier
+        //with more chairs); give up on this TA count if even max_chairs fail
+        c = evaluate(tas, hi);
+        if (c == NULL) {
+            return 1;
+        }
+        if (!c->meets_reject) {
+            continue;
+        }
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            c = evaluate(tas, mid);
+            if (c == NULL) {
+                return 1;
+            }
+            if (c->meets_reject) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        } //end while
+
+        //More chairs only lengthen the wait, so this is the only candidate
+        c = evaluate(tas, lo);
+        if (c == NULL) {
+            return 1;
+        }
+        if (c->meets_wait && (best == NULL || c->cost < best->cost)) {
+            best = c;
+        }
+    } //end for (each TA count)
+
+    printf("\n%d candidates simulated in %.2f s\n", num_evaluated, wall_clock() - start);
+    if (best == NULL) {
+        printf("No plan with at most %d TAs and %d chairs meets the SLO.\n", max_tas, max_chairs);
+        free(evaluated);
+        return 1;
+    }
+    printf("Cheapest plan: %d TA(s) and %d chair(s), cost %g\n", best->tas, best->chairs,
+           best->cost);
+    printf("  turned away: %.2f%% (95%% CI %.2f%% .. %.2f%%)\n", 100.0 * best->reject,
+           100.0 * (best->reject - best->reject_half), 100.0 * (best->reject + best->reject_half));
+    printf("  p95 wait:    %.1f s (95%% CI %.1f .. %.1f s)\n", best->p95,
+           best->p95 - best->p95_half, best->p95 + best->p95_half);
+    free(evaluated);
+    return 0;
+} //end main
+
+/****************************************************************************
+* Function: parse_profile
+* What it does: Reads an arrival profile: either one rate, or a list of
+*               START:RATE pairs (seconds, students per second) in order.
+*               Each rate holds until the next START.
+* Outputs: 0 on success, -1 if the text is not understood
+****************************************************************************/
+static int parse_profile(const char* text) {
+    const char* p = text;
+    int n = 0;
+
+    if (strchr(text, ':') == NULL) {
+        seg_start[0] = 0.0;
+        seg_rate[0] = atof(text);
+        num_segments = 1;
+        return seg_rate[0] >= 0.0 ? 0 : -1;
+    }
+    while (*p != '\0') {
+        int used;
+        if (n == MAX_SEGMENTS ||
+            sscanf(p, "%lf:%lf%n", &seg_start[n], &seg_rate[n], &used) != 2 ||
+            seg_rate[n] < 0.0 || (n > 0 && seg_start[n] <= seg_start[n - 1])) {
+            return -1;
+        }
+        p += used;
+        n++;
+        if (*p == ',') {
+            p++;
+        }
+    } //end while
+    if (n == 0 || seg_start[0] != 0.0) {
+        return -1;
+    }
+    num_segments = n;
+    return 0;
+} //end parse_profile
+
+/****************************************************************************
+* Function: next_arrival
+* What it does: Draws the next arrival of the piecewise-constant Poisson
+*               stream after `now`. A gap that runs past the end of its
+*               segment restarts at the segment boundary with the next
+*               rate (exact, since exponential gaps have no memory).
+* Outputs: arrival time, or INFINITY once the day is over
+****************************************************************************/
+static double next_arrival(uint64_t* rng, double now) {
+    int seg = 0;
+
+    while (now < day_length) {
+        double end;
+        double gap;
+
+        while (seg + 1 < num_segments && seg_start[seg + 1] <= now) {
+            seg++;
+        }
+        end = seg + 1 < num_segments ? seg_start[seg + 1] : day_length;
+        if (end > day_length) {
+            end = day_length;
+        }
+        if (seg_rate[seg] > 0.0) {
+            gap = -log(1.0 - rng_uniform(rng)) / seg_rate[seg];
+            if (now + gap < end) {
+                return now + gap;
+            }
+        }
+        now = end;
+    } //end while
+    return INFINITY;
+} //end next_arrival
+
+//Records the wait of every student the TA calls in; drops lost students
+static void plan_send(void* ctx, int dest, const event_t* ev) {
+    wait_log_t* log = (wait_log_t*)ctx;
+
+    if (isinf(ev->time)) {
+        return;
+    }
+    if (ev->type == EV_DONE) {
+        if (log->count == log->cap) {
+            long cap = log->cap > 0 ? 2 * log->cap : 1024;
+            double* waits = (double*)realloc(log->waits, sizeof(double) * (size_t)cap);
+            if (waits == NULL) {
+                return; //keeps going; the percentile just misses some waits
+            }
+            log->waits = waits;
+            log->cap = cap;
+        }
+        log->waits[log->count++] = log->office->now - ev->student.seated_at;
+    }
+    office_send_local(log->office, dest, ev);
+} //end plan_send
+
+//Two-sided 95% Student t quantile: a table up to 9 degrees of freedom,
+//then the Cornish-Fisher expansion (Abramowitz & Stegun 26.7.5), which is
+//within 1e-5 of the exact value from there on
+static double t95(int df) {
+    static const double table[10] = { 0.0, 12.706205, 4.302653, 3.182446, 2.776445,
+                                      2.570582, 2.446912, 2.364624, 2.306004, 2.262157 };
+    const double z = 1.959964;
+    double z2 = z * z;
+    double n = df;
+
+    if (df < 10) {
+        return table[df];
+    }
+    return z + z * (z2 + 1.0) / (4.0 * n)
+             + z * ((5.0 * z2 + 16.0) * z2 + 3.0) / (96.0 * n * n)
+             + z * (((3.0 * z2 + 19.0) * z2 + 17.0) * z2 - 15.0) / (384.0 * n * n * n)
+             + z * ((((79.0 * z2 + 776.0) * z2 + 1482.0) * z2 - 1920.0) * z2 - 945.0)
+               / (92160.0 * n * n * n * n);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/****************************************************************************
+* Function: simulate_day
+* What it does: Runs one day of office hours with the given staffing. The
+*               arrival stream and the students depend only on `day`, so
+*               every candidate sees the same days.
+* Outputs: 0 on success, -1 if memory runs out
+****************************************************************************/
+static int simulate_day(const job_t* job, int day, day_result_t* out) {
+    office_params_t params = base_params;
+    office_t office;
+    wait_log_t log;
+    uint64_t day_seed = run_seed + (uint64_t)day * 0x9E3779B97F4A7C15ULL;
+    uint64_t arrivals_rng = day_seed ^ 0x5DEECE66DULL;
+    double arrival;
+    double next_slot = INFINITY;
+    double sum = 0.0;
+    int num_slots = 0;
+    int slot = 0;
+    int next_id = 1;
+    event_t ev;
+    long i;
+
+    params.num_tas = job->tas;
+    if (job->schedule != NULL) {
+        num_slots = (int)ceil(day_length / slot_length);
+        params.num_tas = job->schedule[0];
+        next_slot = num_slots > 1 ? slot_length : INFINITY;
+    }
+    params.num_chairs = job->chairs;
+    params.help_requests = 1;
+    params.retry_time = INFINITY;       //turned away: goes home
+    params.program_time.kind = DIST_NEVER; //gave up waiting: goes home too
+    params.transfer_prob = 0.0;
+    if (office_init(&office, 0, 1, &params) != 0) {
+        return -1;
+    }
+    memset(&log, 0, sizeof(log));
+    log.office = &office;
+
+    arrival = next_arrival(&arrivals_rng, 0.0);
+    while (!isinf(arrival) || office.heap_len > 0) {
+        if (next_slot <= arrival && next_slot <= office_next_time(&office)) {
+            //Shift change; the last slot's TAs stay until the line is empty
+            office.now = next_slot;
+            params.num_tas = job->schedule[++slot];
+            if (office_reconfigure(&office, &params, plan_send, &log) != 0) {
+                free(log.waits);
+                office_free(&office);
+                return -1;
+            }
+            next_slot = slot + 1 < num_slots ? next_slot + slot_length : INFINITY;
+            continue;
+        }
+        if (arrival < office_next_time(&office)) {
+            memset(&ev, 0, sizeof(ev));
+            ev.type = EV_ARRIVE;
+            ev.time = arrival;
+            ev.student = office_new_student(next_id++, day_seed, &params);
+            office_push(&office, &ev);
+            arrival = next_arrival(&arrivals_rng, arrival);
+            continue;
+        }
+        office_pop(&office, &ev);
+        office_handle(&office, &ev, NULL, plan_send, &log);
+    } //end while
+
+    out->reject = office.stats.arrivals ?
+                  (double)(office.stats.rejected + office.stats.reneged) / office.stats.arrivals : 0.0;
+    out->p95_wait = 0.0;
+    out->mean_wait = 0.0;
+    if (log.count > 0) {
+        qsort(log.waits, (size_t)log.count, sizeof(double), compare_doubles);
+        out->p95_wait = log.waits[(long)ceil(0.95 * log.count) - 1];
+        for (i = 0; i < log.count; i++) {
+            sum += log.waits[i];
+        }
+        out->mean_wait = sum / log.count;
+    }
+    free(log.waits);
+    office_free(&office);
+    return 0;
+} //end simulate_day
+
+//Simulates days until none are left for this candidate
+static void* day_thread(void* param) {
+    job_t* job = (job_t*)param;
+    int day;
+
+    while ((day = atomic_fetch_add(&job->next_day, 1)) < num_days) {
+        if (simulate_day(job, day, &job->days[day]) != 0) {
+            job->days[day].reject = NAN;
+        }
+    }
+    return NULL;
+}
+
+/****************************************************************************
+* Function: run_days
+* What it does: Simulates all days of one job on up to num_threads threads.
+* Outputs: 0 on success, -1 if any day ran out of memory
+****************************************************************************/
+static int run_days(job_t* job) {
+    pthread_t handles[256];
+    int threads = num_threads < num_days ? num_threads : num_days;
+    int i;
+
+    if (threads > 256) {
+        threads = 256;
+    }
+    atomic_store(&job->next_day, 0);
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&handles[i], NULL, day_thread, job) != 0) {
+            threads = i; //the rest is done by the threads already running
+            break;
+        }
+    }
+    day_thread(job);
+    for (i = 1; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    for (i = 0; i < num_days; i++) {
+        if (isnan(job->days[i].reject)) {
+            return -1;
+        }
+    }
+    return 0;
+} //end run_days
+
+/****************************************************************************
+* Function: summarize
+* What it does: Fills in a candidate's means over days, their 95%
+*               confidence half-widths and whether it meets the SLO.
+****************************************************************************/
+static void summarize(const day_result_t* days, candidate_t* c) {
+    double sum[2] = { 0.0, 0.0 };
+    double sum_sq[2] = { 0.0, 0.0 };
+    double wait_sum = 0.0;
+    double t = t95(num_days - 1);
+    int i;
+    int k;
+
+    for (i = 0; i < num_days; i++) {
+        double v[2] = { days[i].reject, days[i].p95_wait };
+        for (k = 0; k < 2; k++) {
+            sum[k] += v[k];
+            sum_sq[k] += v[k] * v[k];
+        }
+        wait_sum += days[i].mean_wait;
+    }
+    c->reject = sum[0] / num_days;
+    c->p95 = sum[1] / num_days;
+    c->reject_half = t * sqrt(fmax(0.0, sum_sq[0] / num_days - c->reject * c->reject) /
+                              (num_days - 1));
+    c->p95_half = t * sqrt(fmax(0.0, sum_sq[1] / num_days - c->p95 * c->p95) /
+                           (num_days - 1));
+    c->mean_wait = wait_sum / num_days;
+    c->meets_reject = c->reject + c->reject_half <= slo_reject;
+    c->meets_wait = c->p95 + c->p95_half <= slo_wait;
+} //end summarize
+
+/****************************************************************************
+* Function: evaluate
+* What it does: Simulates all days for one (TAs, chairs) choice, or returns
+*               the earlier result if it was already simulated. Prints a
+*               line for every new candidate.
+* Outputs: the candidate, or NULL if it could not be simulated
+****************************************************************************/
+static const candidate_t* evaluate(int tas, int chairs) {
+    candidate_t* c;
+    job_t job;
+    int i;
+
+    for (i = 0; i < num_evaluated; i++) {
+        if (evaluated[i].tas == tas && evaluated[i].chairs == chairs) {
+            return &evaluated[i];
+        }
+    }
+
+    c = &evaluated[num_evaluated];
+    memset(c, 0, sizeof(*c));
+    c->tas = tas;
+    c->chairs = chairs;
+    c->cost = tas * ta_cost + chairs * chair_cost;
+
+    memset(&job, 0, sizeof(job));
+    job.tas = tas;
+    job.chairs = chairs;
+    job.days = (day_result_t*)calloc((size_t)num_days, sizeof(day_result_t));
+    if (job.days == NULL || run_days(&job) != 0) {
+        printf("Error: unable to simulate %d TA(s) with %d chair(s).\n", tas, chairs);
+        free(job.days);
+        return NULL;
+    }
+    summarize(job.days, c);
+    num_evaluated++;
+    print_candidate(c);
+
+    free(job.days);
+    return c;
+} //end evaluate
+
+/****************************************************************************
+* Function: plan_schedule
+* What it does: Searches TAs per slot for a hallway of staff_chairs by
+*               simulated annealing and prints the best schedule that meets
+*               the SLO. The search starts from enough TAs to keep up with
+*               each slot's arrivals on average, plus one.
+*               Score = TA-hours, plus 1000 TA-hours for each SLO target
+*               missed and a further amount that grows with the miss.
+* Outputs: 0 if a schedule meets the SLO, 1 otherwise
+****************************************************************************/
+static int plan_schedule(void) {
+    int num_slots = (int)ceil(day_length / slot_length);
+    int current[MAX_SLOTS];
+    int best[MAX_SLOTS];
+    double help_mean = base_params.help_time.kind == DIST_UNIFORM ?
+                       (base_params.help_time.a + base_params.help_time.b) / 2.0 :
+                       base_params.help_time.a;
+    double current_score;
+    double best_score = INFINITY;
+    double temperature;
+    double cooling;
+    double start = wall_clock();
+    double elapsed;
+    uint64_t rng = run_seed ^ 0xA5A5A5A5ULL;
+    candidate_t best_c;
+    candidate_t c;
+    job_t job;
+    int step;
+    int i;
+
+    memset(&job, 0, sizeof(job));
+    memset(&best_c, 0, sizeof(best_c));
+    job.chairs = staff_chairs;
+    job.schedule = current;
+    job.days = (day_result_t*)calloc((size_t)num_days, sizeof(day_result_t));
+    if (job.days == NULL) {
+        printf("Error: unable to allocate days.\n");
+        return 1;
+    }
+
+    //Start: enough TAs for each slot's average load, plus one
+    for (i = 0; i < num_slots; i++) {
+        double t = i * slot_length;
+        int seg = 0;
+        while (seg + 1 < num_segments && seg_start[seg + 1] <= t) {
+            seg++;
+        }
+        current[i] = (int)ceil(seg_rate[seg] * help_mean) + 1;
+        if (current[i] > max_tas) {
+            current[i] = max_tas;
+        }
+    }
+
+    //Temperature falls from 2 TA-hours to 0.01 over the run
+    temperature = 2.0;
+    cooling = pow(0.01 / 2.0, 1.0 / (anneal_steps > 1 ? anneal_steps - 1 : 1));
+    current_score = INFINITY;
+
+    for (step = 0; step <= anneal_steps; step++) {
+        double score;
+        double hours = 0.0;
+        int slot = -1;
+        int old = 0;
+
+        //Propose: one slot up or down by one TA (the first step scores the start)
+        if (step > 0) {
+            slot = (int)(rng_uniform(&rng) * num_slots);
+            old = current[slot];
+            current[slot] += rng_uniform(&rng) < 0.5 ? -1 : 1;
+            if (current[slot] < 1 || current[slot] > max_tas) {
+                current[slot] = old;
+                continue;
+            }
+        }
+
+        if (run_days(&job) != 0) {
+            printf("Error: out of memory simulating a schedule.\n");
+            free(job.days);
+            return 1;
+        }
+        memset(&c, 0, sizeof(c));
+        summarize(job.days, &c);
+        for (i = 0; i < num_slots; i++) {
+            double len = fmin(slot_length, day_length - i * slot_length);
+            hours += current[i] * len / 3600.0;
+        }
+        score = hours;
+        if (!c.meets_reject) {
+            score += 1000.0 + 1000.0 * (c.reject + c.reject_half - slo_reject) / fmax(slo_reject, 1e-3);
+        }
+        if (!c.meets_wait) {
+            score += 1000.0 + 1000.0 * (c.p95 + c.p95_half - slo_wait) / fmax(slo_wait, 1.0);
+        }
+        c.cost = hours;
+
+        if (score < best_score) {
+            best_score = score;
+            best_c = c;
+            memcpy(best, current, sizeof(int) * (size_t)num_slots);
+        }
+        if (score <= current_score ||
+            rng_uniform(&rng) < exp((current_score - score) / temperature)) {
+            current_score = score;
+        } else if (slot >= 0) {
+            current[slot] = old; //rejected: undo the move
+        }
+        temperature *= cooling;
+        num_evaluated++;
+    } //end for (each step)
+    elapsed = wall_clock() - start;
+    free(job.days);
+
+    printf("%d schedules simulated (%d days each) in %.2f s: %.0f per minute\n\n",
+           num_evaluated, num_days, elapsed, elapsed > 0.0 ? 60.0 * num_evaluated / elapsed : 0.0);
+    printf(" slot   from (s)  arrivals/s  TAs\n");
+    for (i = 0; i < num_slots; i++) {
+        double t = i * slot_length;
+        int seg = 0;
+        while (seg + 1 < num_segments && seg_start[seg + 1] <= t) {
+            seg++;
+        }
+        printf("%5d %10g %11g %4d\n", i + 1, t, seg_rate[seg], best[i]);
+    }
+    printf("\nTA-hours: %g with %d chair(s)\n", best_c.cost, staff_chairs);
+    printf("  turned away: %.2f%% (95%% CI up to %.2f%%)\n", 100.0 * best_c.reject,
+           100.0 * (best_c.reject + best_c.reject_half));
+    printf("  p95 wait:    %.1f s (95%% CI up to %.1f s)\n", best_c.p95,
+           best_c.p95 + best_c.p95_half);
+    if (!best_c.meets_reject || !best_c.meets_wait) {
+        printf("No schedule with at most %d TAs per slot met the SLO.\n", max_tas);
+        return 1;
+    }
+    return 0;
+} //end plan_schedule
+
+static void print_candidate(const candidate_t* c) {
+    printf("%3d %6d %7g   %6.2f +/- %-6.2f   %8.1f +/- %-7.1f   %8.1f        %s\n",
+           c->tas, c->chairs, c->cost, 100.0 * c->reject, 100.0 * c->reject_half,
+           c->p95, c->p95_half, c->mean_wait,
+           c->meets_reject && c->meets_wait ? "met" :
+           c->meets_reject ? "wait too long" : "too many turned away");
+}
+
+static double wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,538 @@
+//TA_Proc.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "office_model.h"
+
+/****************************************************************************
+* The sleeping TA with every student in its own process
+* Same rules as TA_Sim.c, but the TA and each student are separate
+* processes, forked by a supervisor. They share the hallway through one
+* shm_open/mmap segment, which holds:
+*   - a process-shared, robust mutex in place of TA_Sim's mutex
+*   - process-shared semaphores: students_sem, and "called"/"helped" for
+*     every student
+*   - the hallway line, a ring of student ids
+*
+* A student process that dies (killed, crashed) is cleaned up two ways:
+*   - if it held the mutex, the next process to lock it gets EOWNERDEAD,
+*     removes the dead student's seat, rebuilds the line from the seats
+*     and marks the mutex consistent again
+*   - the supervisor reaps every student; one that did not exit normally
+*     loses its seat the same way
+* -d N makes students 1..N die on purpose on their second visit, right
+* after sitting down and while still holding the mutex.
+*
+* Handoff latency is measured both ways: from a student's sem_post to the
+* sleeping TA waking up, and from the TA calling a student in to that
+* student's process running.
+****************************************************************************/
+
+#define LAT_CAP 65536                   //latency samples kept per direction
+
+//Where a student is
+#define SEAT_AWAY    0                  //programming or walking
+#define SEAT_SEATED  1                  //in the hallway line
+#define SEAT_CALLED  2                  //with the TA
+#define SEAT_DONE    3                  //done for the day
+#define SEAT_GONE    4                  //process died
+
+typedef struct {
+    pid_t pid;
+    int state;
+    long seated_no;                     //order of arrival in the line
+    _Atomic double called_at;           //when the TA posted `called`
+    sem_t called;                       //posted when the TA calls this student in
+    sem_t helped;                       //posted when the TA is done helping
+} proc_seat_t;
+
+typedef struct {
+    pthread_mutex_t mutex;              //robust and process-shared
+    int owner;                          //who holds the mutex: student id, 0 TA, -1 supervisor
+    sem_t students_sem;                 //counts students waiting & wakes the TA
+
+    int num_students;
+    int num_chairs;
+    int waiting;                        //students in the line
+    int head;                           //front of the line in the ring
+    long next_no;
+    int all_done;
+    int finished;
+    int seated;
+    int rejected;
+    int helped;
+    int recoveries;                     //EOWNERDEAD recoveries
+    int died;                           //student processes that died
+
+    _Atomic double wake_posted_at;      //-1 while the TA blocks on students_sem, then
+                                        //when the first post after that was made
+    atomic_long wake_count;
+    atomic_long call_count;
+    double wake_lat[LAT_CAP];           //post -> TA running (seconds)
+    double call_lat[LAT_CAP];           //TA call -> student running (seconds)
+
+    proc_seat_t seats[];                //one per student, then the line ring
+} office_shm_t;
+
+/****************************************************************************
+* Global run settings
+****************************************************************************/
+int num_students = 5;
+int num_chairs = 3;
+int help_requests = 3;
+int crash_students = 0;                 //-d: students 1..N die holding the mutex
+int quiet = 0;                          //-q: no per-event lines
+dist_t program_time = { DIST_UNIFORM, 1.0, 5.0 };
+dist_t help_time = { DIST_CONST, 5.0, 0.0 };
+double retry_time = 1.0;
+
+office_shm_t* shm = NULL;
+char shm_name[64];
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static int ta_process(void);
+static int student_process(int id);
+static void lock_office(int self);
+static void unlock_office(void);
+static void mark_gone(int id);
+static void rebuild_line(void);
+static void wake_ta(void);
+static void record(double* samples, atomic_long* count, double value);
+static void print_latency(const char* what, double* samples, long count);
+static double now_sec(void);
+static void sleep_sec(double seconds);
+static int* line_ring(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    pthread_mutexattr_t attr;
+    pid_t ta_pid;
+    size_t size;
+    double start;
+    int status;
+    int opt;
+    int fd;
+    int i;
+
+    while ((opt = getopt(argc, argv, "s:c:r:P:H:R:d:q")) != -1) {
+        switch (opt) {
+        case 's': num_students = atoi(optarg); break;
+        case 'c': num_chairs = atoi(optarg); break;
+        case 'r': help_requests = atoi(optarg); break;
+        case 'P':
+            if (dist_parse(&program_time, optarg) != 0) {
+                printf("Bad programming time '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'H':
+            if (dist_parse(&help_time, optarg) != 0) {
+                printf("Bad help time '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R': retry_time = atof(optarg); break;
+        case 'd': crash_students = atoi(optarg); break;
+        case 'q': quiet = 1; break;
+        default:
+            printf("Usage: %s [-s students] [-c chairs] [-r help requests]\n"
+                   "          [-P program time] [-H help time] [-R retry seconds]\n"
+                   "          [-d students that die holding the mutex] [-q]\n"
+                   "Times look like const:5, uniform:1:5 or exp:120 (seconds).\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_students <= 0 || num_chairs < 1 || help_requests <= 0 || retry_time < 0.0 ||
+        program_time.kind == DIST_NEVER || help_time.kind == DIST_NEVER) {
+        printf("Invalid input. Exiting.\n");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0); //whole lines, so processes do not mix them
+
+    //Create and map the shared segment
+    size = sizeof(office_shm_t) + sizeof(proc_seat_t) * (size_t)num_students +
+           sizeof(int) * (size_t)num_chairs;
+    snprintf(shm_name, sizeof(shm_name), "/tasim-%d", (int)getpid());
+    fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+        printf("Error: unable to create shared memory %s\n", shm_name);
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(shm_name);
+        }
+        return 1;
+    }
+    shm = (office_shm_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        printf("Error: unable to map shared memory.\n");
+        shm_unlink(shm_name);
+        return 1;
+    }
+    memset(shm, 0, size);
+    shm->num_students = num_students;
+    shm->num_chairs = num_chairs;
+
+    //Initialize the robust, process-shared mutex and the semaphores
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shm->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    sem_init(&shm->students_sem, 1, 0);
+    for (i = 0; i < num_students; i++) {
+        sem_init(&shm->seats[i].called, 1, 0);
+        sem_init(&shm->seats[i].helped, 1, 0);
+    }
+
+    //Start the TA and the students
+    start = now_sec();
+    fflush(stdout);
+    ta_pid = fork();
+    if (ta_pid == 0) {
+        _exit(ta_process());
+    }
+    for (i = 0; i < num_students && ta_pid > 0; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(student_process(i + 1));
+        }
+        shm->seats[i].pid = pid;
+        if (pid < 0) {
+            printf("Error: unable to start student %d.\n", i + 1);
+            lock_office(-1);
+            mark_gone(i + 1);
+            unlock_office();
+        }
+    }
+    if (ta_pid < 0) {
+        printf("Error: unable to start the TA.\n");
+        shm_unlink(shm_name);
+        return 1;
+    }
+
+    //Reap the students; one that did not exit cleanly loses its seat
+    for (i = 0; i < num_students; i++) {
+        if (shm->seats[i].pid <= 0) {
+            continue;
+        }
+        waitpid(shm->seats[i].pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            lock_office(-1);
+            if (shm->seats[i].state != SEAT_GONE) {
+                printf("Supervisor: student %d died; freeing their seat.\n", i + 1);
+                mark_gone(i + 1);
+            }
+            unlock_office();
+        }
+    }
+
+    //Everyone is done or gone; let the TA go home
+    lock_office(-1);
+    shm->all_done = 1;
+    unlock_office();
+    wake_ta();
+    waitpid(ta_pid, &status, 0);
+
+    printf("\n%d students in separate processes: %d helped, %d turned away, %.2f s\n",
+           num_students, shm->helped, shm->rejected, now_sec() - start);
+    printf("Student processes that died: %d; mutex recovered from a dead owner %d time(s)\n",
+           shm->died, shm->recoveries);
+    print_latency("student post -> TA awake", shm->wake_lat, atomic_load(&shm->wake_count));
+    print_latency("TA call -> student awake", shm->call_lat, atomic_load(&shm->call_count));
+
+    pthread_mutex_destroy(&shm->mutex);
+    sem_destroy(&shm->students_sem);
+    for (i = 0; i < num_students; i++) {
+        sem_destroy(&shm->seats[i].called);
+        sem_destroy(&shm->seats[i].helped);
+    }
+    munmap(shm, size);
+    shm_unlink(shm_name);
+    return 0;
+} //end main
+
+/****************************************************************************
+* Function: ta_process
+* What it does: Sleeps on students_sem until a student sits down, then
+*               calls in the front of the line and helps them, until the
+*               supervisor says everyone is done.
+* Outputs: exit status of the TA process
+****************************************************************************/
+static int ta_process(void) {
+    uint64_t rng = (uint64_t)getpid() * 0x9E3779B97F4A7C15ULL ^ (uint64_t)time(NULL);
+    double help;
+
+    while (1) {
+        if (!quiet) {
+            printf("TA: Waiting for a student (sleeping)...\n");
+        }
+
+        //Only a wait that really blocks counts as a handoff
+        if (sem_trywait(&shm->students_sem) != 0) {
+            double posted_at;
+
+            atomic_store(&shm->wake_posted_at, -1.0);
+            while (sem_wait(&shm->students_sem) != 0 && errno == EINTR) {
+            }
+            posted_at = atomic_exchange(&shm->wake_posted_at, 0.0);
+            if (posted_at > 0.0) {
+                //A student swapped in the time of the post that woke us
+                record(shm->wake_lat, &shm->wake_count, now_sec() - posted_at);
+            }
+        }
+
+        lock_office(0);
+        if (shm->all_done && shm->waiting == 0) {
+            unlock_office();
+            if (!quiet) {
+                printf("TA: All students are done. TA is going home.\n");
+            }
+            break;
+        }
+
+        if (shm->waiting > 0) {
+            //Call in the student at the front of the line
+            int id = line_ring()[shm->head];
+            proc_seat_t* seat = &shm->seats[id - 1];
+            shm->head = (shm->head + 1) % shm->num_chairs;
+            shm->waiting--;
+            seat->state = SEAT_CALLED;
+            shm->helped++;
+            if (!quiet) {
+                printf("TA: Helping student %d. Students still waiting = %d\n",
+                       id, shm->waiting);
+            }
+            unlock_office();
+
+            help = dist_draw(&help_time, &rng);
+            atomic_store(&seat->called_at, now_sec());
+            sem_post(&seat->called);
+            sleep_sec(help);
+            sem_post(&seat->helped);
+        } else {
+            //The student who woke us died before we got here
+            if (!quiet) {
+                printf("TA: Woke up but no students are waiting.\n");
+            }
+            unlock_office();
+        }
+    } //end while
+    return 0;
+} //end ta_process
+
+/****************************************************************************
+* Function: student_process
+* What it does: Programs, then visits the TA, help_requests times, like
+*               student_thread in TA_Sim.c with the fixed retry policy.
+* Inputs: id -> this student's id (1..num_students)
+* Outputs: exit status of the student process
+****************************************************************************/
+static int student_process(int id) {
+    proc_seat_t* seat = &shm->seats[id - 1];
+    uint64_t rng = (uint64_t)getpid() * 0xD1B54A32D192ED03ULL ^ (uint64_t)time(NULL);
+    double programming;
+    int i;
+
+    for (i = 0; i < help_requests; i++) {
+        programming = dist_draw(&program_time, &rng);
+        if (!quiet) {
+            printf("Student %d: Programming for %g seconds.\n", id, programming);
+        }
+        sleep_sec(programming);
+
+        while (1) {
+            lock_office(id);
+            if (shm->waiting < shm->num_chairs) {
+                line_ring()[(shm->head + shm->waiting) % shm->num_chairs] = id;
+                seat->seated_no = ++shm->next_no;
+                seat->state = SEAT_SEATED;
+                shm->waiting++;
+                shm->seated++;
+                if (id <= crash_students && i == 1) {
+                    _exit(3); //die in a chair with the mutex held
+                }
+                if (!quiet) {
+                    printf("Student %d: Sitting in hallway. Students waiting = %d\n",
+                           id, shm->waiting);
+                }
+                unlock_office();
+                wake_ta();
+                break;
+            }
+            shm->rejected++;
+            if (!quiet) {
+                printf("Student %d: Hallway full. Will try again in %g seconds.\n",
+                       id, retry_time);
+            }
+            unlock_office();
+            sleep_sec(retry_time);
+        } //end while (each try)
+
+        while (sem_wait(&seat->called) != 0 && errno == EINTR) {
+        }
+        record(shm->call_lat, &shm->call_count, now_sec() - atomic_load(&seat->called_at));
+        while (sem_wait(&seat->helped) != 0 && errno == EINTR) {
+        }
+        lock_office(id);
+        seat->state = SEAT_AWAY;
+        unlock_office();
+        if (!quiet) {
+            printf("Student %d: Got help from the TA.\n", id);
+        }
+    } //end for (each help request)
+
+    lock_office(id);
+    seat->state = SEAT_DONE;
+    shm->finished++;
+    if (!quiet) {
+        printf("Student %d: Done for the day. Finished count = %d\n", id, shm->finished);
+    }
+    unlock_office();
+    return 0;
+} //end student_process
+
+/****************************************************************************
+* Function: lock_office / unlock_office
+* What it does: Takes the shared mutex. If its last owner died holding it,
+*               that owner (a student) loses their seat, the line is rebuilt
+*               from the seats, and the mutex is made consistent again.
+* Inputs: self -> student id, 0 for the TA, -1 for the supervisor
+****************************************************************************/
+static void lock_office(int self) {
+    if (pthread_mutex_lock(&shm->mutex) == EOWNERDEAD) {
+        int dead = shm->owner;
+        shm->recoveries++;
+        printf("Recovered the office mutex from dead student %d.\n", dead);
+        if (dead > 0) {
+            mark_gone(dead);
+        } else {
+            rebuild_line();
+        }
+        pthread_mutex_consistent(&shm->mutex);
+    }
+    shm->owner = self;
+}
+
+static void unlock_office(void) {
+    pthread_mutex_unlock(&shm->mutex);
+}
+
+/****************************************************************************
+* Function: mark_gone / rebuild_line
+* What it does: mark_gone records that a student's process died and takes
+*               them out of the line. rebuild_line writes the line again
+*               from the seats, in arrival order, so a student that died
+*               halfway through sitting down leaves no trace in it.
+*               Caller holds the mutex.
+****************************************************************************/
+static void mark_gone(int id) {
+    proc_seat_t* seat = &shm->seats[id - 1];
+
+    if (seat->state == SEAT_GONE || seat->state == SEAT_DONE) {
+        return;
+    }
+    seat->state = SEAT_GONE;
+    shm->died++;
+    rebuild_line();
+} //end mark_gone
+
+static void rebuild_line(void) {
+    int* ring = line_ring();
+    int count = 0;
+    int i;
+    int j;
+
+    for (i = 0; i < shm->num_students; i++) {
+        if (shm->seats[i].state != SEAT_SEATED) {
+            continue;
+        }
+        //Insertion sort by arrival; the line holds at most num_chairs
+        for (j = count; j > 0 && shm->seats[ring[j - 1] - 1].seated_no > shm->seats[i].seated_no; j--) {
+            ring[j] = ring[j - 1];
+        }
+        ring[j] = i + 1;
+        count++;
+    }
+    shm->head = 0;
+    shm->waiting = count;
+} //end rebuild_line
+
+//Posts students_sem, noting the time if the TA is asleep on it. The time
+//replaces the -1 in one step, so the TA never reads an older student's
+static void wake_ta(void) {
+    double asleep = -1.0;
+
+    if (atomic_load(&shm->wake_posted_at) < 0.0) {
+        atomic_compare_exchange_strong(&shm->wake_posted_at, &asleep, now_sec());
+    }
+    sem_post(&shm->students_sem);
+}
+
+static void record(double* samples, atomic_long* count, double value) {
+    long slot = atomic_fetch_add(count, 1);
+
+    if (slot < LAT_CAP) {
+        samples[slot] = value;
+    }
+}
+
+static int by_value(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latency(const char* what, double* samples, long count) {
+    long n = count < LAT_CAP ? count : LAT_CAP;
+
+    if (n == 0) {
+        printf("%-26s: no samples\n", what);
+        return;
+    }
+    qsort(samples, (size_t)n, sizeof(double), by_value);
+    printf("%-26s: %ld samples, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+           what, count, samples[n / 2] * 1e6, samples[n * 9 / 10] * 1e6,
+           samples[n * 99 / 100] * 1e6, samples[n - 1] * 1e6);
+} //end print_latency
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_sec(double seconds) {
+    struct timespec left;
+
+    if (seconds <= 0.0) {
+        return;
+    }
+    left.tv_sec = (time_t)seconds;
+    left.tv_nsec = (long)((seconds - (double)left.tv_sec) * 1e9);
+    while (nanosleep(&left, &left) != 0 && errno == EINTR) {
+        //interrupted: sleep the rest
+    }
+}
+
+//The hallway ring lives right after the seats
+static int* line_ring(void) {
+    return (int*)&shm->seats[shm->num_students];
+}
@@ -0,0 +1,421 @@
+//TA_Ring.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "ta_wire.h"
+#include "ta_ring.h"
+
+/****************************************************************************
+* Help request transports, head to head
+* A supervisor forks one TA process and -s student processes. Every
+* student sends -n help requests, with up to -w of them out at once, and
+* waits for the replies. The TA answers each one straight away, so the
+* run measures how fast requests and replies move, not the office.
+*
+* Two ways to carry them:
+*   ring    the shared-memory ring in ta_ring.c: requests are written in
+*           place in a mapped ring and replies in place in each
+*           student's mailbox; futex calls only to sleep and wake
+*   socket  a Unix stream socket per student, with the TA on epoll and
+*           one read/write per message, as between TA_Load and TA_Server
+*
+* Both print messages per second and system calls per message.
+****************************************************************************/
+
+#define TRANSPORT_RING   0
+#define TRANSPORT_SOCKET 1
+
+typedef struct {
+    int num_students;
+    atomic_long syscalls;               //socket mode: reads, writes and epoll waits
+    atomic_long bad_replies;            //replies that did not match their request
+    ta_ring_t* ring;                    //inside this mapping, after the mailboxes
+    ring_mailbox_t boxes[];             //one per student
+} bench_shm_t;
+
+/****************************************************************************
+* Global run settings
+****************************************************************************/
+int num_students = 4;
+long num_requests = 250000;             //per student
+int window = 16;                        //requests a student may have out at once
+int transport = TRANSPORT_RING;
+int verbose = 0;
+
+bench_shm_t* shm = NULL;
+int* ta_ends;                           //socket mode: the TA's end of each socket
+int* student_ends;
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static int ta_ring_process(void);
+static int student_ring_process(int id);
+static int ta_socket_process(void);
+static int student_socket_process(int id);
+static double now_sec(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    pid_t* pids;
+    size_t boxes_size;
+    size_t size;
+    uint32_t capacity = 1;
+    double start;
+    double elapsed;
+    long messages;
+    long syscalls;
+    long sleeps = 0;
+    long wakeups = 0;
+    int status;
+    int failed = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "s:n:w:x:v")) != -1) {
+        switch (opt) {
+        case 's': num_students = atoi(optarg); break;
+        case 'n': num_requests = atol(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        case 'x':
+            if (strcmp(optarg, "ring") == 0) {
+                transport = TRANSPORT_RING;
+            } else if (strcmp(optarg, "socket") == 0) {
+                transport = TRANSPORT_SOCKET;
+            } else {
+                printf("Unknown transport '%s' (ring or socket).\n", optarg);
+                return 1;
+            }
+            break;
+        case 'v': verbose = 1; break;
+        default:
+            printf("Usage: %s [-s students] [-n requests per student] [-w window]\n"
+                   "          [-x ring|socket] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_students <= 0 || num_requests <= 0 || window < 1 || window > RING_WINDOW) {
+        printf("Invalid input (the window is 1..%d). Exiting.\n", RING_WINDOW);
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    //Every student's whole window fits, so a claim never finds the ring full
+    while (capacity < (uint32_t)num_students * (uint32_t)window) {
+        capacity *= 2;
+    }
+    boxes_size = sizeof(bench_shm_t) + sizeof(ring_mailbox_t) * (size_t)num_students;
+    boxes_size = (boxes_size + 63) & ~(size_t)63;
+    size = boxes_size + ta_ring_size(capacity);
+    shm = (bench_shm_t*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pids = (pid_t*)calloc((size_t)num_students + 1, sizeof(pid_t));
+    ta_ends = (int*)calloc((size_t)num_students, sizeof(int));
+    student_ends = (int*)calloc((size_t)num_students, sizeof(int));
+    if (shm == MAP_FAILED || pids == NULL || ta_ends == NULL || student_ends == NULL) {
+        printf("Error: unable to set up shared memory.\n");
+        return 1;
+    }
+    memset(shm, 0, boxes_size);
+    shm->num_students = num_students;
+    shm->ring = (ta_ring_t*)((char*)shm + boxes_size);
+    ta_ring_init(shm->ring, capacity);
+    if (transport == TRANSPORT_SOCKET) {
+        for (i = 0; i < num_students; i++) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+                printf("Error: unable to create socket %d.\n", i);
+                return 1;
+            }
+            ta_ends[i] = pair[0];
+            student_ends[i] = pair[1];
+        }
+    }
+
+    //Start the TA and the students
+    start = now_sec();
+    for (i = 0; i <= num_students; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            if (i == 0) {
+                _exit(transport == TRANSPORT_RING ? ta_ring_process() : ta_socket_process());
+            }
+            _exit(transport == TRANSPORT_RING ? student_ring_process(i - 1)
+                                              : student_socket_process(i - 1));
+        }
+        if (pids[i] < 0) {
+            printf("Error: unable to start process %d.\n", i);
+            return 1;
+        }
+    }
+    for (i = 0; i <= num_students; i++) {
+        waitpid(pids[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+    }
+    elapsed = now_sec() - start;
+
+    messages = num_requests * num_students;
+    if (transport == TRANSPORT_RING) {
+        sleeps = atomic_load(&shm->ring->ta_sleeps);
+        wakeups = atomic_load(&shm->ring->ta_wakeups);
+        for (i = 0; i < num_students; i++) {
+            sleeps += atomic_load(&shm->boxes[i].sleeps);
+            wakeups += atomic_load(&shm->boxes[i].wakeups);
+        }
+        syscalls = sleeps + wakeups;
+    } else {
+        syscalls = atomic_load(&shm->syscalls);
+    }
+
+    printf("%s: %d students, %ld requests each, up to %d out at once\n",
+           transport == TRANSPORT_RING ? "Shared-memory ring" : "Unix sockets",
+           num_students, num_requests, window);
+    printf("  %ld requests answered in %.3f s: %.0f requests/s\n",
+           messages, elapsed, messages / elapsed);
+    printf("  system calls       : %.3f per request", (double)syscalls / messages);
+    if (transport == TRANSPORT_RING) {
+        printf(" (%ld futex waits, %ld futex wakes)", sleeps, wakeups);
+    }
+    printf("\n");
+    if (failed > 0 || atomic_load(&shm->bad_replies) > 0) {
+        printf("  ERROR: %d process(es) failed, %ld bad replies\n",
+               failed, atomic_load(&shm->bad_replies));
+    }
+
+    munmap(shm, size);
+    free(pids);
+    free(ta_ends);
+    free(student_ends);
+    return failed > 0;
+} //end main
+
+/****************************************************************************
+* Function: ta_ring_process
+* What it does: Answers every request in the ring, in place, sleeping
+*               whenever the ring is empty.
+* Outputs: exit status of the TA process
+****************************************************************************/
+static int ta_ring_process(void) {
+    ta_ring_t* ring = shm->ring;
+    long total = num_requests * num_students;
+    long i;
+
+    for (i = 0; i < total; i++) {
+        help_request_t* req = ta_ring_next(ring, 0);
+        ring_mailbox_t* box;
+        help_reply_t* reply;
+        uint32_t seq;
+        uint32_t student;
+
+        if (req == NULL) {
+            if (verbose) {
+                printf("TA: Waiting for a student (sleeping)...\n");
+            }
+            req = ta_ring_next(ring, 1);
+        }
+        seq = req->seq;
+        student = req->student;
+        ta_ring_done(ring);
+        if (student >= (uint32_t)num_students) {
+            atomic_fetch_add(&shm->bad_replies, 1);
+            continue;
+        }
+
+        box = &shm->boxes[student];
+        reply = &box->replies[seq % RING_WINDOW];
+        reply->seq = seq;
+        reply->status = REPLY_HELPED;
+        reply->waited = 0.0;
+        reply->helped_for = 0.0;
+        ring_mailbox_post(box);
+    } //end for
+    return 0;
+} //end ta_ring_process
+
+/****************************************************************************
+* Function: student_ring_process
+* What it does: Writes a window of requests into the ring, waits for their
+*               replies in the mailbox and checks them, until it has sent
+*               num_requests.
+* Outputs: exit status of the student process
+****************************************************************************/
+static int student_ring_process(int id) {
+    ring_mailbox_t* box = &shm->boxes[id];
+    uint32_t seq = 0;
+    long sent = 0;
+    int k;
+
+    while (sent < num_requests) {
+        int batch = num_requests - sent < window ? (int)(num_requests - sent) : window;
+        uint32_t first = seq + 1;
+
+        for (k = 0; k < batch; k++) {
+            ring_slot_t* slot = ta_ring_claim(shm->ring);
+            if (slot == NULL) {
+                return 1; //cannot happen: the ring holds every window
+            }
+            slot->req.seq = ++seq;
+            slot->req.student = (uint32_t)id;
+            ta_ring_publish(shm->ring, slot);
+        }
+        ring_mailbox_wait(box, seq);
+        for (k = 0; k < batch; k++) {
+            if (box->replies[(first + (uint32_t)k) % RING_WINDOW].seq != first + (uint32_t)k) {
+                atomic_fetch_add(&shm->bad_replies, 1);
+            }
+        }
+        sent += batch;
+    } //end while
+    return 0;
+} //end student_ring_process
+
+/****************************************************************************
+* Function: ta_socket_process
+* What it does: Answers every request from an epoll loop over the
+*               students' sockets, one write per reply.
+* Outputs: exit status of the TA process
+****************************************************************************/
+static int ta_socket_process(void) {
+    struct epoll_event events[64];
+    struct epoll_event ev;
+    char (*partial)[sizeof(help_request_t)];
+    size_t* partial_len;
+    long total = num_requests * num_students;
+    long answered = 0;
+    long syscalls = 0;
+    char buf[4096];
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int n;
+    int i;
+
+    partial = calloc((size_t)num_students, sizeof(*partial));
+    partial_len = (size_t*)calloc((size_t)num_students, sizeof(size_t));
+    if (epoll_fd < 0 || partial == NULL || partial_len == NULL) {
+        return 1;
+    }
+    for (i = 0; i < num_students; i++) {
+        close(student_ends[i]);
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ta_ends[i], &ev);
+    }
+
+    while (answered < total) {
+        n = epoll_wait(epoll_fd, events, 64, -1);
+        syscalls++;
+        for (i = 0; i < n; i++) {
+            int s = (int)events[i].data.u32;
+            ssize_t got = read(ta_ends[s], buf, sizeof(buf));
+            ssize_t b;
+
+            syscalls++;
+            if (got <= 0) {
+                if (got == 0 || errno != EINTR) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ta_ends[s], NULL);
+                }
+                continue;
+            }
+            for (b = 0; b < got; b++) {
+                partial[s][partial_len[s]++] = buf[b];
+                if (partial_len[s] == sizeof(help_request_t)) {
+                    help_request_t req;
+                    help_reply_t reply;
+
+                    memcpy(&req, partial[s], sizeof(req));
+                    partial_len[s] = 0;
+                    memset(&reply, 0, sizeof(reply));
+                    reply.seq = req.seq;
+                    reply.status = REPLY_HELPED;
+                    //The student reads while it waits, so this never blocks for long
+                    if (write(ta_ends[s], &reply, sizeof(reply)) != (ssize_t)sizeof(reply)) {
+                        atomic_fetch_add(&shm->bad_replies, 1);
+                    }
+                    syscalls++;
+                    answered++;
+                }
+            }
+        } //end for (each ready student)
+    } //end while
+    atomic_fetch_add(&shm->syscalls, syscalls);
+    free(partial);
+    free(partial_len);
+    return 0;
+} //end ta_socket_process
+
+/****************************************************************************
+* Function: student_socket_process
+* What it does: Same as student_ring_process, over the student's socket:
+*               one write per request, then reads until the window's
+*               replies are in.
+* Outputs: exit status of the student process
+****************************************************************************/
+static int student_socket_process(int id) {
+    int fd = student_ends[id];
+    char buf[sizeof(help_reply_t) * RING_WINDOW];
+    size_t have;
+    uint32_t seq = 0;
+    long sent = 0;
+    long syscalls = 0;
+    int k;
+
+    for (k = 0; k < num_students; k++) {
+        close(ta_ends[k]);
+    }
+    while (sent < num_requests) {
+        int batch = num_requests - sent < window ? (int)(num_requests - sent) : window;
+        uint32_t first = seq + 1;
+
+        for (k = 0; k < batch; k++) {
+            help_request_t req;
+            req.seq = ++seq;
+            req.student = (uint32_t)id;
+            if (write(fd, &req, sizeof(req)) != (ssize_t)sizeof(req)) {
+                return 1;
+            }
+            syscalls++;
+        }
+        have = 0;
+        while (have < sizeof(help_reply_t) * (size_t)batch) {
+            ssize_t got = read(fd, buf + have, sizeof(help_reply_t) * (size_t)batch - have);
+            syscalls++;
+            if (got <= 0) {
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                return 1;
+            }
+            have += (size_t)got;
+        }
+        for (k = 0; k < batch; k++) {
+            help_reply_t reply;
+            memcpy(&reply, buf + sizeof(reply) * (size_t)k, sizeof(reply));
+            if (reply.seq != first + (uint32_t)k) {
+                atomic_fetch_add(&shm->bad_replies, 1);
+            }
+        }
+        sent += batch;
+    } //end while
+    atomic_fetch_add(&shm->syscalls, syscalls);
+    close(fd);
+    return 0;
+} //end student_socket_process
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,511 @@
+//TA_Server.c
+#define _GNU_SOURCE                     //accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include "office_model.h"
+#include "ta_wire.h"
+
+/****************************************************************************
+* The TA as a single-threaded server
+* Students are clients on a Unix domain socket; each one sends a help
+* request (ta_wire.h) and waits for the reply. One thread runs everything
+* from one epoll loop:
+*   - the listening socket, to accept new students
+*   - every student's socket, to read their requests
+*   - one timerfd, which goes off when the current help session ends
+*   - a signalfd for SIGINT/SIGTERM, to stop and print the totals
+* The rules are the ones in TA_Sim.c: a request that finds the TA busy
+* takes one of num_chairs hallway chairs, and a request that finds every
+* chair taken is answered "Hallway full" right away. The TA helps the
+* front of the line for a help time drawn from -H.
+****************************************************************************/
+
+#define MAX_EVENTS 256
+#define OUT_BUFFER 128                  //bytes of replies queued per student
+
+typedef struct {
+    int open;
+    unsigned gen;                       //bumped on close, so stale references show
+    char in[sizeof(help_request_t)];    //partial request
+    size_t in_len;
+    char out[OUT_BUFFER];               //replies not yet written
+    size_t out_len;
+    int want_out;                       //EPOLLOUT is armed
+    help_request_t req;                 //request waiting in the hallway
+    double arrived;
+    int seated;                         //1 while in the hallway line
+    int prev;                           //hallway line neighbours (fds, -1 = none)
+    int next;
+} conn_t;
+
+/****************************************************************************
+* Global server state
+****************************************************************************/
+int num_chairs = 3;
+dist_t help_time = { DIST_CONST, 5.0, 0.0 };
+int verbose = 0;
+
+conn_t* conns;                          //indexed by fd
+int max_fds;
+int epoll_fd;
+int timer_fd;
+
+int hall_head = -1;                     //front of the line (fd)
+int hall_tail = -1;
+int waiting_students = 0;
+
+int ta_fd = -1;                         //student with the TA (-1 = nobody)
+unsigned ta_gen;
+int ta_busy = 0;
+uint32_t ta_seq;
+double ta_waited;
+double ta_help;
+double busy_since;
+double busy_total = 0.0;
+uint64_t ta_rng;
+
+long accepted = 0;
+int connected = 0;
+int peak_connected = 0;
+long requests = 0;
+long helped = 0;
+long rejected = 0;
+long abandoned = 0;                     //students who hung up while waiting or being helped
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static void accept_students(int listen_fd);
+static void read_requests(int fd);
+static void handle_request(int fd, const help_request_t* req);
+static void start_help(int fd, const help_request_t* req, double waited);
+static void finish_help(void);
+static void send_reply(int fd, uint32_t seq, uint32_t status, double waited, double help);
+static void flush_out(int fd);
+static void close_student(int fd);
+static void hall_push(int fd);
+static void hall_remove(int fd);
+static double now_sec(void);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event ev;
+    struct sockaddr_un addr;
+    struct rlimit limit;
+    sigset_t stop_signals;
+    const char* path = "TA_Server.sock";
+    double start;
+    double elapsed;
+    int listen_fd;
+    int signal_fd;
+    int running = 1;
+    int opt;
+    int n;
+    int i;
+
+    while ((opt = getopt(argc, argv, "u:c:H:v")) != -1) {
+        switch (opt) {
+        case 'u': path = optarg; break;
+        case 'c': num_chairs = atoi(optarg); break;
+        case 'H':
+            if (dist_parse(&help_time, optarg) != 0) {
+                printf("Bad help time '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'v': verbose = 1; break;
+        default:
+            printf("Usage: %s [-u socket path] [-c chairs] [-H help time] [-v]\n"
+                   "Times look like const:5, uniform:1:5 or exp:120 (seconds).\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_chairs < 1 || help_time.kind == DIST_NEVER ||
+        strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Invalid input. Exiting.\n");
+        return 1;
+    }
+
+    //One connection per student: allow as many open files as we may
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    max_fds = limit.rlim_cur > 1048576 ? 1048576 : (int)limit.rlim_cur;
+    conns = (conn_t*)calloc((size_t)max_fds, sizeof(conn_t));
+    if (conns == NULL) {
+        printf("Error: unable to allocate connections.\n");
+        return 1;
+    }
+    ta_rng = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL;
+
+    //Listening socket, help timer and stop signals, all in one epoll set
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        printf("Error: unable to listen on %s\n", path);
+        return 1;
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, NULL);
+    signal(SIGPIPE, SIG_IGN);           //a student who hung up shows as EPIPE instead
+    signal_fd = signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (timer_fd < 0 || signal_fd < 0 || epoll_fd < 0) {
+        printf("Error: unable to set up the event loop.\n");
+        return 1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    ev.data.fd = signal_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    printf("TA: Listening on %s with %d chair(s), up to %d connections. Ctrl-C to stop.\n",
+           path, num_chairs, max_fds - 8);
+    printf("TA: Waiting for a student (sleeping)...\n");
+    start = now_sec();
+
+    while (running) {
+        n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            printf("Error: epoll_wait failed.\n");
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == listen_fd) {
+                accept_students(listen_fd);
+            } else if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    finish_help();
+                }
+            } else if (fd == signal_fd) {
+                running = 0;
+            } else if (conns[fd].open) {
+                //Skips events queued for a connection closed earlier in this batch
+                if (events[i].events & EPOLLOUT) {
+                    flush_out(fd);
+                }
+                if (conns[fd].open && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    read_requests(fd);
+                }
+            }
+        } //end for (each ready fd)
+    } //end while
+
+    elapsed = now_sec() - start;
+    if (ta_busy) {
+        busy_total += now_sec() - busy_since;
+    }
+    printf("\nTA: Closing after %.2f s.\n", elapsed);
+    printf("  students connected : %ld in total, %d at most at once\n", accepted, peak_connected);
+    printf("  help requests      : %ld (%.0f/s)\n", requests,
+           elapsed > 0.0 ? requests / elapsed : 0.0);
+    printf("  helped             : %ld; hallway full: %ld; hung up first: %ld\n",
+           helped, rejected, abandoned);
+    printf("  TA busy            : %.1f%% of the time\n",
+           elapsed > 0.0 ? 100.0 * busy_total / elapsed : 0.0);
+
+    close(listen_fd);
+    unlink(path);
+    free(conns);
+    return 0;
+} //end main
+
+/****************************************************************************
+* Function: accept_students
+* What it does: Accepts every pending connection and adds it to the loop.
+****************************************************************************/
+static void accept_students(int listen_fd) {
+    struct epoll_event ev;
+    int fd;
+
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        conn_t* c;
+        if (fd >= max_fds) {
+            close(fd);
+            continue;
+        }
+        c = &conns[fd];
+        c->open = 1;
+        c->in_len = 0;
+        c->out_len = 0;
+        c->want_out = 0;
+        c->seated = 0;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        accepted++;
+        if (++connected > peak_connected) {
+            peak_connected = connected;
+        }
+    } //end while
+} //end accept_students
+
+/****************************************************************************
+* Function: read_requests
+* What it does: Reads what the student sent and handles every complete
+*               request in it. A closed or broken connection is dropped.
+****************************************************************************/
+static void read_requests(int fd) {
+    conn_t* c = &conns[fd];
+    char buf[4096];
+    ssize_t got;
+    ssize_t i;
+
+    while (c->open) {
+        got = read(fd, buf, sizeof(buf));
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+            close_student(fd);
+            return;
+        }
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; //EAGAIN: all read
+        }
+        for (i = 0; i < got && c->open; i++) {
+            c->in[c->in_len++] = buf[i];
+            if (c->in_len == sizeof(help_request_t)) {
+                help_request_t req;
+                memcpy(&req, c->in, sizeof(req));
+                c->in_len = 0;
+                handle_request(fd, &req);
+            }
+        }
+    } //end while
+} //end read_requests
+
+/****************************************************************************
+* Function: handle_request
+* What it does: Applies the hallway rules to one help request: straight
+*               to the TA if the TA is asleep, into a chair if one is
+*               free, otherwise "Hallway full".
+****************************************************************************/
+static void handle_request(int fd, const help_request_t* req) {
+    conn_t* c = &conns[fd];
+
+    requests++;
+    if (!ta_busy) {
+        start_help(fd, req, 0.0);
+    } else if (waiting_students < num_chairs && !c->seated) {
+        c->req = *req;
+        c->arrived = now_sec();
+        hall_push(fd);
+        if (verbose) {
+            printf("Student %u: Sitting in hallway. Students waiting = %d\n",
+                   req->student, waiting_students);
+        }
+    } else {
+        rejected++;
+        if (verbose) {
+            printf("Student %u: Hallway full.\n", req->student);
+        }
+        send_reply(fd, req->seq, REPLY_FULL, 0.0, 0.0);
+    }
+} //end handle_request
+
+/****************************************************************************
+* Function: start_help / finish_help
+* What it does: start_help puts a student with the TA and arms the timer
+*               for the end of the session (an absolute deadline).
+*               finish_help answers that student and calls in the front
+*               of the line, or lets the TA sleep.
+****************************************************************************/
+static void start_help(int fd, const help_request_t* req, double waited) {
+    struct itimerspec when;
+    struct timespec now;
+    double help = dist_draw(&help_time, &ta_rng);
+    long ns;
+
+    if (!ta_busy) {
+        busy_since = now_sec();
+    }
+    ta_busy = 1;
+    ta_fd = fd;
+    ta_gen = conns[fd].gen;
+    ta_seq = req->seq;
+    ta_waited = waited;
+    ta_help = help;
+    if (verbose) {
+        printf("TA: Helping student %u. Students still waiting = %d\n",
+               req->student, waiting_students);
+    }
+
+    //A zero it_value would disarm the timer, so a 0 s session still waits 1 ns
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = now.tv_nsec + (long)((help - (long)help) * 1e9) + 1;
+    memset(&when, 0, sizeof(when));
+    when.it_value.tv_sec = now.tv_sec + (time_t)help + ns / 1000000000L;
+    when.it_value.tv_nsec = ns % 1000000000L;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+} //end start_help
+
+static void finish_help(void) {
+    if (ta_fd >= 0 && conns[ta_fd].open && conns[ta_fd].gen == ta_gen) {
+        helped++;
+        send_reply(ta_fd, ta_seq, REPLY_HELPED, ta_waited, ta_help);
+    }
+    ta_fd = -1;
+
+    if (hall_head >= 0) {
+        int fd = hall_head;
+        conn_t* c = &conns[fd];
+        hall_remove(fd);
+        start_help(fd, &c->req, now_sec() - c->arrived);
+    } else {
+        ta_busy = 0;
+        busy_total += now_sec() - busy_since;
+        if (verbose) {
+            printf("TA: Waiting for a student (sleeping)...\n");
+        }
+    }
+} //end finish_help
+
+/****************************************************************************
+* Function: send_reply / flush_out
+* What it does: Queues a reply and writes as much as the socket takes;
+*               whatever is left goes out when the socket is writable.
+****************************************************************************/
+static void send_reply(int fd, uint32_t seq, uint32_t status, double waited, double help) {
+    conn_t* c = &conns[fd];
+    help_reply_t reply;
+
+    if (c->out_len + sizeof(reply) > OUT_BUFFER) {
+        close_student(fd); //not reading its replies
+        return;
+    }
+    memset(&reply, 0, sizeof(reply));
+    reply.seq = seq;
+    reply.status = status;
+    reply.waited = waited;
+    reply.helped_for = help;
+    memcpy(c->out + c->out_len, &reply, sizeof(reply));
+    c->out_len += sizeof(reply);
+    flush_out(fd);
+} //end send_reply
+
+static void flush_out(int fd) {
+    conn_t* c = &conns[fd];
+    struct epoll_event ev;
+    ssize_t put;
+
+    while (c->out_len > 0) {
+        put = write(fd, c->out, c->out_len);
+        if (put < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                close_student(fd);
+                return;
+            }
+            break;
+        }
+        memmove(c->out, c->out + put, c->out_len - (size_t)put);
+        c->out_len -= (size_t)put;
+    } //end while
+
+    //Ask for EPOLLOUT only while something is left to write
+    if ((c->out_len > 0) != c->want_out) {
+        c->want_out = c->out_len > 0;
+        ev.events = EPOLLIN | EPOLLRDHUP | (c->want_out ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+} //end flush_out
+
+static void close_student(int fd) {
+    conn_t* c = &conns[fd];
+
+    if (!c->open) {
+        return;
+    }
+    if (c->seated) {
+        hall_remove(fd);
+        abandoned++;
+    } else if (fd == ta_fd && c->gen == ta_gen) {
+        abandoned++; //the session runs out anyway; nobody gets the reply
+    }
+    c->open = 0;
+    c->gen++;
+    c->in_len = 0;
+    c->out_len = 0;
+    c->want_out = 0;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    connected--;
+} //end close_student
+
+/****************************************************************************
+* Function: hall_push / hall_remove
+* What it does: The hallway line, linked through the connections in
+*               arrival order, so a student who hangs up can leave from
+*               anywhere in it.
+****************************************************************************/
+static void hall_push(int fd) {
+    conn_t* c = &conns[fd];
+
+    c->seated = 1;
+    c->next = -1;
+    c->prev = hall_tail;
+    if (hall_tail >= 0) {
+        conns[hall_tail].next = fd;
+    } else {
+        hall_head = fd;
+    }
+    hall_tail = fd;
+    waiting_students++;
+} //end hall_push
+
+static void hall_remove(int fd) {
+    conn_t* c = &conns[fd];
+
+    if (c->prev >= 0) {
+        conns[c->prev].next = c->next;
+    } else {
+        hall_head = c->next;
+    }
+    if (c->next >= 0) {
+        conns[c->next].prev = c->prev;
+    } else {
+        hall_tail = c->prev;
+    }
+    c->prev = c->next = -1;
+    c->seated = 0;
+    waiting_students--;
+} //end hall_remove
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
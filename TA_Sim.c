@@ -5,6 +5,18 @@
 #include <semaphore.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "office_model.h"
+#include "ta_metrics.h"
+#include "ta_vclock.h"
 
 /****************************************************************************
 * Global synchronization objects and shared state
@@ -17,28 +29,412 @@ int num_chairs = 0;                     //number of chairs in the hallway
 int waiting_students = 0;               //current number of students waiting for the TA
 int students_finished = 0;              //how many students are completely done
 int all_done = 0;                       //flag set when all students have finished
+int students_seated = 0;                //visits that got a chair
+int students_reneged = 0;               //seated students who gave up waiting
+double reneged_wait_sum = 0.0;          //how long they sat before giving up, on schedule
+int students_rejected = 0;              //"Hallway full" turn-aways
+int students_helped = 0;                //help sessions given
+int students_parked = 0;                //turned-away visits that took a callback ticket
+double schedule_lag_sum = 0.0;          //how far behind their schedules students finished
+double schedule_lag_max = 0.0;
+long lock_acquisitions = 0;             //times anyone took the mutex
 
 #define HELP_REQUESTS_PER_STUDENT 3     //how many times each student will ask for help
 
+/****************************************************************************
+* Timing and retry settings
+* Programming and help times are drawn from the same distributions as the
+* virtual-time model (office_model.h). A student turned away by a full
+* hallway keeps coming back for the same visit, waiting between tries as
+* the retry policy says.
+*
+* Times on the command line are scenario times, in seconds unless -u says
+* otherwise, and -S runs the scenario that many times faster than real
+* time. They are turned into real seconds once, when the options are read
+* (and each time a distribution is drawn from), so everything that sleeps
+* or reads the clock works in real seconds; messages print scenario times.
+****************************************************************************/
+#define RETRY_FIXED    0                //always retry_base seconds (the original sleep(1))
+#define RETRY_EXP      1                //exponential backoff with full jitter
+#define RETRY_DECORR   2                //decorrelated jitter
+#define RETRY_ADVISED  3                //come back when the office says a chair frees up
+#define RETRY_VIRTUAL  4                //take a callback ticket and wait to be seated
+
+dist_t program_time = { DIST_UNIFORM, 1.0, 5.0 }; //time programming between visits
+dist_t help_time = { DIST_CONST, 5.0, 0.0 };      //time the TA spends with one student
+int retry_policy = RETRY_FIXED;
+double retry_base = 1.0;                //first/fixed retry delay in seconds
+double retry_cap = 30.0;                //longest backoff delay in seconds
+double help_ends_at = 0.0;              //when the current help session ends (mutex)
+double help_avg = 5.0;                  //running average of help times (mutex)
+double advised_until = 0.0;             //last retry time handed out (mutex)
+double balk_wait = 0.0;                 //skip the trip if the expected wait is longer (0 = off)
+double time_scale = 1.0;                //real seconds per scenario time unit
+const char* time_unit = "seconds";      //unit scenario times are printed in
+
+int ta_helping = 0;                     //student the TA called in last (mutex)
+
+/****************************************************************************
+* Published office board
+* Whoever changes the shared state (always under the mutex) republishes
+* the counters, the line length and the TA's help times on the board.
+* Observers - students checking the expected wait, the sampler thread -
+* read a consistent copy without the mutex: the sequence number is odd
+* while an update is in progress, and a reader retries if it changed.
+****************************************************************************/
+typedef struct {
+    int waiting;                        //students in the hallway
+    int seated;                         //visits that got a chair
+    int rejected;                       //"Hallway full" turn-aways
+    int reneged;                        //seated students who gave up
+    int parked;                         //callback tickets taken
+    int helped;                         //help sessions given
+    int finished;                       //students done for the day
+    int ta_helping;                     //student the TA called in last (0 = none yet)
+    double help_avg;                    //running average help time
+    double help_ends_at;                //end of the current session (TA busy until then)
+} office_view_t;
+
+typedef struct {
+    atomic_uint seq;
+    _Atomic int waiting;
+    _Atomic int seated;
+    _Atomic int rejected;
+    _Atomic int reneged;
+    _Atomic int parked;
+    _Atomic int helped;
+    _Atomic int finished;
+    _Atomic int ta_helping;
+    _Atomic double help_avg;
+    _Atomic double help_ends_at;
+} office_board_t;
+
+office_board_t board;
+
+/****************************************************************************
+* Queue-length sampler
+* With -i a sampler thread reads the board every interval seconds and
+* keeps the most recent SAMPLE_RING samples in a ring buffer.
+****************************************************************************/
+#define SAMPLE_RING 4096
+
+typedef struct {
+    double time;                        //seconds since the start of the run
+    int waiting;
+    int helped;
+    int ta_busy;
+} sample_t;
+
+sample_t samples[SAMPLE_RING];
+long samples_taken = 0;                 //total samples; the ring keeps the last SAMPLE_RING
+double sample_interval = 0.0;           //seconds between samples (0 = no sampler)
+double sample_wait_sum = 0.0;           //sum of sampled line lengths
+int sample_wait_max = 0;
+atomic_int sampler_stop = 0;
+double run_start = 0.0;
+
+/****************************************************************************
+* Hallway line
+* Each student owns one seat_t. Seated students are linked in arrival order,
+* so the TA calls in the front of the line and a student who runs out of
+* patience can leave from anywhere in it in O(1).
+****************************************************************************/
+typedef struct ticket {
+    _Atomic(struct ticket*) next;
+} ticket_t;
+
+typedef struct seat {
+    ticket_t ticket;                    //link in the callback line (first member)
+    int id;                             //student ID
+    int seated;                         //1 while in the hallway line
+    uint64_t rng;                       //student's stream for patience draws
+    sem_t called;                       //posted when the TA calls this student in
+    sem_t helped;                       //posted when the TA is done helping
+    sem_t parked;                       //posted when a callback ticket got a chair
+    sem_t alarm;                        //-V: posted when a virtual sleep is over
+    struct seat* prev;
+    struct seat* next;
+    double clock;                       //where this student is on their own schedule
+    double seated_at;                   //when they last sat down (set under the mutex)
+    double helped_until;                //when the TA's help ends (set under the mutex)
+
+    //Event driver only (-e): where this student is in their day
+    int phase;
+    int visit;                          //help sessions had so far
+    int attempt;                        //tries turned away on this visit
+    double prev_delay;                  //retry_delay state
+    double sat_down;
+    unsigned timer_gen;                 //bumped to cancel the pending timer
+} seat_t;
+
+seat_t* seats;                          //one per student, index id - 1
+seat_t* hall_head = NULL;               //front of the line
+seat_t* hall_tail = NULL;               //back of the line
+dist_t patience = { DIST_NEVER, 0.0, 0.0 }; //how long a seated student waits
+
+/****************************************************************************
+* Virtual queue (callback tickets)
+* With -b virtual a turned-away student does not come back to poll. They
+* push their seat onto a lock-free multi-producer queue of tickets and
+* block. Whoever frees a chair (the TA calling someone in, or a student
+* giving up) already holds the mutex, pops tickets and seats those
+* students on their behalf, so only one thread pops at a time.
+****************************************************************************/
+typedef struct {
+    _Atomic(ticket_t*) head;            //students swap themselves in here
+    _Atomic(ticket_t*) tail;            //popped under the mutex, peeked by the TA
+    ticket_t stub;
+} ticket_line_t;
+
+ticket_line_t callbacks;
+atomic_int ta_idle = 0;                 //1 while the TA is about to sleep or asleep
+
+/****************************************************************************
+* Event-driven students
+* Normally every student is a thread that blocks in its own sleeps and
+* semaphore waits. With -e no student gets a thread: one driver thread
+* runs them all as small state machines from an epoll loop. Every timed
+* wait (programming, a retry delay, patience in the hallway) goes on a
+* min-heap of wake-up times, and one timerfd is set for the earliest.
+* What the TA and the callback line would post on a student's semaphores
+* arrives as a note in the driver's inbox instead, with an eventfd to
+* wake the loop. The mutex, students_sem and the TA thread are unchanged.
+****************************************************************************/
+#define NOTE_CALLED 0                   //the TA called the student in
+#define NOTE_HELPED 1                   //the TA is done helping
+#define NOTE_PARKED 2                   //a callback ticket got a chair
+
+#define PHASE_PROGRAMMING 0
+#define PHASE_RETRYING    1             //turned away or balked, coming back later
+#define PHASE_SEATED      2
+#define PHASE_WITH_TA     3
+#define PHASE_PARKED      4
+#define PHASE_DONE        5
+
+typedef struct {
+    double time;                        //monotonic seconds
+    int id;
+    unsigned gen;                       //stale if the seat's timer_gen moved on
+    int overdue;                        //already due when set: not a real sleep
+} student_timer_t;
+
+typedef struct {
+    int id;
+    int note;
+} student_note_t;
+
+int event_driver = 0;                   //-e: students on one driver thread
+student_timer_t* timers;                //min-heap on time (driver thread only)
+int num_timers = 0;
+int timers_cap = 0;
+pthread_mutex_t inbox_lock;
+student_note_t* inbox;                  //notes not yet handled (inbox_lock)
+student_note_t* inbox_spare;            //the driver's copy while it handles them
+int inbox_count = 0;
+int inbox_fd = -1;                      //eventfd: the inbox went from empty to not
+
+/****************************************************************************
+* Virtual clock (-V)
+* The same threads, mutex and semaphores, but every sleep is an alarm on
+* the clock in ta_vclock.c, which jumps ahead whenever all the threads are
+* blocked. Every post that lets a thread through goes through wake_up,
+* every wait through wait_on and every sem_trywait through take_back, so
+* the clock knows who can still run.
+****************************************************************************/
+int virtual_clock = 0;
+sem_t ta_alarm;                         //posted when the TA's virtual sleep is over
+
+void hall_push(seat_t* seat);
+void hall_remove(seat_t* seat);
+void lock_office(void);
+void park_push(ticket_line_t* line, ticket_t* ticket);
+seat_t* park_pop(ticket_line_t* line);
+void park(seat_t* seat);
+void notify_student(seat_t* seat, int note);
+void timer_push(seat_t* seat, double time);
+student_timer_t timer_pop(void);
+void admit_parked(double when);
+void publish_board(void);
+void read_board(office_view_t* view);
+double expected_wait(void);
+void* sampler_thread(void* param);
+void write_gauges(FILE* out);
+int write_samples(const char* path);
+double now_sec(void);
+double wall_sec(void);
+void sleep_until(int shard, double deadline);
+void wake_up(sem_t* sem);
+void wait_on(sem_t* sem);
+void take_back(sem_t* sem);
+double retry_delay(int attempt, double* prev, double advised, uint64_t* rng);
+double draw_time(const dist_t* dist, uint64_t* rng);
+int count_threads(void);
+void compare_ground_truth(int reps, double elapsed);
+
 /****************************************************************************
 * Thread function prototypes
 ****************************************************************************/
 void* ta_thread(void* param);
 void* student_thread(void* num);
+void* driver_thread(void* param);
+int wait_for_call(seat_t* seat);
+int leave_line(seat_t* seat, double when);
+int try_visit(seat_t* seat, int attempt, double* prev, double* delay);
+void finish_student(int id);
+void start_programming(seat_t* seat);
+void go_to_office(seat_t* seat);
+void sit_down(seat_t* seat);
+int end_visit(seat_t* seat, int helped);
+int student_timer_due(seat_t* seat, double when);
+int student_note(seat_t* seat, int note);
+
+//What try_visit did
+#define VISIT_SEATED 0                  //sat down in the hallway
+#define VISIT_PARKED 1                  //took a callback ticket
+#define VISIT_RETRY  2                  //come back after *delay seconds
 
 /****************************************************************************
  * Main Function
 ****************************************************************************/
 
-int main() {
+int main(int argc, char* argv[]) {
     //Declare local variables
     int i;
+    int opt;
     pthread_t ta_handle;
     pthread_t* student_handles;
     int* student_ids;
+    uint64_t ta_rng;
+    struct rusage usage;
+    pthread_t sampler_handle;
+    pthread_t driver_handle;
+    const char* sample_file = NULL;
+    const char* metrics_path = NULL;
+    double start;
+    double elapsed;
+    int threads_seen;
+    int bad = 0;
+    double unit = 1.0;
+    double speed = 1.0;
+    int truth_reps = 0;
+    unsigned int seed = (unsigned int)time(NULL);
+    double wall_start;
+
+    //Optional settings; times are distributions like exp:8, const:10,
+    //uniform:1:5 or never
+    while ((opt = getopt(argc, argv, "p:P:H:b:r:m:w:i:o:M:eu:S:g:Vs:")) != -1) {
+        switch (opt) {
+        case 'p':
+            bad |= dist_parse(&patience, optarg);
+            break;
+        case 'P':
+            bad |= dist_parse(&program_time, optarg);
+            break;
+        case 'H':
+            bad |= dist_parse(&help_time, optarg);
+            break;
+        case 'b':
+            if (strcmp(optarg, "fixed") == 0) {
+                retry_policy = RETRY_FIXED;
+            } else if (strcmp(optarg, "exp") == 0) {
+                retry_policy = RETRY_EXP;
+            } else if (strcmp(optarg, "decorr") == 0) {
+                retry_policy = RETRY_DECORR;
+            } else if (strcmp(optarg, "advised") == 0) {
+                retry_policy = RETRY_ADVISED;
+            } else if (strcmp(optarg, "virtual") == 0) {
+                retry_policy = RETRY_VIRTUAL;
+            } else {
+                bad = 1;
+            }
+            break;
+        case 'r':
+            retry_base = atof(optarg);
+            bad |= retry_base <= 0.0;
+            break;
+        case 'm':
+            retry_cap = atof(optarg);
+            bad |= retry_cap <= 0.0;
+            break;
+        case 'w':
+            balk_wait = atof(optarg);
+            bad |= balk_wait <= 0.0;
+            break;
+        case 'i':
+            sample_interval = atof(optarg);
+            bad |= sample_interval <= 0.0;
+            break;
+        case 'o':
+            sample_file = optarg;
+            break;
+        case 'M':
+            metrics_path = optarg;
+            break;
+        case 'e':
+            event_driver = 1;
+            break;
+        case 'u':
+            if (strcmp(optarg, "s") == 0) {
+                unit = 1.0;
+                time_unit = "seconds";
+            } else if (strcmp(optarg, "ms") == 0) {
+                unit = 1e-3;
+                time_unit = "ms";
+            } else if (strcmp(optarg, "us") == 0) {
+                unit = 1e-6;
+                time_unit = "us";
+            } else {
+                bad = 1;
+            }
+            break;
+        case 'S':
+            speed = atof(optarg);
+            bad |= speed <= 0.0;
+            break;
+        case 'g':
+            truth_reps = atoi(optarg);
+            bad |= truth_reps <= 0;
+            break;
+        case 'V':
+            virtual_clock = 1;
+            break;
+        case 's':
+            seed = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            bad = 1;
+        }
+    } //end while
+    //The virtual clock only knows the student and TA threads
+    bad |= virtual_clock && (event_driver || sample_interval > 0.0);
+    if (bad || program_time.kind == DIST_NEVER || help_time.kind == DIST_NEVER) {
+        printf("Usage: %s [-p patience] [-P program time] [-H help time]\n"
+               "       [-b fixed|exp|decorr|advised|virtual] [-r retry seconds] [-m max backoff]\n"
+               "       [-w skip the trip if the expected wait is longer]\n"
+               "       [-i sample the line every SECONDS] [-o samples.csv]\n"
+               "       [-M serve Prometheus metrics on this Unix socket]\n"
+               "       [-e run every student on one event-loop thread]\n"
+               "       [-u s|ms|us unit of the times above] [-S run this many times faster]\n"
+               "       [-g compare with this many runs of the virtual-time model]\n"
+               "       [-V run on a virtual clock (not with -e or -i)] [-s random seed]\n"
+               "Times are distributions such as exp:8, const:10, uniform:1:5 or never.\n",
+               argv[0]);
+        return 1;
+    }
+
+    //From here on every time is in real seconds
+    time_scale = unit / speed;
+    retry_base *= time_scale;
+    retry_cap *= time_scale;
+    balk_wait *= time_scale;
 
     //Seed the random number generator so each run looks different
-    srand((unsigned int)time(NULL));
+    //(unless -s gives the seed)
+    srand(seed);
+    ta_rng = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+    help_avg = help_time.kind == DIST_UNIFORM ? (help_time.a + help_time.b) / 2.0 : help_time.a;
+    help_avg *= time_scale;
+    publish_board();
 
     //Prompt for number of students and number of chairs
     printf("Enter number of students: ");
@@ -47,7 +443,8 @@ int main() {
     printf("Enter number of chairs in hallway: ");
     scanf("%d", &num_chairs);
 
-    if (num_students <= 0 || num_chairs < 0) {
+    //At least one chair, or turned-away students would retry forever
+    if (num_students <= 0 || num_chairs < 1) {
         printf("Invalid input. Exiting.\n");
         return 1;
     }
@@ -55,57 +452,200 @@ int main() {
     //Allocate arrays for threads and IDs
     student_handles = (pthread_t*)malloc(sizeof(pthread_t) * num_students);
     student_ids = (int*)malloc(sizeof(int) * num_students);
-    if (student_handles == NULL || student_ids == NULL) {
+    seats = (seat_t*)calloc(num_students, sizeof(seat_t));
+    if (student_handles == NULL || student_ids == NULL || seats == NULL ||
+        metrics_init(num_students + 1) != 0) { //shard 0 is the TA's, shard id each student's
         printf("Error: unable to allocate memory for threads.\n");
         free(student_handles);
         free(student_ids);
+        free(seats);
         return 1;
     }
+    for (i = 0; i < num_students; i++) {
+        seats[i].id = i + 1;
+        seats[i].rng = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+        sem_init(&seats[i].called, 0, 0);
+        sem_init(&seats[i].helped, 0, 0);
+        sem_init(&seats[i].parked, 0, 0);
+        sem_init(&seats[i].alarm, 0, 0);
+    }
+
+    //The driver's inbox: a student has at most three notes pending
+    //(parked, called, helped) before the driver acts on them
+    if (event_driver) {
+        inbox = (student_note_t*)malloc(sizeof(student_note_t) * 3 * num_students);
+        inbox_spare = (student_note_t*)malloc(sizeof(student_note_t) * 3 * num_students);
+        inbox_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (inbox == NULL || inbox_spare == NULL || inbox_fd < 0) {
+            printf("Error: unable to set up the event driver.\n");
+            return 1;
+        }
+        pthread_mutex_init(&inbox_lock, NULL);
+    }
 
     //Initialize mutex and semaphore
     pthread_mutex_init(&mutex, NULL);
     sem_init(&students_sem, 0, 0); //start with 0 students waiting
+    atomic_store(&callbacks.stub.next, NULL);
+    atomic_store(&callbacks.head, &callbacks.stub);
+    atomic_store(&callbacks.tail, &callbacks.stub);
+
+    //On the virtual clock, time starts at 0 with every thread able to run
+    if (virtual_clock) {
+        sem_init(&ta_alarm, 0, 0);
+        //Each student has four semaphores, the TA students_sem and ta_alarm
+        if (vclock_start(0.0, num_students + 1, 4 * num_students + 2) != 0) {
+            printf("Error: unable to start the virtual clock.\n");
+            return 1;
+        }
+    }
 
     //Create the TA thread
-    if (pthread_create(&ta_handle, NULL, ta_thread, NULL) != 0) {
+    wall_start = wall_sec();
+    start = now_sec();
+    run_start = start;
+    for (i = 0; i < num_students; i++) {
+        seats[i].clock = start;
+    }
+    if (pthread_create(&ta_handle, NULL, ta_thread, &ta_rng) != 0) {
         printf("Error: unable to create TA thread.\n");
         free(student_handles);
         free(student_ids);
+        free(seats);
         pthread_mutex_destroy(&mutex);
         sem_destroy(&students_sem);
         return 1;
     }
 
-    //Create the student threads
-    for (i = 0; i < num_students; i++) {
-        student_ids[i] = i + 1; //give students IDs 1..num_students
-        if (pthread_create(&student_handles[i], NULL, student_thread, &student_ids[i]) != 0) {
-            printf("Error: unable to create student thread %d.\n", i + 1);
+    //Create the student threads, or the one thread that drives them all
+    if (event_driver) {
+        if (pthread_create(&driver_handle, NULL, driver_thread, NULL) != 0) {
+            printf("Error: unable to create the event driver thread.\n");
+            return 1;
         }
+    } else {
+        for (i = 0; i < num_students; i++) {
+            student_ids[i] = i + 1; //give students IDs 1..num_students
+            if (pthread_create(&student_handles[i], NULL, student_thread, &student_ids[i]) != 0) {
+                printf("Error: unable to create student thread %d.\n", i + 1);
+            }
+        }
+    }
+
+    //Start the metrics exporter and the sampler, if asked for
+    if (metrics_path != NULL && metrics_serve_start(metrics_path, write_gauges) != 0) {
+        printf("Error: unable to serve metrics on %s\n", metrics_path);
+    }
+    if (sample_interval > 0.0 &&
+        pthread_create(&sampler_handle, NULL, sampler_thread, NULL) != 0) {
+        printf("Error: unable to create sampler thread.\n");
+        sample_interval = 0.0;
     }
 
     //Wait for all student threads to finish
-    for (i = 0; i < num_students; i++) {
-        pthread_join(student_handles[i], NULL);
+    threads_seen = count_threads();
+    if (event_driver) {
+        pthread_join(driver_handle, NULL);
+    } else {
+        for (i = 0; i < num_students; i++) {
+            pthread_join(student_handles[i], NULL);
+        }
     }
 
     //At this point, all students have finished their help cycles
     //Let the TA know that everyone is done
-    pthread_mutex_lock(&mutex);
+    lock_office();
     all_done = 1;
     pthread_mutex_unlock(&mutex);
 
     //Wake up TA in case it is sleeping on the semaphore
-    sem_post(&students_sem);
+    wake_up(&students_sem);
 
     //End the TA thread after all students are done
     pthread_join(ta_handle, NULL);
+    elapsed = now_sec() - start;
+    if (sample_interval > 0.0) {
+        atomic_store(&sampler_stop, 1);
+        pthread_join(sampler_handle, NULL);
+    }
+    metrics_serve_stop();
+    getrusage(RUSAGE_SELF, &usage);
+
+    //Report what the retry policy cost
+    printf("Helped %d times in %.2f seconds (%.1f helps/s); %d visits turned away\n",
+           students_helped, elapsed, elapsed > 0.0 ? students_helped / elapsed : 0.0,
+           students_rejected);
+    printf("Mutex taken %ld times (%.2f per help)\n", lock_acquisitions,
+           students_helped ? (double)lock_acquisitions / students_helped : 0.0);
+    printf("CPU time: %.2f s user + %.2f s system; %d callback tickets\n",
+           usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6,
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6, students_parked);
+    if (virtual_clock) {
+        printf("Virtual clock: jumped %ld times; the run took %.3f s of wall time\n",
+               vclock_jumps(), wall_sec() - wall_start);
+    } else {
+        printf("Timed sleeps: %ld; woke up late by p50 %.0f us, p90 %.0f us, p99 %.0f us, "
+               "p99.9 %.0f us\n", metrics_count(MET_HIST_OVERSHOOT),
+               1e6 * metrics_quantile(MET_HIST_OVERSHOOT, 0.5),
+               1e6 * metrics_quantile(MET_HIST_OVERSHOOT, 0.9),
+               1e6 * metrics_quantile(MET_HIST_OVERSHOOT, 0.99),
+               1e6 * metrics_quantile(MET_HIST_OVERSHOOT, 0.999));
+    }
+    printf("Students finished %.3f ms behind their own schedules on average (%.3f ms at most)\n",
+           1e3 * schedule_lag_sum / num_students, 1e3 * schedule_lag_max);
+    if (time_scale != 1.0) {
+        printf("Scenario time: %.4g %s at %gx speed\n",
+               elapsed / time_scale, time_unit, speed);
+    }
+    printf("Threads while running: %d (%s)\n", threads_seen,
+           event_driver ? "students on one event-loop thread" : "one per student");
+    printf("Wasted trips (turned away or gave up): %d; trips skipped on the estimate: %d\n",
+           students_rejected + students_reneged, (int)metrics_total(MET_BALKED));
+
+    //Report the sampled line lengths, and save the ring if asked for
+    if (sample_interval > 0.0) {
+        printf("Sampled the line %ld times every %g s: mean %.2f, max %d waiting\n",
+               samples_taken, sample_interval,
+               samples_taken ? sample_wait_sum / samples_taken : 0.0, sample_wait_max);
+        if (sample_file != NULL && write_samples(sample_file) != 0) {
+            printf("Error: unable to write %s\n", sample_file);
+        }
+    }
+
+    //Report how often seated students gave up
+    printf("Students gave up waiting %d of %d times they sat down (%.1f%% abandonment)\n",
+           students_reneged, students_seated,
+           students_seated ? 100.0 * students_reneged / students_seated : 0.0);
 
-    //Destroy mutex and semaphore, and free memory
+    //Check the run against the same scenario in virtual time
+    if (truth_reps > 0) {
+        compare_ground_truth(truth_reps, elapsed);
+    }
+
+    //Destroy mutex and semaphores, and free memory
     pthread_mutex_destroy(&mutex);
     sem_destroy(&students_sem);
+    for (i = 0; i < num_students; i++) {
+        sem_destroy(&seats[i].called);
+        sem_destroy(&seats[i].helped);
+        sem_destroy(&seats[i].parked);
+        sem_destroy(&seats[i].alarm);
+    }
+    if (virtual_clock) {
+        sem_destroy(&ta_alarm);
+        vclock_stop();
+    }
     free(student_handles);
     free(student_ids);
+    free(seats);
+    if (event_driver) {
+        pthread_mutex_destroy(&inbox_lock);
+        close(inbox_fd);
+        free(inbox);
+        free(inbox_spare);
+        free(timers);
+    }
+    metrics_free();
 
     return 0;
 } //end main
@@ -117,14 +657,43 @@ int main() {
 * Outputs: NULL when the TA finishes and the thread exits
 ****************************************************************************/
 void* ta_thread(void* param) {
-    (void)param; // unused parameter
+    uint64_t* rng = (uint64_t*)param; //TA's own stream for help times
+    double help;
+    double start;
+    double ta_clock = run_start;        //end of the last session on the TA's schedule
+
     while (1) {
         //TA goes to "sleep" by waiting on the semaphore
         printf("TA: Waiting for a student (sleeping)...\n");
-        sem_wait(&students_sem);  // block until a student arrives or a final wake-up
+
+        //Before sleeping, seat any callback tickets that fit. A student who
+        //parks after this check sees ta_idle and wakes the TA instead.
+        atomic_store(&ta_idle, 1);
+        if (atomic_load(&callbacks.head) !=
+            atomic_load_explicit(&callbacks.tail, memory_order_acquire)) {
+            lock_office();
+            admit_parked(ta_clock);
+            publish_board();
+            pthread_mutex_unlock(&mutex);
+        }
+        metrics_add(0, MET_TA_SLEEPS, 1);
+        wait_on(&students_sem);  // block until a student arrives or a final wake-up
+        atomic_store(&ta_idle, 0);
+        metrics_add(0, MET_TA_WAKEUPS, 1);
 
         //Lock the mutex when checking/updating shared state
-        pthread_mutex_lock(&mutex);
+        lock_office();
+
+        //A student who parked while we slept may have woken us: seat the
+        //callback line now. That wake-up stands in for the one admit_parked
+        //gives the first seat, so take that one back
+        if (waiting_students == 0) {
+            admit_parked(ta_clock);
+            if (waiting_students > 0) {
+                publish_board();
+                take_back(&students_sem);
+            }
+        }
 
         //If all students are done and no one is waiting, TA can go home
         if (all_done && waiting_students == 0) {
@@ -135,26 +704,48 @@ void* ta_thread(void* param) {
 
         //Check if students are actually waiting
         if (waiting_students > 0) {
-            //"Help" a student by reducing the number of waiting students
+            //Call in the student at the front of the line
+            //The session starts on schedule: when the last one ended, or
+            //when this student sat down if the TA was idle
+            seat_t* seat = hall_head;
+            start = seat->seated_at > ta_clock ? seat->seated_at : ta_clock;
+            hall_remove(seat);
             waiting_students--;
-            printf("TA: Helping a student. Students still waiting = %d\n",
-                   waiting_students);
+            admit_parked(start);
+            help = draw_time(&help_time, rng);
+            help_ends_at = start + help;
+            ta_clock = help_ends_at;
+            seat->helped_until = help_ends_at; //the student moves their own clock
+            ta_helping = seat->id;
+            help_avg += 0.1 * (help - help_avg);
+            students_helped++;
+            publish_board();
+            metrics_add(0, MET_HELPED, 1);
+            printf("TA: Helping student %d. Students still waiting = %d\n",
+                   seat->id, waiting_students);
 
             //Unlock mutex before simulating help time
             pthread_mutex_unlock(&mutex);
+            notify_student(seat, NOTE_CALLED);
 
             //Simulate time taken to help a student (delay to make output readable)
-            sleep(5);
+            sleep_until(0, help_ends_at);
+            notify_student(seat, NOTE_HELPED);
         } else {
-            //No students are actually waiting (possible after final wake-up)
+            //No students are actually waiting (possible after final wake-up,
+            //or when the student who woke the TA already gave up)
             printf("TA: Woke up but no students are waiting.\n");
+            metrics_add(0, MET_TA_SPURIOUS, 1);
             pthread_mutex_unlock(&mutex);
 
             //Short delay just so output is readable; TA will loop and probably exit
-            sleep(1);
+            sleep_until(0, now_sec() + time_scale);
         }
     } //end while
 
+    if (virtual_clock) {
+        vclock_exit(); //one thread fewer to wait for
+    }
     pthread_exit(NULL);
     return NULL; //not reached, but keeps compiler happy
 } //end thread function
@@ -169,50 +760,1039 @@ void* ta_thread(void* param) {
 void* student_thread(void* num) {
     //typcast param to integer id
     int id = *((int*)num);
+    seat_t* seat = &seats[id - 1];
     int i;
+    int attempt;
+    double prev;
+    double delay;
+    double sat_down;
 
-    for (i = 0; i < HELP_REQUESTS_PER_STUDENT; i++) {
+    //A visit that ends with the student giving up does not count: they
+    //still need that help, as in office_model.c
+    for (i = 0; i < HELP_REQUESTS_PER_STUDENT; ) {
         //Simulate time spent programming
-        int program_time = (rand() % 5) + 1; //between 1 and 5 seconds
-        printf("Student %d: Programming for %d seconds.\n", id, program_time);
-        sleep(program_time);
+        double programming = draw_time(&program_time, &seat->rng);
+        printf("Student %d: Programming for %g %s.\n", id, programming / time_scale, time_unit);
+        seat->clock += programming;
+        sleep_until(id, seat->clock);
 
-        //Try to get help from the TA by locking mutex
-        pthread_mutex_lock(&mutex);
+        //Keep coming back until this visit gets a chair
+        prev = retry_base;
+        for (attempt = 0; ; attempt++) {
+            int visit = try_visit(seat, attempt, &prev, &delay);
 
-        //If number of waiting students is less than the number of chairs
-        if (waiting_students < num_chairs) {
-            waiting_students++;
-            printf("Student %d: Sitting in hallway. Students waiting = %d\n",
-                   id, waiting_students);
+            if (visit == VISIT_RETRY) {
+                //Delay to simulate walking away/coming back later
+                seat->clock += delay;
+                sleep_until(id, seat->clock);
+                continue;
+            }
+            if (visit == VISIT_PARKED) {
+                //Whoever frees a chair seats us, so no more tries are needed
+                wait_on(&seat->parked);
+                metrics_add(id, MET_SEATED, 1);
+            }
+            break;
+        } //end for (each try)
 
-            //Unlock mutex before notifying TA
-            pthread_mutex_unlock(&mutex);
+        //Seated: wait to be called in, but only as long as patience lasts
+        sat_down = now_sec();
+        if (wait_for_call(seat)) {
+            metrics_observe(id, MET_HIST_WAIT, now_sec() - sat_down);
+            wait_on(&seat->helped);
+            seat->clock = seat->helped_until;
+            printf("Student %d: Got help from the TA.\n", id);
+            i++;
+        }
+    } //end for (each help request)
 
-            //Notify TA through semaphore (student has arrived / is waiting)
-            sem_post(&students_sem);
+    finish_student(id);
+    if (virtual_clock) {
+        vclock_exit(); //one thread fewer to wait for
+    }
+    pthread_exit(NULL);
+    return NULL; //not reached, but keeps compiler happy
+} //end thread function
 
-            //Simulate waiting time
-            sleep(1);
-        } else {
-            printf("Student %d: Hallway full. Will try again later.\n", id);
-            pthread_mutex_unlock(&mutex);
+/*************************************
+* Function: try_visit
+* What it does: One trip to the office. The student checks the published
+*               estimate first (with -w), then takes the mutex and sits
+*               down if a chair is free. A turned-away student either takes
+*               a callback ticket (-b virtual) or is told how long to wait
+*               before the next try.
+* Inputs: seat -> this student's seat
+*         attempt -> tries already turned away for this visit (0 first)
+*         prev -> previous retry delay (decorrelated jitter state)
+*         delay -> where the wait before the next try goes (VISIT_RETRY)
+* Outputs: VISIT_SEATED, VISIT_PARKED (wait for the `parked` wake-up) or
+*          VISIT_RETRY
+*************************************/
+int try_visit(seat_t* seat, int attempt, double* prev, double* delay) {
+    int id = seat->id;
+    double advised;
 
-            //Delay to make output readable and simulate walking away/coming back later
-            sleep(1);
+    //Check the published estimate first; if the wait looks too long,
+    //skip the walk and try again later as the retry policy says
+    if (balk_wait > 0.0) {
+        double estimate = expected_wait();
+        if (estimate > balk_wait) {
+            metrics_add(id, MET_BALKED, 1);
+            *delay = retry_delay(attempt, prev, estimate - balk_wait, &seat->rng);
+            printf("Student %d: Line looks like %.3g %s. Will check again in %.3g %s.\n",
+                   id, estimate / time_scale, time_unit, *delay / time_scale, time_unit);
+            return VISIT_RETRY;
         }
-    } //end for (each help request)
+    }
 
-    //Mark this student as finished
-    pthread_mutex_lock(&mutex);
+    //Try to get help from the TA by locking mutex
+    lock_office();
+    metrics_add(id, MET_ARRIVALS, 1);
+
+    //If number of waiting students is less than the number of chairs
+    if (waiting_students < num_chairs) {
+        hall_push(seat);
+        seat->seated_at = seat->clock;
+        waiting_students++;
+        students_seated++;
+        publish_board();
+        metrics_add(id, MET_SEATED, 1);
+        printf("Student %d: Sitting in hallway. Students waiting = %d\n",
+               id, waiting_students);
+
+        //Unlock mutex before notifying TA
+        pthread_mutex_unlock(&mutex);
+
+        //Notify TA through semaphore (student has arrived / is waiting)
+        wake_up(&students_sem);
+        return VISIT_SEATED;
+    }
+
+    students_rejected++;
+    metrics_add(id, MET_REJECTED, 1);
+    if (retry_policy == RETRY_VIRTUAL) {
+        students_parked++;
+        publish_board();
+        printf("Student %d: Hallway full. Waiting for a callback.\n", id);
+        pthread_mutex_unlock(&mutex);
+        metrics_add(id, MET_PARKED, 1);
+        park(seat);
+        return VISIT_PARKED;
+    }
+
+    publish_board();
+
+    //The office's advice is the next free chair not yet promised
+    //to someone else, so advised retries do not arrive together
+    advised = help_ends_at > advised_until ? help_ends_at : advised_until;
+    advised_until = advised + help_avg / (num_chairs > 0 ? num_chairs : 1);
+    *delay = retry_delay(attempt, prev, advised - seat->clock, &seat->rng);
+    printf("Student %d: Hallway full. Will try again in %.3g %s.\n",
+           id, *delay / time_scale, time_unit);
+    pthread_mutex_unlock(&mutex);
+    return VISIT_RETRY;
+} //end try_visit
+
+/*************************************
+* Function: finish_student
+* What it does: Marks a student done for the day.
+* Inputs: id -> the student's ID
+*************************************/
+void finish_student(int id) {
+    double lag = now_sec() - seats[id - 1].clock;
+
+    lock_office();
     students_finished++;
+    schedule_lag_sum += lag;
+    if (lag > schedule_lag_max) {
+        schedule_lag_max = lag;
+    }
     printf("Student %d: Done for the day. Finished count = %d\n",
            id, students_finished);
     if (students_finished == num_students) {
         all_done = 1;
     }
+    publish_board();
+    metrics_add(id, MET_FINISHED, 1);
     pthread_mutex_unlock(&mutex);
+} //end finish_student
 
-    pthread_exit(NULL);
-    return NULL; //not reached, but keeps compiler happy
-} //end thread function
\ No newline at end of file
+/*************************************
+* Function: driver_thread
+* What it does: Runs every student (-e). Sleeps in epoll until the
+*               earliest student timer is due or a note arrives, and
+*               moves the students concerned on to their next step,
+*               until every student is done for the day.
+* Outputs: NULL when all students have finished
+*************************************/
+void* driver_thread(void* param) {
+    struct epoll_event events[2];
+    struct epoll_event ev;
+    struct itimerspec when;
+    double armed_for = -1.0;            //deadline the timerfd is set to
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    int done = 0;
+    int n;
+    int i;
+
+    (void)param; // unused parameter
+    if (epoll_fd < 0 || timer_fd < 0) {
+        printf("Error: unable to start the event loop.\n");
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    ev.data.fd = inbox_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inbox_fd, &ev);
+
+    for (i = 0; i < num_students; i++) {
+        start_programming(&seats[i]);
+    }
+
+    while (done < num_students) {
+        //Set the timer for the earliest wake-up, if it moved
+        if (num_timers > 0 && timers[0].time != armed_for) {
+            armed_for = timers[0].time;
+            memset(&when, 0, sizeof(when));
+            when.it_value.tv_sec = (time_t)armed_for;
+            when.it_value.tv_nsec = (long)((armed_for - (double)when.it_value.tv_sec) * 1e9);
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+        }
+
+        n = epoll_wait(epoll_fd, events, 2, -1);
+        for (i = 0; i < n; i++) {
+            uint64_t count;
+
+            if (read(events[i].data.fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                continue;
+            }
+            if (events[i].data.fd == timer_fd) {
+                double now = now_sec();
+                armed_for = -1.0;
+                while (num_timers > 0 && timers[0].time <= now) {
+                    student_timer_t timer = timer_pop();
+                    seat_t* seat = &seats[timer.id - 1];
+                    if (timer.gen == seat->timer_gen) {
+                        if (!timer.overdue) {
+                            metrics_observe(seat->id, MET_HIST_OVERSHOOT, now - timer.time);
+                        }
+                        done += student_timer_due(seat, timer.time);
+                    }
+                }
+            } else {
+                student_note_t* taken;
+                int notes;
+                int k;
+
+                //Take the whole inbox at once, then handle it unlocked
+                pthread_mutex_lock(&inbox_lock);
+                taken = inbox;
+                inbox = inbox_spare;
+                inbox_spare = taken;
+                notes = inbox_count;
+                inbox_count = 0;
+                pthread_mutex_unlock(&inbox_lock);
+                for (k = 0; k < notes; k++) {
+                    done += student_note(&seats[taken[k].id - 1], taken[k].note);
+                }
+            }
+        } //end for (each ready fd)
+    } //end while
+
+    close(timer_fd);
+    close(epoll_fd);
+    return NULL;
+} //end driver_thread
+
+/*************************************
+* Function: start_programming / go_to_office / sit_down
+* What it does: The steps of a student's day under the event driver,
+*               doing what student_thread does between two waits and then
+*               setting a timer (or waiting for a note) in place of the
+*               wait.
+*               start_programming: draw the programming time, wake up
+*                                  after it
+*               go_to_office: one try_visit; come back later, wait for a
+*                             callback, or sit down
+*               sit_down: wait for the TA's call, with a timer for the
+*                         student's patience if it is limited
+* Inputs: seat -> the student's seat
+*************************************/
+void start_programming(seat_t* seat) {
+    double programming = draw_time(&program_time, &seat->rng);
+
+    printf("Student %d: Programming for %g %s.\n", seat->id, programming / time_scale, time_unit);
+    seat->phase = PHASE_PROGRAMMING;
+    seat->attempt = 0;
+    seat->prev_delay = retry_base;
+    seat->clock += programming;
+    timer_push(seat, seat->clock);
+} //end start_programming
+
+void go_to_office(seat_t* seat) {
+    double delay;
+    int visit = try_visit(seat, seat->attempt, &seat->prev_delay, &delay);
+
+    if (visit == VISIT_RETRY) {
+        seat->attempt++;
+        seat->phase = PHASE_RETRYING;
+        seat->clock += delay;
+        timer_push(seat, seat->clock);
+    } else if (visit == VISIT_PARKED) {
+        seat->phase = PHASE_PARKED;
+    } else {
+        sit_down(seat);
+    }
+} //end go_to_office
+
+void sit_down(seat_t* seat) {
+    seat->phase = PHASE_SEATED;
+    seat->sat_down = now_sec();
+    if (patience.kind != DIST_NEVER) {
+        timer_push(seat, seat->seated_at + draw_time(&patience, &seat->rng));
+    }
+} //end sit_down
+
+/*************************************
+* Function: end_visit
+* What it does: A visit is over (helped, or gave up waiting): go back to
+*               programming, or finish after the last help. A student who
+*               gave up still needs that help.
+* Inputs: seat -> the student's seat
+*         helped -> 1 if the TA helped them on this visit
+* Outputs: 1 if the student is now done for the day, else 0
+*************************************/
+int end_visit(seat_t* seat, int helped) {
+    seat->visit += helped;
+    if (seat->visit < HELP_REQUESTS_PER_STUDENT) {
+        start_programming(seat);
+        return 0;
+    }
+    seat->phase = PHASE_DONE;
+    finish_student(seat->id);
+    return 1;
+} //end end_visit
+
+/*************************************
+* Function: student_timer_due / student_note
+* What it does: What a student does when their timer goes off, or when
+*               a note for them arrives.
+* Inputs: seat -> the student's seat
+*         when -> the time the timer was set for
+*         note -> NOTE_CALLED, NOTE_HELPED or NOTE_PARKED
+* Outputs: 1 if the student is now done for the day, else 0
+*************************************/
+int student_timer_due(seat_t* seat, double when) {
+    switch (seat->phase) {
+    case PHASE_PROGRAMMING:
+    case PHASE_RETRYING:
+        go_to_office(seat);
+        return 0;
+    case PHASE_SEATED:
+        //Patience ran out; if the TA called at the same moment, the
+        //NOTE_CALLED is on its way and the student just keeps waiting
+        return leave_line(seat, when) ? end_visit(seat, 0) : 0;
+    default:
+        return 0;
+    }
+} //end student_timer_due
+
+int student_note(seat_t* seat, int note) {
+    switch (note) {
+    case NOTE_CALLED:
+        seat->timer_gen++; //no more patience timer
+        seat->phase = PHASE_WITH_TA;
+        metrics_observe(seat->id, MET_HIST_WAIT, now_sec() - seat->sat_down);
+        return 0;
+    case NOTE_HELPED:
+        seat->clock = seat->helped_until;
+        printf("Student %d: Got help from the TA.\n", seat->id);
+        return end_visit(seat, 1);
+    default: //NOTE_PARKED: someone seated us from the callback line
+        metrics_add(seat->id, MET_SEATED, 1);
+        sit_down(seat);
+        return 0;
+    }
+} //end student_note
+
+/*************************************
+* Function: timer_push / timer_pop
+* What it does: The driver's min-heap of student wake-ups. Each push
+*               replaces the student's pending timer: older entries stay
+*               in the heap but no longer match the seat's timer_gen.
+* Inputs: seat -> the student to wake
+*         time -> when, in now_sec() seconds
+* Outputs: timer_pop returns the earliest entry
+*************************************/
+void timer_push(seat_t* seat, double time) {
+    int k;
+
+    if (num_timers == timers_cap) {
+        int cap = timers_cap > 0 ? timers_cap * 2 : 2 * num_students;
+        student_timer_t* bigger = (student_timer_t*)realloc(timers, sizeof(student_timer_t) * cap);
+        if (bigger == NULL) {
+            printf("Error: out of memory for student timers.\n");
+            exit(1);
+        }
+        timers = bigger;
+        timers_cap = cap;
+    }
+
+    seat->timer_gen++;
+    k = num_timers++;
+    timers[k].time = time;
+    timers[k].id = seat->id;
+    timers[k].gen = seat->timer_gen;
+    timers[k].overdue = time <= now_sec();
+    while (k > 0 && timers[(k - 1) / 2].time > timers[k].time) {
+        student_timer_t swap = timers[k];
+        timers[k] = timers[(k - 1) / 2];
+        timers[(k - 1) / 2] = swap;
+        k = (k - 1) / 2;
+    }
+} //end timer_push
+
+student_timer_t timer_pop(void) {
+    student_timer_t top = timers[0];
+    int k = 0;
+
+    timers[0] = timers[--num_timers];
+    while (1) {
+        int child = 2 * k + 1;
+        int least = k;
+        student_timer_t swap;
+
+        if (child < num_timers && timers[child].time < timers[least].time) {
+            least = child;
+        }
+        if (child + 1 < num_timers && timers[child + 1].time < timers[least].time) {
+            least = child + 1;
+        }
+        if (least == k) {
+            break;
+        }
+        swap = timers[k];
+        timers[k] = timers[least];
+        timers[least] = swap;
+        k = least;
+    } //end while
+    return top;
+} //end timer_pop
+
+/*************************************
+* Function: hall_push / hall_remove
+* What it does: Adds a seat to the back of the hallway line, or takes it
+*               out from wherever it is. Caller must hold the mutex.
+*************************************/
+void hall_push(seat_t* seat) {
+    seat->seated = 1;
+    seat->next = NULL;
+    seat->prev = hall_tail;
+    if (hall_tail != NULL) {
+        hall_tail->next = seat;
+    } else {
+        hall_head = seat;
+    }
+    hall_tail = seat;
+} //end hall_push
+
+void hall_remove(seat_t* seat) {
+    if (seat->prev != NULL) {
+        seat->prev->next = seat->next;
+    } else {
+        hall_head = seat->next;
+    }
+    if (seat->next != NULL) {
+        seat->next->prev = seat->prev;
+    } else {
+        hall_tail = seat->prev;
+    }
+    seat->prev = seat->next = NULL;
+    seat->seated = 0;
+} //end hall_remove
+
+/*************************************
+* Function: wait_for_call
+* What it does: Waits in the hallway until the TA calls this student in.
+*               With limited patience the wait is a sem_timedwait; if it
+*               times out while the student is still in line, the student
+*               leaves the line and goes back to programming.
+* Inputs: seat -> this student's seat (already in the line)
+* Outputs: 1 if the TA called the student in, 0 if they gave up
+*************************************/
+int wait_for_call(seat_t* seat) {
+    struct timespec deadline;
+    double gives_up;
+    double left;
+    long alarm;
+
+    if (patience.kind == DIST_NEVER) {
+        wait_on(&seat->called);
+        return 1;
+    }
+
+    //On the virtual clock, running out of patience is an alarm that posts
+    //`called` itself. If the alarm is still there to take back, the post
+    //was the TA's.
+    if (virtual_clock) {
+        gives_up = seat->seated_at + draw_time(&patience, &seat->rng);
+        alarm = vclock_alarm(seat->id, gives_up, &seat->called);
+        wait_on(&seat->called);
+        if (alarm < 0 || vclock_cancel(alarm)) {
+            return 1;
+        }
+
+        //Out of patience: leave, unless the TA called us in at the same moment
+        if (leave_line(seat, gives_up)) {
+            return 0;
+        }
+        wait_on(&seat->called); //the TA's post is on its way
+        return 1;
+    }
+
+    //Patience runs out on the student's own schedule. sem_timedwait takes
+    //a CLOCK_REALTIME deadline, so move the monotonic one over to it
+    gives_up = seat->seated_at + draw_time(&patience, &seat->rng);
+    left = gives_up - now_sec();
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (left > 0.0) {
+        deadline.tv_sec += (time_t)left;
+        deadline.tv_nsec += (long)((left - (time_t)left) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    while (sem_timedwait(&seat->called, &deadline) != 0) {
+        if (errno == EINTR) {
+            continue;
+        }
+
+        //Timed out: leave, unless the TA called us in at the same moment
+        if (left > 0.0) {
+            metrics_observe(seat->id, MET_HIST_OVERSHOOT, now_sec() - gives_up);
+        }
+        if (leave_line(seat, gives_up)) {
+            return 0;
+        }
+        sem_wait(&seat->called); //the TA's post is on its way
+        return 1;
+    } //end while
+
+    return 1;
+} //end wait_for_call
+
+/*************************************
+* Function: leave_line
+* What it does: A seated student whose patience ran out leaves the line,
+*               unless the TA called them in at the same moment.
+* Inputs: seat -> this student's seat
+*         when -> when their patience ran out, on their schedule
+* Outputs: 1 if the student left, 0 if the TA's call is on its way
+*************************************/
+int leave_line(seat_t* seat, double when) {
+    lock_office();
+    if (!seat->seated) {
+        pthread_mutex_unlock(&mutex);
+        return 0;
+    }
+    hall_remove(seat);
+    seat->clock = when;
+    waiting_students--;
+    students_reneged++;
+    reneged_wait_sum += when - seat->seated_at;
+    metrics_add(seat->id, MET_RENEGED, 1);
+    admit_parked(when);
+    publish_board();
+    printf("Student %d: Tired of waiting, going back to programming. "
+           "Students waiting = %d\n", seat->id, waiting_students);
+    pthread_mutex_unlock(&mutex);
+
+    //Take back the wake-up this student gave the TA, if still unused,
+    //so the TA does not wake up to an empty hallway
+    take_back(&students_sem);
+    return 1;
+} //end leave_line
+
+/*************************************
+* Function: retry_delay
+* What it does: Picks how long a turned-away student waits before trying
+*               the office door again.
+*               fixed:   retry_base every time
+*               exp:     random in [0, min(cap, base * 2^attempt)]
+*               decorr:  random in [base, 3 * previous delay], capped
+*               advised: the wait the office handed out (at least 0)
+* Inputs: attempt -> tries already turned away for this visit (0 first)
+*         prev -> previous delay (decorrelated jitter state)
+*         advised -> seconds until the office expects a free chair
+*         rng -> student's random stream
+* Outputs: delay in seconds
+*************************************/
+double retry_delay(int attempt, double* prev, double advised, uint64_t* rng) {
+    double ceiling;
+
+    switch (retry_policy) {
+    case RETRY_EXP:
+        ceiling = retry_base * (double)(1L << (attempt < 30 ? attempt : 30));
+        return rng_uniform(rng) * (ceiling < retry_cap ? ceiling : retry_cap);
+    case RETRY_DECORR:
+        *prev = retry_base + rng_uniform(rng) * (3.0 * *prev - retry_base);
+        if (*prev > retry_cap) {
+            *prev = retry_cap;
+        }
+        return *prev;
+    case RETRY_ADVISED:
+        return advised > 0.0 ? advised : 0.0;
+    default:
+        return retry_base;
+    }
+} //end retry_delay
+
+//One draw from a scenario distribution, in real seconds
+double draw_time(const dist_t* dist, uint64_t* rng) {
+    return dist_draw(dist, rng) * time_scale;
+}
+
+/*************************************
+* Function: lock_office
+* What it does: Takes the mutex and counts it, so runs can compare how
+*               much lock traffic each retry policy causes.
+*************************************/
+void lock_office(void) {
+    pthread_mutex_lock(&mutex);
+    lock_acquisitions++;
+} //end lock_office
+
+/*************************************
+* Function: now_sec / wall_sec / sleep_until
+* What it does: Reads the clock in seconds (the virtual one with -V; the
+*               monotonic one, which wall_sec always reads, otherwise),
+*               and sleeps until an absolute time on it (restarting after
+*               signals). Every wait is a deadline on the sleeper's own
+*               schedule, not a length counted from whenever it woke up
+*               last, so oversleeping once does not push back everything
+*               after it. If it really slept, how late it woke up goes
+*               into the overshoot histogram of `shard` (none if
+*               shard < 0). On the virtual clock the sleep is an alarm
+*               keyed by `shard` (0 for the TA, else a student's id) and
+*               is never late.
+*************************************/
+double now_sec(void) {
+    if (virtual_clock) {
+        return vclock_now();
+    }
+    return wall_sec();
+} //end now_sec
+
+double wall_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+} //end wall_sec
+
+void sleep_until(int shard, double deadline) {
+    struct timespec until;
+    double now = now_sec();
+
+    if (deadline > now && virtual_clock) {
+        sem_t* alarm = shard == 0 ? &ta_alarm : &seats[shard - 1].alarm;
+        if (vclock_alarm(shard, deadline, alarm) >= 0) {
+            wait_on(alarm);
+        }
+    } else if (deadline > now) {
+        until.tv_sec = (time_t)deadline;
+        until.tv_nsec = (long)((deadline - (double)until.tv_sec) * 1e9);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+            //interrupted: same deadline again
+        }
+        if (shard >= 0) {
+            metrics_observe(shard, MET_HIST_OVERSHOOT, now_sec() - deadline);
+        }
+    }
+} //end sleep_until
+
+/*************************************
+* Function: wake_up / wait_on / take_back
+* What it does: Post a semaphore that lets a waiting thread through, wait
+*               on one, and take back a post nobody has waited for yet.
+*               On the virtual clock they also tell the clock, which keeps
+*               count of who can still run.
+* Inputs: sem -> the semaphore
+*************************************/
+void wake_up(sem_t* sem) {
+    if (virtual_clock) {
+        vclock_post(sem);
+    }
+    sem_post(sem);
+} //end wake_up
+
+void wait_on(sem_t* sem) {
+    if (virtual_clock) {
+        vclock_wait(sem);
+    }
+    while (sem_wait(sem) != 0 && errno == EINTR) {
+        //interrupted: wait again
+    }
+} //end wait_on
+
+void take_back(sem_t* sem) {
+    if (!virtual_clock) {
+        sem_trywait(sem);
+        return;
+    }
+    if (vclock_trywait(sem)) {
+        while (sem_wait(sem) != 0 && errno == EINTR) {
+            //interrupted: wait again
+        }
+    }
+} //end take_back
+
+//Threads in this process right now (Linux)
+int count_threads(void) {
+    FILE* in = fopen("/proc/self/status", "r");
+    char line[256];
+    int threads = -1;
+
+    if (in == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (sscanf(line, "Threads: %d", &threads) == 1) {
+            break;
+        }
+    }
+    fclose(in);
+    return threads;
+} //end count_threads
+
+/*************************************
+* Function: compare_ground_truth
+* What it does: Runs the same scenario reps times in virtual time
+*               (office_model.c: no threads, no sleeping) and prints how
+*               far this run's queue statistics are from the model's, in
+*               scenario time. The model follows TA_Sim's rules for
+*               -b fixed and no -w, with or without patience; for
+*               anything else it prints why there is nothing to compare
+*               with. Waits count every student who sat down, including
+*               those who gave up.
+* Inputs: reps -> virtual-time runs to average over
+*         elapsed -> real seconds this run took
+*************************************/
+void compare_ground_truth(int reps, double elapsed) {
+    const char* names[4] = { "Time to finish", "Mean hallway wait", "Visits turned away",
+                             "Sat down, gave up" };
+    office_params_t params;
+    office_t office;
+    double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+    double squares[4] = { 0.0, 0.0, 0.0, 0.0 };
+    double run[4];
+    long waits = metrics_count(MET_HIST_WAIT);
+    int r;
+    int i;
+
+    if (retry_policy != RETRY_FIXED || balk_wait > 0.0) {
+        printf("Ground truth: the virtual-time model only covers -b fixed and no -w\n");
+        return;
+    }
+    office_default_params(&params);
+    params.num_chairs = num_chairs;
+    params.help_requests = HELP_REQUESTS_PER_STUDENT;
+    params.program_time = program_time;
+    params.help_time = help_time;
+    params.patience = patience;
+    params.retry_time = retry_base / time_scale;
+
+    for (r = 0; r < reps; r++) {
+        double model[4];
+
+        if (office_init(&office, 0, 1, &params) != 0 ||
+            office_reserve(&office, num_students + 1) != 0) {
+            printf("Error: unable to allocate the virtual-time office.\n");
+            return;
+        }
+        for (i = 0; i < num_students; i++) {
+            office_add_student(&office, office_new_student(i + 1, (uint64_t)r + 1, &params));
+        }
+        office_run(&office, INFINITY);
+        model[0] = office.now;
+        model[1] = office.stats.seated ? office.stats.wait_sum / office.stats.seated : 0.0;
+        model[2] = office.stats.arrivals ? (double)office.stats.rejected / office.stats.arrivals : 0.0;
+        model[3] = office.stats.seated ? (double)office.stats.reneged / office.stats.seated : 0.0;
+        office_free(&office);
+        for (i = 0; i < 4; i++) {
+            sum[i] += model[i];
+            squares[i] += model[i] * model[i];
+        }
+    } //end for
+
+    run[0] = elapsed / time_scale;
+    run[1] = waits + students_reneged ?
+             (metrics_sum(MET_HIST_WAIT) + reneged_wait_sum) / (waits + students_reneged) /
+             time_scale : 0.0;
+    run[2] = students_seated + students_rejected ?
+             (double)students_rejected / (students_seated + students_rejected) : 0.0;
+    run[3] = students_seated ? (double)students_reneged / students_seated : 0.0;
+
+    //How far off, relative to the model's mean and in model standard deviations
+    printf("Ground truth (%d virtual-time runs) vs this run, times in %s:\n", reps, time_unit);
+    for (i = 0; i < 4; i++) {
+        double mean = sum[i] / reps;
+        double sd = sqrt(fmax(squares[i] / reps - mean * mean, 0.0));
+        double scale = i >= 2 ? 100.0 : 1.0; //shares as percentages
+
+        printf("  %-18s model %.4g +- %.2g, this run %.4g (%+.1f%%, %+.1f sd)\n", names[i],
+               scale * mean, scale * sd, scale * run[i],
+               mean > 0.0 ? 100.0 * (run[i] - mean) / mean : 0.0,
+               sd > 0.0 ? (run[i] - mean) / sd : 0.0);
+    }
+} //end compare_ground_truth
+
+/*************************************
+* Function: park_push / park_pop
+* What it does: Lock-free callback line. Any number of students may push
+*               at once (one atomic exchange each); pops happen under the
+*               mutex, so there is only ever one popper.
+* Outputs: park_pop returns the oldest parked seat, or NULL if there is
+*          none (or one is only halfway through being pushed)
+*************************************/
+void park_push(ticket_line_t* line, ticket_t* ticket) {
+    ticket_t* prev;
+
+    atomic_store_explicit(&ticket->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange(&line->head, ticket);
+    atomic_store_explicit(&prev->next, ticket, memory_order_release);
+} //end park_push
+
+seat_t* park_pop(ticket_line_t* line) {
+    ticket_t* tail = atomic_load_explicit(&line->tail, memory_order_relaxed);
+    ticket_t* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &line->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        atomic_store_explicit(&line->tail, next, memory_order_release);
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next == NULL) {
+        if (tail != atomic_load(&line->head)) {
+            return NULL;
+        }
+        park_push(line, &line->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (next == NULL) {
+            return NULL;
+        }
+    }
+    atomic_store_explicit(&line->tail, next, memory_order_release);
+    return (seat_t*)tail; //ticket is the first member of seat_t
+} //end park_pop
+
+/*************************************
+* Function: park
+* What it does: Takes a callback ticket; someone who frees a chair will
+*               seat this student and wake them (NOTE_PARKED). If the TA
+*               is idle, nobody may be about to free a chair, so the TA is
+*               woken to look. Only the first student to park while the TA
+*               sleeps wakes it; the TA seats the rest in the same pass.
+* Inputs: seat -> this student's seat
+*************************************/
+void park(seat_t* seat) {
+    park_push(&callbacks, &seat->ticket);
+    if (atomic_exchange(&ta_idle, 0)) {
+        wake_up(&students_sem);
+    }
+} //end park
+
+/*************************************
+* Function: notify_student
+* What it does: Wakes a student who is waiting to be called in, helped or
+*               called back: posts their semaphore, or with -e leaves a
+*               note in the event driver's inbox.
+* Inputs: seat -> the student's seat
+*         note -> NOTE_CALLED, NOTE_HELPED or NOTE_PARKED
+*************************************/
+void notify_student(seat_t* seat, int note) {
+    uint64_t one = 1;
+    int was_empty;
+
+    if (!event_driver) {
+        wake_up(note == NOTE_CALLED ? &seat->called :
+                note == NOTE_HELPED ? &seat->helped : &seat->parked);
+        return;
+    }
+    pthread_mutex_lock(&inbox_lock);
+    inbox[inbox_count].id = seat->id;
+    inbox[inbox_count].note = note;
+    was_empty = inbox_count++ == 0;
+    pthread_mutex_unlock(&inbox_lock);
+    if (was_empty && write(inbox_fd, &one, sizeof(one)) < 0) {
+        printf("Error: unable to wake the event driver.\n");
+    }
+} //end notify_student
+
+/*************************************
+* Function: admit_parked
+* What it does: Fills free chairs from the callback line, oldest ticket
+*               first, and wakes each seated student. Caller must hold
+*               the mutex.
+* Inputs: when -> when the chair came free, on the freer's schedule; a
+*                 student who parked later sits down when they parked
+*************************************/
+void admit_parked(double when) {
+    seat_t* seat;
+
+    while (waiting_students < num_chairs && (seat = park_pop(&callbacks)) != NULL) {
+        seat->seated_at = when > seat->clock ? when : seat->clock;
+        hall_push(seat);
+        waiting_students++;
+        students_seated++;
+        printf("Student %d: Called back to a free chair. Students waiting = %d\n",
+               seat->id, waiting_students);
+        wake_up(&students_sem);
+        notify_student(seat, NOTE_PARKED);
+    } //end while
+} //end admit_parked
+
+/*************************************
+* Function: publish_board / read_board
+* What it does: publish_board copies the shared counters to the board
+*               (caller holds the mutex, so there is one writer at a time).
+*               read_board takes a consistent copy without the mutex,
+*               retrying if a publish happened in between.
+* Inputs: view -> where read_board puts the copy
+*************************************/
+void publish_board(void) {
+    unsigned seq = atomic_load_explicit(&board.seq, memory_order_relaxed);
+
+    atomic_store_explicit(&board.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&board.waiting, waiting_students, memory_order_relaxed);
+    atomic_store_explicit(&board.seated, students_seated, memory_order_relaxed);
+    atomic_store_explicit(&board.rejected, students_rejected, memory_order_relaxed);
+    atomic_store_explicit(&board.reneged, students_reneged, memory_order_relaxed);
+    atomic_store_explicit(&board.parked, students_parked, memory_order_relaxed);
+    atomic_store_explicit(&board.helped, students_helped, memory_order_relaxed);
+    atomic_store_explicit(&board.finished, students_finished, memory_order_relaxed);
+    atomic_store_explicit(&board.ta_helping, ta_helping, memory_order_relaxed);
+    atomic_store_explicit(&board.help_avg, help_avg, memory_order_relaxed);
+    atomic_store_explicit(&board.help_ends_at, help_ends_at, memory_order_relaxed);
+    atomic_store_explicit(&board.seq, seq + 2, memory_order_release);
+} //end publish_board
+
+void read_board(office_view_t* view) {
+    unsigned seq;
+
+    do {
+        seq = atomic_load_explicit(&board.seq, memory_order_acquire);
+        view->waiting = atomic_load_explicit(&board.waiting, memory_order_relaxed);
+        view->seated = atomic_load_explicit(&board.seated, memory_order_relaxed);
+        view->rejected = atomic_load_explicit(&board.rejected, memory_order_relaxed);
+        view->reneged = atomic_load_explicit(&board.reneged, memory_order_relaxed);
+        view->parked = atomic_load_explicit(&board.parked, memory_order_relaxed);
+        view->helped = atomic_load_explicit(&board.helped, memory_order_relaxed);
+        view->finished = atomic_load_explicit(&board.finished, memory_order_relaxed);
+        view->ta_helping = atomic_load_explicit(&board.ta_helping, memory_order_relaxed);
+        view->help_avg = atomic_load_explicit(&board.help_avg, memory_order_relaxed);
+        view->help_ends_at = atomic_load_explicit(&board.help_ends_at, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) != 0 || seq != atomic_load_explicit(&board.seq, memory_order_relaxed));
+} //end read_board
+
+/*************************************
+* Function: expected_wait
+* What it does: Estimates from the board how long a student who sits down
+*               now would wait: the rest of the current session plus one
+*               average session per student ahead.
+* Outputs: the estimate in seconds
+*************************************/
+double expected_wait(void) {
+    office_view_t view;
+    double left;
+
+    read_board(&view);
+    left = view.help_ends_at - now_sec();
+    return (left > 0.0 ? left : 0.0) + view.waiting * view.help_avg;
+} //end expected_wait
+
+/*************************************
+* Function: sampler_thread
+* What it does: Records the line length every sample_interval seconds
+*               into the samples ring until main says stop. Deadlines are
+*               counted from the start, so sleep overshoot does not add up.
+* Outputs: NULL when stopped
+*************************************/
+void* sampler_thread(void* param) {
+    office_view_t view;
+    sample_t* sample;
+    double next = now_sec();
+
+    (void)param; // unused parameter
+    while (!atomic_load(&sampler_stop)) {
+        read_board(&view);
+        sample = &samples[samples_taken % SAMPLE_RING];
+        sample->time = now_sec() - run_start;
+        sample->waiting = view.waiting;
+        sample->helped = view.helped;
+        sample->ta_busy = view.help_ends_at > run_start + sample->time;
+        samples_taken++;
+        sample_wait_sum += view.waiting;
+        if (view.waiting > sample_wait_max) {
+            sample_wait_max = view.waiting;
+        }
+
+        next += sample_interval;
+        sleep_until(-1, next);
+    } //end while
+
+    return NULL;
+} //end sampler_thread
+
+/*************************************
+* Function: write_samples
+* What it does: Writes the samples still in the ring, oldest first, as CSV.
+* Inputs: path -> file to create
+* Outputs: 0 on success, 1 if the file cannot be written
+*************************************/
+int write_samples(const char* path) {
+    FILE* out = fopen(path, "w");
+    long first = samples_taken > SAMPLE_RING ? samples_taken - SAMPLE_RING : 0;
+    long i;
+
+    if (out == NULL) {
+        return 1;
+    }
+    fprintf(out, "time,waiting,helped,ta_busy\n");
+    for (i = first; i < samples_taken; i++) {
+        const sample_t* sample = &samples[i % SAMPLE_RING];
+        fprintf(out, "%.6f,%d,%d,%d\n", sample->time, sample->waiting,
+                sample->helped, sample->ta_busy);
+    }
+    return fclose(out) != 0;
+} //end write_samples
+
+/*************************************
+* Function: write_gauges
+* What it does: Adds the current line length and TA state, read from the
+*               board without the mutex, to a metrics scrape.
+* Inputs: out -> scrape being written
+*************************************/
+void write_gauges(FILE* out) {
+    office_view_t view;
+
+    read_board(&view);
+    fprintf(out, "# HELP tasim_queue_depth Students waiting in the hallway.\n"
+                 "# TYPE tasim_queue_depth gauge\ntasim_queue_depth %d\n", view.waiting);
+    fprintf(out, "# HELP tasim_chairs Chairs in the hallway.\n"
+                 "# TYPE tasim_chairs gauge\ntasim_chairs %d\n", num_chairs);
+    fprintf(out, "# HELP tasim_ta_busy 1 while the TA is helping a student.\n"
+                 "# TYPE tasim_ta_busy gauge\ntasim_ta_busy %d\n",
+            view.help_ends_at > now_sec());
+    fprintf(out, "# HELP tasim_help_seconds_avg Running average help session length.\n"
+                 "# TYPE tasim_help_seconds_avg gauge\ntasim_help_seconds_avg %.9g\n",
+            view.help_avg);
+} //end write_gauges
@@ -0,0 +1,809 @@
+//TA_Virtual.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "office_model.h"
+#include "ta_trace.h"
+#include "tasim.h"
+
+/****************************************************************************
+* One TA office in virtual time
+* Runs the office_model.c version of TA_Sim.c to completion, as fast as
+* the CPU allows. The whole state of the run lives in one office_t, so it
+* can be written to a snapshot file and resumed later with identical
+* results.
+*
+* Checkpoints are taken with fork(): the child process gets a copy-on-write
+* view of the office at that instant and writes it out while the parent
+* keeps simulating. The parent only pays for the fork itself.
+*
+* What-if branching: the run goes as far as the branch time once, then
+* hands one copy of the office per variant (more chairs, more TAs, a
+* different help time) to libtasim (tasim.c). Each copy changes its
+* settings and runs on in parallel with the others on the library's
+* thread pool, and the results are compared at the end.
+****************************************************************************/
+
+/****************************************************************************
+* Global run settings
+****************************************************************************/
+int num_students = 5;                   //students in the office
+uint64_t run_seed = 521;                //seed for every student's stream
+double stop_at = -1.0;                  //pause (snapshot and exit) at this time
+double checkpoint_every = -1.0;         //take a checkpoint this often (virtual s)
+const char* snapshot_path = "TA_Virtual.snap";
+const char* resume_path = NULL;         //snapshot to resume from
+
+static pid_t writer = 0;                //checkpoint child still writing, if any
+
+#define MAX_VARIANTS 16
+
+double branch_at = -1.0;                //split into variants at this time
+const char* variant_specs[MAX_VARIANTS];
+int num_variants = 0;
+
+const char* trace_path = NULL;          //write a Chrome/Perfetto trace here
+int generic_loop = 0;                   //-G: handle every event through office_handle
+double validate_rate = -1.0;            //Poisson arrival rate for -Q (per second)
+double validate_precision = 0.01;       //stop when every CI is this tight (relative)
+
+//Turns the office's event stream into trace spans as events are scheduled
+typedef struct {
+    office_t* office;
+    trace_t trace;
+    const event_t* current;             //event being handled
+    double* ta_free_since;              //when each TA slot last went idle
+} tracer_t;
+
+#define TRACE_STUDENTS 1                //trace "process" holding one track per student
+#define TRACE_TAS      2                //... and one per TA
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+static int write_snapshot(const office_t* office, const char* path);
+static void checkpoint(const office_t* office, int wait_for_it);
+static void print_stats(const office_t* office);
+static int parse_variant(const char* spec, office_params_t* params);
+static void run_branches(office_t* office);
+static double wall_clock(void);
+static int tracer_start(tracer_t* tracer, office_t* office, const char* path);
+static void tracer_send(void* ctx, int dest, const event_t* ev);
+static int tracer_finish(tracer_t* tracer);
+static int run_validation(office_params_t params);
+
+/****************************************************************************
+ * Main Function
+****************************************************************************/
+int main(int argc, char* argv[]) {
+    office_params_t params;
+    office_t office;
+    tracer_t tracer;
+    office_send_fn send = office_send_local;
+    void* send_ctx = &office;
+    double next_checkpoint;
+    double start;
+    double elapsed;
+    event_t ev;
+    int opt;
+    int i;
+
+    office_default_params(&params);
+
+    while ((opt = getopt(argc, argv, "s:c:t:r:P:H:A:S:u:k:o:l:b:V:T:Q:E:G")) != -1) {
+        switch (opt) {
+        case 's': num_students = atoi(optarg); break;
+        case 'c': params.num_chairs = atoi(optarg); break;
+        case 't': params.num_tas = atoi(optarg); break;
+        case 'r': params.help_requests = atoi(optarg); break;
+        case 'P':
+            if (dist_parse(&params.program_time, optarg) != 0) {
+                printf("Bad programming time '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'H':
+            if (dist_parse(&params.help_time, optarg) != 0) {
+                printf("Bad help time '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'A':
+            if (dist_parse(&params.patience, optarg) != 0) {
+                printf("Bad patience '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S': run_seed = strtoull(optarg, NULL, 10); break;
+        case 'u': stop_at = atof(optarg); break;
+        case 'k': checkpoint_every = atof(optarg); break;
+        case 'o': snapshot_path = optarg; break;
+        case 'l': resume_path = optarg; break;
+        case 'b': branch_at = atof(optarg); break;
+        case 'T': trace_path = optarg; break;
+        case 'Q': validate_rate = atof(optarg); break;
+        case 'E': validate_precision = atof(optarg); break;
+        case 'G': generic_loop = 1; break;
+        case 'V':
+            if (num_variants == MAX_VARIANTS) {
+                printf("At most %d variants.\n", MAX_VARIANTS);
+                return 1;
+            }
+            variant_specs[num_variants++] = optarg;
+            break;
+        default:
+            printf("Usage: %s [-s students] [-c chairs] [-t TAs] [-r help requests]\n"
+                   "          [-P program time] [-H help time] [-A patience] [-S seed]\n"
+                   "          [-u pause at time] [-k checkpoint every] [-o snapshot file]\n"
+                   "          [-l resume from snapshot]\n"
+                   "          [-b branch at time] [-V chairs=N,tas=N,help=TIME ...]\n"
+                   "          [-T trace.json] [-G: run-time dispatch for every event]\n"
+                   "          [-Q arrivals per second: check against M/M/c/K] [-E precision]\n"
+                   "Times look like const:5, uniform:1:5, exp:120 (seconds) or never.\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    if (validate_rate > 0.0) {
+        return run_validation(params);
+    }
+
+    if (resume_path != NULL) {
+        //Settings come from the snapshot, not the command line
+        FILE* in = fopen(resume_path, "rb");
+        if (in == NULL || office_load(&office, in) != 0) {
+            printf("Error: %s is not a readable snapshot.\n", resume_path);
+            if (in != NULL) {
+                fclose(in);
+            }
+            return 1;
+        }
+        fclose(in);
+        printf("Resumed from %s at t = %.3f s (%d events pending)\n",
+               resume_path, office.now, office.heap_len);
+    } else {
+        if (num_students <= 0 || params.num_chairs <= 0 || params.num_tas <= 0 ||
+            params.help_requests <= 0) {
+            printf("Invalid input. Exiting.\n");
+            return 1;
+        }
+        if (office_init(&office, 0, 1, &params) != 0 ||
+            office_reserve(&office, num_students + params.num_tas) != 0) {
+            printf("Error: unable to allocate the office.\n");
+            return 1;
+        }
+        for (i = 0; i < num_students; i++) {
+            office_add_student(&office, office_new_student(i + 1, run_seed, &params));
+        }
+    }
+
+    if (trace_path != NULL) {
+        if (tracer_start(&tracer, &office, trace_path) != 0) {
+            printf("Error: unable to write trace %s\n", trace_path);
+            office_free(&office);
+            return 1;
+        }
+        send = tracer_send;
+        send_ctx = &tracer;
+    }
+
+    next_checkpoint = checkpoint_every > 0.0 ? office.now + checkpoint_every : INFINITY;
+    start = wall_clock();
+
+    while (office.heap_len > 0) {
+        double next = office_next_time(&office);
+
+        if (branch_at >= 0.0 && next > branch_at) {
+            office.now = branch_at;
+            run_branches(&office);
+            if (writer > 0) {
+                waitpid(writer, NULL, 0);
+            }
+            office_free(&office);
+            return 0;
+        }
+        if (stop_at >= 0.0 && next > stop_at) {
+            //Pause: everything up to stop_at is done, save and leave
+            office.now = stop_at;
+            checkpoint(&office, 1);
+            printf("Paused at t = %.3f s; resume with -l %s\n", office.now, snapshot_path);
+            office_free(&office);
+            return 0;
+        }
+        if (next > next_checkpoint) {
+            checkpoint(&office, 0);
+            while (next_checkpoint < next) {
+                next_checkpoint += checkpoint_every;
+            }
+        }
+
+        if (trace_path == NULL && !generic_loop) {
+            //Specialized loop, up to the next pause, branch or checkpoint
+            double until = next_checkpoint;
+            if (branch_at >= 0.0 && branch_at < until) {
+                until = branch_at;
+            }
+            if (stop_at >= 0.0 && stop_at < until) {
+                until = stop_at;
+            }
+            office_run(&office, until);
+            continue;
+        }
+        office_pop(&office, &ev);
+        tracer.current = &ev;
+        office_handle(&office, &ev, NULL, send, send_ctx);
+    } //end while
+
+    elapsed = wall_clock() - start;
+    printf("Simulated %.1f s in %.3f s of wall time (%.1f million events/s)\n", office.now,
+           elapsed, elapsed > 0.0 ? office.stats.events / elapsed / 1e6 : 0.0);
+    print_stats(&office);
+    if (trace_path != NULL) {
+        long spans = tracer.trace.spans;
+        if (tracer_finish(&tracer) != 0) {
+            printf("Error: unable to write trace %s\n", trace_path);
+        } else {
+            printf("Wrote %ld spans to %s\n", spans, trace_path);
+        }
+    }
+
+    if (writer > 0) {
+        waitpid(writer, NULL, 0);
+    }
+    office_free(&office);
+    return 0;
+} //end main
+
+/****************************************************************************
+* Function: write_snapshot
+* What it does: Writes the office to path (through a temporary file, so an
+*               interrupted write never replaces a good snapshot).
+* Outputs: 0 on success, -1 on failure
+****************************************************************************/
+static int write_snapshot(const office_t* office, const char* path) {
+    char tmp_path[4096];
+    static char buffer[1 << 20];
+    FILE* out;
+    int status;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        return -1;
+    }
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+    status = office_save(office, out);
+    if (fclose(out) != 0 || status != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+    return rename(tmp_path, path) == 0 ? 0 : -1;
+} //end write_snapshot
+
+/****************************************************************************
+* Function: checkpoint
+* What it does: Forks a child that writes the snapshot from its frozen
+*               copy of memory while this process keeps going. Only one
+*               writer runs at a time; a new checkpoint waits for the last.
+* Inputs: office -> office to save
+*         wait_for_it -> 1 to wait until the file is written
+****************************************************************************/
+static void checkpoint(const office_t* office, int wait_for_it) {
+    double start;
+    pid_t pid;
+    int status = 0;
+
+    if (writer > 0) {
+        waitpid(writer, NULL, 0);
+        writer = 0;
+    }
+
+    fflush(stdout); //do not let the child repeat buffered output
+    start = wall_clock();
+    pid = fork();
+    if (pid == 0) {
+        _exit(write_snapshot(office, snapshot_path) == 0 ? 0 : 1);
+    }
+    if (pid < 0) {
+        //No fork available: write it ourselves
+        printf("Checkpoint at t = %.3f s: fork failed, writing in place\n", office->now);
+        if (write_snapshot(office, snapshot_path) != 0) {
+            printf("Error: unable to write %s\n", snapshot_path);
+        }
+        return;
+    }
+
+    printf("Checkpoint at t = %.3f s: simulation paused %.3f ms\n",
+           office->now, (wall_clock() - start) * 1000.0);
+    writer = pid;
+    if (wait_for_it) {
+        waitpid(writer, &status, 0);
+        writer = 0;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("Error: unable to write %s\n", snapshot_path);
+        }
+    }
+} //end checkpoint
+
+/****************************************************************************
+* Function: parse_variant
+* What it does: Applies a variant such as "chairs=4,tas=2,help=exp:4" on
+*               top of the current settings.
+* Outputs: 0 on success, -1 if the text is not understood
+****************************************************************************/
+static int parse_variant(const char* spec, office_params_t* params) {
+    char copy[256];
+    char* item;
+
+    snprintf(copy, sizeof(copy), "%s", spec);
+    for (item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+        if (strncmp(item, "chairs=", 7) == 0) {
+            params->num_chairs = atoi(item + 7);
+        } else if (strncmp(item, "tas=", 4) == 0) {
+            params->num_tas = atoi(item + 4);
+        } else if (strncmp(item, "help=", 5) == 0) {
+            if (dist_parse(&params->help_time, item + 5) != 0) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+    return params->num_chairs >= 1 && params->num_tas >= 1 ? 0 : -1;
+} //end parse_variant
+
+/****************************************************************************
+* Function: run_branches
+* What it does: Runs the unchanged baseline plus one copy per -V variant
+*               from the current office with tasim_run_batch. The run up to
+*               here is shared and never repeated; every variant starts
+*               from a copy of it. Prints how far each variant drifts from
+*               the baseline.
+****************************************************************************/
+static void run_branches(office_t* office) {
+    tasim_config_t configs[MAX_VARIANTS + 1];
+    tasim_result_t results[MAX_VARIANTS + 1];
+    const char* names[MAX_VARIANTS + 1];
+    tasim_pool_t* pool;
+    int total = 0;
+    double start = wall_clock();
+    int k;
+
+    printf("Branching at t = %.3f s: %d waiting, %d of %d TA(s) busy, %ld helped so far\n",
+           office->now, office->hall_len, office->busy, office->params.num_tas,
+           office->stats.helped);
+
+    for (k = 0; k <= num_variants; k++) {
+        tasim_config_t* c = &configs[total];
+
+        memset(c, 0, sizeof(*c));
+        c->params = office->params;
+        c->start = office;
+        c->until = INFINITY;
+        if (k > 0 && parse_variant(variant_specs[k - 1], &c->params) != 0) {
+            printf("Bad variant '%s'; skipped.\n", variant_specs[k - 1]);
+            continue;
+        }
+        names[total++] = k == 0 ? "baseline" : variant_specs[k - 1];
+    }
+
+    pool = tasim_pool_create((int)sysconf(_SC_NPROCESSORS_ONLN));
+    if (pool == NULL) {
+        printf("Error: unable to start the variants.\n");
+        return;
+    }
+    if (tasim_run_batch(pool, configs, results, total) != 0) {
+        printf("Error: some variants ran out of memory.\n");
+    }
+    tasim_pool_destroy(pool);
+
+    printf("%d variant(s) finished in %.3f s of wall time\n\n", total, wall_clock() - start);
+    printf("variant                 helped  full%%  gave up%%  wait(s)  line    done at(s)"
+           "  d.wait   d.done\n");
+    for (k = 0; k < total; k++) {
+        const tasim_result_t* r = &results[k];
+        const tasim_result_t* base = &results[0];
+        double wait;
+        double base_wait;
+        double span;
+
+        if (!r->ok) {
+            continue;
+        }
+        span = r->end_time - office->now;
+        wait = r->stats.seated ? r->stats.wait_sum / r->stats.seated : 0.0;
+        base_wait = base->stats.seated ? base->stats.wait_sum / base->stats.seated : 0.0;
+        printf("%-22s %7ld  %5.1f  %8.1f  %8.3f  %6.3f  %10.1f  %+7.3f  %+8.1f\n",
+               names[k], r->stats.helped,
+               r->stats.arrivals ? 100.0 * r->stats.rejected / r->stats.arrivals : 0.0,
+               r->stats.seated ? 100.0 * r->stats.reneged / r->stats.seated : 0.0,
+               wait, span > 0.0 ? r->line_area / span : 0.0, r->end_time,
+               base->ok ? wait - base_wait : 0.0,
+               base->ok ? r->end_time - base->end_time : 0.0);
+    }
+} //end run_branches
+
+/****************************************************************************
+* Function: print_stats
+* What it does: Prints the results of the run and a digest of them, so
+*               two runs can be compared at a glance.
+****************************************************************************/
+static void print_stats(const office_t* office) {
+    const office_stats_t* s = &office->stats;
+    const unsigned char* bytes = (const unsigned char*)s;
+    uint64_t digest = 1469598103934665603ULL; //FNV-1a
+    size_t i;
+
+    for (i = 0; i < sizeof(*s); i++) {
+        digest = (digest ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    printf("Help sessions: %ld, hallway full: %ld of %ld visits, TA slept %ld times\n",
+           s->helped, s->rejected, s->arrivals, s->ta_sleeps);
+    printf("Mean hallway wait: %.3f s (max %.3f s)\n",
+           s->seated ? s->wait_sum / s->seated : 0.0, s->wait_max);
+    printf("Gave up waiting: %ld of %ld seated visits (%.2f%% abandonment)\n",
+           s->reneged, s->seated, s->seated ? 100.0 * s->reneged / s->seated : 0.0);
+    printf("Run digest: %016llx\n", (unsigned long long)digest);
+} //end print_stats
+
+static double wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/****************************************************************************
+* Function: tracer_start
+* What it does: Opens the trace, names one track per student and per TA,
+*               and starts a programming span for every student already on
+*               their way to the office. Student ids come from the office
+*               itself (chairs, TA slots and pending events), so a run
+*               resumed from a snapshot names them all too.
+* Outputs: 0 on success, -1 on failure
+****************************************************************************/
+static int tracer_start(tracer_t* tracer, office_t* office, const char* path) {
+    char name[32];
+    int last_id = 0;                    //students are numbered 1..last_id
+    int i;
+
+    memset(tracer, 0, sizeof(*tracer));
+    tracer->office = office;
+    tracer->ta_free_since = (double*)malloc(sizeof(double) * (size_t)office->ta_slots);
+    if (tracer->ta_free_since == NULL || trace_open(&tracer->trace, path) != 0) {
+        free(tracer->ta_free_since);
+        return -1;
+    }
+
+    trace_name_process(&tracer->trace, TRACE_TAS, "TAs");
+    for (i = 0; i < office->ta_slots; i++) {
+        tracer->ta_free_since[i] = office->ta_busy[i] ? INFINITY : office->now;
+        snprintf(name, sizeof(name), "TA %d", i + 1);
+        trace_name_track(&tracer->trace, TRACE_TAS, i + 1, name);
+    }
+    trace_name_process(&tracer->trace, TRACE_STUDENTS, "Students");
+    for (i = 0; i < office->params.num_chairs; i++) {
+        if (office->chairs[i].used && office->chairs[i].student.id > last_id) {
+            last_id = office->chairs[i].student.id;
+        }
+    }
+    for (i = 0; i < office->ta_slots; i++) {
+        if (office->ta_busy[i] && office->helping[i].id > last_id) {
+            last_id = office->helping[i].id;
+        }
+    }
+    for (i = 0; i < office->heap_len; i++) {
+        if (office->heap[i].student.id > last_id) {
+            last_id = office->heap[i].student.id;
+        }
+    }
+    for (i = 1; i <= last_id; i++) {
+        snprintf(name, sizeof(name), "Student %d", i);
+        trace_name_track(&tracer->trace, TRACE_STUDENTS, i, name);
+    }
+    for (i = 0; i < office->heap_len; i++) {
+        const event_t* ev = &office->heap[i];
+        if (ev->type == EV_ARRIVE) {
+            trace_span(&tracer->trace, TRACE_STUDENTS, ev->student.id, "programming",
+                       office->now, ev->time);
+        }
+    }
+    return 0;
+} //end tracer_start
+
+/****************************************************************************
+* Function: tracer_send
+* What it does: Schedules an event like office_send_local, and writes the
+*               spans it implies. Every span is known in full the moment
+*               its end event is scheduled:
+*               - a visit scheduled after a help session or a give-up is
+*                 programming time (a give-up also ends a hallway wait),
+*                 and one scheduled after a full hallway is walking back;
+*               - a help session ends the student's hallway wait (if any)
+*                 and, for the TA, any time asleep since the last session.
+****************************************************************************/
+static void tracer_send(void* ctx, int dest, const event_t* ev) {
+    tracer_t* tracer = (tracer_t*)ctx;
+    const event_t* cur = tracer->current;
+    double now = tracer->office->now;
+    int id = ev->student.id;
+
+    office_send_local(tracer->office, dest, ev);
+
+    if (ev->type == EV_ARRIVE) {
+        if (cur != NULL && cur->type == EV_ARRIVE) {
+            trace_span(&tracer->trace, TRACE_STUDENTS, id, "hallway full", now, ev->time);
+        } else {
+            if (cur != NULL && cur->type == EV_RENEGE) {
+                trace_span(&tracer->trace, TRACE_STUDENTS, id, "waiting (gave up)",
+                           ev->student.seated_at, now);
+            }
+            trace_span(&tracer->trace, TRACE_STUDENTS, id, "programming", now, ev->time);
+        }
+    } else if (ev->type == EV_DONE) {
+        double* since = &tracer->ta_free_since[ev->slot];
+        if (ev->student.seated_at < now) {
+            trace_span(&tracer->trace, TRACE_STUDENTS, id, "waiting",
+                       ev->student.seated_at, now);
+        }
+        trace_span(&tracer->trace, TRACE_STUDENTS, id, "with the TA", now, ev->time);
+        if (*since < now) {
+            trace_span(&tracer->trace, TRACE_TAS, ev->slot + 1, "sleeping", *since, now);
+        }
+        trace_span(&tracer->trace, TRACE_TAS, ev->slot + 1, "helping", now, ev->time);
+        *since = ev->time;
+    }
+} //end tracer_send
+
+static int tracer_finish(tracer_t* tracer) {
+    free(tracer->ta_free_since);
+    return trace_close(&tracer->trace);
+}
+
+/****************************************************************************
+* Validation against queueing theory
+* With Poisson arrivals, exponential help times, c TAs and a hallway of
+* num_chairs, the office is an M/M/c/K queue with K = c + num_chairs: a
+* student who finds the hallway full is lost. Its blocking probability,
+* mean line length and mean wait have closed forms, so the engine can be
+* checked against them.
+****************************************************************************/
+typedef struct {
+    double blocking;                    //chance an arrival finds the hallway full
+    double line;                        //time-average students in the hallway (Lq)
+    double wait;                        //mean hallway wait of admitted students (Wq)
+} queue_measures_t;
+
+/****************************************************************************
+* Function: mmck_measures
+* What it does: Computes the M/M/c/K stationary measures.
+* Inputs: rate -> arrivals per second
+*         help_mean -> mean help time in seconds
+*         tas -> c, chairs -> K - c
+****************************************************************************/
+static queue_measures_t mmck_measures(double rate, double help_mean, int tas, int chairs) {
+    queue_measures_t m;
+    double load = rate * help_mean;     //offered load a = lambda / mu
+    double term = 1.0;                  //a^n / n! for n <= c, then times (a/c) each step
+    double total = 0.0;
+    double line = 0.0;
+    double p_full;
+    int n;
+
+    for (n = 0; n <= tas + chairs; n++) {
+        if (n > 0) {
+            term *= n <= tas ? load / n : load / tas;
+        }
+        total += term;
+        if (n > tas) {
+            line += (n - tas) * term;
+        }
+    } //end for
+    p_full = term / total;
+
+    m.blocking = p_full;
+    m.line = line / total;
+    m.wait = m.line / (rate * (1.0 - p_full));
+    return m;
+} //end mmck_measures
+
+//Drops lost students (scheduled "never"), passes everything else on
+static void validate_send(void* ctx, int dest, const event_t* ev) {
+    if (!isinf(ev->time)) {
+        office_send_local(ctx, dest, ev);
+    }
+}
+
+//Student t quantile with df degrees of freedom that matches the normal
+//quantile z (Cornish-Fisher expansion, Abramowitz & Stegun 26.7.5).
+//Within 0.1% of the exact value for df >= 5 up to z = 2.6
+static double t_quantile(double z, int df) {
+    double z2 = z * z;
+    double n = df;
+
+    return z + z * (z2 + 1.0) / (4.0 * n)
+             + z * ((5.0 * z2 + 16.0) * z2 + 3.0) / (96.0 * n * n)
+             + z * (((3.0 * z2 + 19.0) * z2 + 17.0) * z2 - 15.0) / (384.0 * n * n * n)
+             + z * ((((79.0 * z2 + 776.0) * z2 + 1482.0) * z2 - 1920.0) * z2 - 945.0)
+               / (92160.0 * n * n * n * n);
+}
+
+/****************************************************************************
+* Function: run_validation
+* What it does: Runs the office with Poisson arrivals of one-visit students
+*               (turned-away students leave for good), discards a warm-up
+*               period and then measures batch after batch until the 95%
+*               confidence interval of every measure is within the
+*               requested relative precision. Stopping there biases those
+*               batches, so the same number of fresh batches is then run
+*               for the estimate that is checked. Each measure is compared
+*               with the M/M/c/K result and flagged if the closed form
+*               falls outside its 99.2% interval, so that the three checks
+*               together fail a correct engine only 2.5% of the time.
+* Inputs: params -> chairs, TAs and help time (must be exponential)
+* Outputs: 0 if every measure agrees, 1 on a deviation or bad settings
+****************************************************************************/
+static int run_validation(office_params_t params) {
+    static const char* names[3] = { "blocking probability", "mean line length",
+                                    "mean wait (s)" };
+    enum { MIN_BATCHES = 30, MAX_BATCHES = 5000 };
+    const double z_precision = 1.959964; //95% two-sided, for -E
+    const double z_check = 2.638257;     //99.17% two-sided: 2.5% over 3 checks
+    queue_measures_t exact;
+    office_t office;
+    double sums[3] = { 0.0, 0.0, 0.0 };
+    double squares[3] = { 0.0, 0.0, 0.0 };
+    double mean[3];
+    double half[3];
+    double score[3];
+    double exact_v[3];
+    double batch_len;
+    double batch_end;
+    double next_arrival;
+    double area = 0.0;
+    double last = 0.0;
+    uint64_t arrivals_rng = run_seed ^ 0x5DEECE66DULL;
+    office_stats_t at_start;
+    long starts_at_start;
+    int next_id = 1;
+    int batches = 0;
+    int target = 0;                     //fresh batches to run once converged
+    int done = 0;
+    int deviations = 0;
+    event_t ev;
+    int k;
+
+    if (params.help_time.kind != DIST_EXP || params.num_chairs <= 0 || params.num_tas <= 0) {
+        printf("Validation needs exponential help times (-H exp:MEAN), chairs and TAs.\n");
+        return 1;
+    }
+    params.help_requests = 1;
+    params.patience.kind = DIST_NEVER;
+    params.retry_time = INFINITY;       //turned away: never comes back
+    params.transfer_prob = 0.0;
+    if (office_init(&office, 0, 1, &params) != 0) {
+        printf("Error: unable to allocate the office.\n");
+        return 1;
+    }
+
+    exact = mmck_measures(validate_rate, params.help_time.a, params.num_tas, params.num_chairs);
+    exact_v[0] = exact.blocking;
+    exact_v[1] = exact.line;
+    exact_v[2] = exact.wait;
+
+    //Batches long enough for about 20000 arrivals; the first one is warm-up
+    batch_len = 20000.0 / validate_rate;
+    batch_end = batch_len;
+    next_arrival = -log(1.0 - rng_uniform(&arrivals_rng)) / validate_rate;
+    memset(&at_start, 0, sizeof(at_start));
+    starts_at_start = 0;
+
+    while (!done) {
+        double next;
+
+        if (next_arrival < office_next_time(&office)) {
+            memset(&ev, 0, sizeof(ev));
+            ev.type = EV_ARRIVE;
+            ev.time = next_arrival;
+            ev.student = office_new_student(next_id++, run_seed, &params);
+            office_push(&office, &ev);
+            next_arrival += -log(1.0 - rng_uniform(&arrivals_rng)) / validate_rate;
+        }
+        next = office_next_time(&office);
+
+        //Close every batch that ends before the next event
+        while (next > batch_end && !done) {
+            area += office.hall_len * (batch_end - last);
+            last = batch_end;
+            if (batch_end > batch_len) { //the first batch is warm-up
+                long arrivals = office.stats.arrivals - at_start.arrivals;
+                long starts = office.stats.helped + office.busy - starts_at_start;
+                double v[3];
+
+                v[0] = arrivals ? (double)(office.stats.rejected - at_start.rejected) / arrivals : 0.0;
+                v[1] = area / batch_len;
+                v[2] = starts ? (office.stats.wait_sum - at_start.wait_sum) / starts : 0.0;
+                for (k = 0; k < 3; k++) {
+                    sums[k] += v[k];
+                    squares[k] += v[k] * v[k];
+                }
+                batches++;
+            }
+            at_start = office.stats;
+            starts_at_start = office.stats.helped + office.busy;
+            area = 0.0;
+            batch_end += batch_len;
+
+            if (target > 0) {
+                done = batches == target;
+            } else if (batches >= MIN_BATCHES) {
+                int converged = 1;
+                for (k = 0; k < 3; k++) {
+                    double var = (squares[k] - sums[k] * sums[k] / batches) / (batches - 1);
+                    mean[k] = sums[k] / batches;
+                    half[k] = t_quantile(z_precision, batches - 1) *
+                              sqrt(var > 0.0 ? var / batches : 0.0);
+                    //Relative precision, or an absolute 1e-6 for measures near 0
+                    if (half[k] > validate_precision * fabs(mean[k]) && half[k] > 1e-6) {
+                        converged = 0;
+                    }
+                }
+                if (converged) {
+                    //Start over with the batch count fixed in advance
+                    target = batches;
+                    batches = 0;
+                    for (k = 0; k < 3; k++) {
+                        sums[k] = 0.0;
+                        squares[k] = 0.0;
+                    }
+                } else {
+                    done = batches >= MAX_BATCHES;
+                }
+            }
+        } //end while (batch boundaries)
+        if (done) {
+            break;
+        }
+
+        area += office.hall_len * (next - last);
+        last = next;
+        office_pop(&office, &ev);
+        office_handle(&office, &ev, NULL, validate_send, &office);
+    } //end while
+
+    printf("M/M/%d/%d: %g arrivals/s, mean help %g s (load %.3f per TA)\n",
+           params.num_tas, params.num_tas + params.num_chairs, validate_rate,
+           params.help_time.a, validate_rate * params.help_time.a / params.num_tas);
+    if (target > 0) {
+        printf("Converged after %d batches of %g s; checked on %d fresh ones\n",
+               target, batch_len, batches);
+    } else {
+        printf("Stopped at the batch limit: %d batches of %g s after warm-up\n",
+               batches, batch_len);
+    }
+    printf("Each check fails if |t| > %.3f (99.2%% per measure, 2.5%% for all three)\n\n",
+           t_quantile(z_check, batches - 1));
+    printf("%-22s %12s %12s %12s %7s  %s\n", "measure", "exact", "simulated", "+/- 99.2%",
+           "t", "check");
+    for (k = 0; k < 3; k++) {
+        double var = (squares[k] - sums[k] * sums[k] / batches) / (batches - 1);
+        double se = sqrt(var > 0.0 ? var / batches : 0.0);
+        int off;
+
+        mean[k] = sums[k] / batches;
+        half[k] = t_quantile(z_check, batches - 1) * se;
+        score[k] = se > 0.0 ? (mean[k] - exact_v[k]) / se : 0.0;
+        off = fabs(mean[k] - exact_v[k]) > half[k];
+        deviations += off;
+        printf("%-22s %12.6g %12.6g %12.3g %+7.2f  %s\n", names[k], exact_v[k], mean[k],
+               half[k], score[k], off ? "DEVIATION" : "ok");
+    }
+    office_free(&office);
+    return deviations > 0;
+} //end run_validation
@@ -0,0 +1,1046 @@
+//office_model.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "office_model.h"
+
+/****************************************************************************
+* Compile-time specialization
+* The event code below is written once, as always-inline functions that
+* take a `features` mask. office_handle passes OF_ALL, so every feature is
+* checked at run time. office_run passes a constant mask instead, and the
+* compiler drops the code of every feature left out of it, the same way a
+* C++ template would be instantiated once per policy.
+****************************************************************************/
+#define OF_SEND     1u                  //new events go through send() (else our own heap)
+#define OF_UNDO     2u                  //record undo information (Time Warp)
+#define OF_PATIENCE 4u                  //seated students may run out of patience
+#define OF_TRANSFER 8u                  //students may move to another office
+#define OF_ALL      (OF_SEND | OF_UNDO | OF_PATIENCE | OF_TRANSFER)
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/****************************************************************************
+* Random numbers
+* splitmix64: one 64-bit word of state per student, cheap to copy around
+****************************************************************************/
+static uint64_t rng_next(uint64_t* rng) {
+    uint64_t z = (*rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+double rng_uniform(uint64_t* rng) {
+    return (double)(rng_next(rng) >> 11) * (1.0 / 9007199254740992.0); //[0, 1)
+}
+
+/****************************************************************************
+* Function: draw / dist_draw
+* What it does: Draws one delay (in seconds) from a distribution using the
+*               given random stream.
+* Inputs: dist -> distribution to draw from
+*         rng -> random stream to advance
+* Outputs: the delay in seconds
+****************************************************************************/
+ALWAYS_INLINE double draw(const dist_t* dist, uint64_t* rng) {
+    double u = rng_uniform(rng);
+
+    switch (dist->kind) {
+    case DIST_UNIFORM:
+        return dist->a + floor(u * (dist->b - dist->a + 1.0));
+    case DIST_EXP:
+        return -dist->a * log(1.0 - u);
+    case DIST_NEVER:
+        return INFINITY;
+    default:
+        return dist->a;
+    }
+} //end draw
+
+double dist_draw(const dist_t* dist, uint64_t* rng) {
+    return draw(dist, rng);
+}
+
+/****************************************************************************
+* Function: dist_parse
+* What it does: Reads a distribution written as "const:5", "uniform:1:5",
+*               "exp:120" (seconds) or "never".
+* Outputs: 0 on success, -1 if the text is not understood
+****************************************************************************/
+int dist_parse(dist_t* dist, const char* text) {
+    double a;
+    double b;
+
+    if (sscanf(text, "uniform:%lf:%lf", &a, &b) == 2 && a >= 0.0 && b >= a) {
+        dist->kind = DIST_UNIFORM;
+    } else if (sscanf(text, "exp:%lf", &a) == 1 && a > 0.0) {
+        dist->kind = DIST_EXP;
+        b = 0.0;
+    } else if (sscanf(text, "const:%lf", &a) == 1 && a >= 0.0) {
+        dist->kind = DIST_CONST;
+        b = 0.0;
+    } else if (strcmp(text, "never") == 0) {
+        dist->kind = DIST_NEVER;
+        a = b = 0.0;
+    } else {
+        return -1;
+    }
+    dist->a = a;
+    dist->b = b;
+    return 0;
+} //end dist_parse
+
+/****************************************************************************
+* Function: office_default_params
+* What it does: Fills in the same numbers TA_Sim.c uses: one TA, program
+*               1-5 seconds, 5 seconds of help, retry a full hallway after
+*               1 second, endless patience and 3 help visits per student.
+****************************************************************************/
+void office_default_params(office_params_t* params) {
+    memset(params, 0, sizeof(*params));
+    params->num_chairs = 3;
+    params->num_tas = 1;
+    params->help_requests = 3;
+    params->program_time.kind = DIST_UNIFORM;
+    params->program_time.a = 1.0;
+    params->program_time.b = 5.0;
+    params->help_time.kind = DIST_CONST;
+    params->help_time.a = 5.0;
+    params->patience.kind = DIST_NEVER; //TA_Sim.c students never give up
+    params->retry_time = 1.0;
+    params->transfer_prob = 0.0;
+    params->transfer_time = 1.0;
+} //end office_default_params
+
+/****************************************************************************
+* Function: office_init
+* What it does: Sets up an empty office (no students yet).
+* Inputs: office -> office to set up
+*         id, num_offices -> position of this office among all offices
+*         params -> settings to copy into the office
+* Outputs: 0 on success, -1 if memory could not be allocated
+****************************************************************************/
+static void init_chairs(chair_t* chairs, int num_chairs) {
+    int i;
+
+    for (i = 0; i < num_chairs; i++) {
+        chairs[i].used = 0;
+        chairs[i].prev = -1;
+        chairs[i].next = i + 1 < num_chairs ? i + 1 : -1;
+    }
+}
+
+int office_init(office_t* office, int id, int num_offices, const office_params_t* params) {
+    memset(office, 0, sizeof(*office));
+    office->id = id;
+    office->num_offices = num_offices;
+    office->params = *params;
+
+    office->chairs = (chair_t*)calloc((size_t)params->num_chairs, sizeof(chair_t));
+    office->helping = (student_t*)calloc((size_t)params->num_tas, sizeof(student_t));
+    office->ta_busy = (char*)calloc((size_t)params->num_tas, 1);
+    office->ta_slots = params->num_tas;
+    if (office->chairs == NULL || office->helping == NULL || office->ta_busy == NULL) {
+        office_free(office);
+        return -1;
+    }
+    init_chairs(office->chairs, params->num_chairs);
+    office->hall_head = -1;
+    office->hall_tail = -1;
+    office->free_chair = 0;
+    return 0;
+} //end office_init
+
+void office_free(office_t* office) {
+    free(office->heap);
+    free(office->chairs);
+    free(office->helping);
+    free(office->ta_busy);
+    office->heap = NULL;
+    office->chairs = NULL;
+    office->helping = NULL;
+    office->ta_busy = NULL;
+} //end office_free
+
+/****************************************************************************
+* Function: office_clone
+* What it does: Makes `copy` an independent deep copy of `office`, so the
+*               two can run on separately (e.g. one per what-if variant).
+* Outputs: 0 on success, -1 if memory could not be allocated
+****************************************************************************/
+int office_clone(office_t* copy, const office_t* office) {
+    *copy = *office;
+    copy->heap = (event_t*)malloc(sizeof(event_t) * (size_t)(office->heap_cap ? office->heap_cap : 1));
+    copy->chairs = (chair_t*)malloc(sizeof(chair_t) * (size_t)office->params.num_chairs);
+    copy->helping = (student_t*)malloc(sizeof(student_t) * (size_t)office->ta_slots);
+    copy->ta_busy = (char*)malloc((size_t)office->ta_slots);
+    if (copy->heap == NULL || copy->chairs == NULL || copy->helping == NULL ||
+        copy->ta_busy == NULL) {
+        office_free(copy);
+        return -1;
+    }
+    copy->heap_cap = office->heap_cap ? office->heap_cap : 1;
+    memcpy(copy->heap, office->heap, sizeof(event_t) * (size_t)office->heap_len);
+    memcpy(copy->chairs, office->chairs, sizeof(chair_t) * (size_t)office->params.num_chairs);
+    memcpy(copy->helping, office->helping, sizeof(student_t) * (size_t)office->ta_slots);
+    memcpy(copy->ta_busy, office->ta_busy, (size_t)office->ta_slots);
+    return 0;
+} //end office_clone
+
+/****************************************************************************
+* Function: office_new_student
+* What it does: Creates a student with its own random stream derived from
+*               the run seed and the student id.
+****************************************************************************/
+student_t office_new_student(int id, uint64_t seed, const office_params_t* params) {
+    student_t student;
+    uint64_t mix = seed ^ ((uint64_t)id * 0xD1B54A32D192ED03ULL);
+
+    memset(&student, 0, sizeof(student));
+    student.rng = rng_next(&mix);
+    student.id = id;
+    student.helps_left = params->help_requests;
+    return student;
+} //end office_new_student
+
+/****************************************************************************
+* Function: office_add_student
+* What it does: Starts a student programming; their first visit to this
+*               office is scheduled after one programming interval.
+****************************************************************************/
+void office_add_student(office_t* office, student_t student) {
+    event_t ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = EV_ARRIVE;
+    ev.time = office->now + dist_draw(&office->params.program_time, &student.rng);
+    ev.student = student;
+    office_push(office, &ev);
+} //end office_add_student
+
+/****************************************************************************
+* Event heap
+* Ties on time are broken by student id, then event type. A student has at
+* most one live pending event (plus, at most, a stale patience timer), so
+* the order is the same no matter how events were queued.
+****************************************************************************/
+int event_before(const event_t* a, const event_t* b) {
+    if (a->time != b->time) {
+        return a->time < b->time;
+    }
+    if (a->student.id != b->student.id) {
+        return a->student.id < b->student.id;
+    }
+    return a->type < b->type;
+}
+
+//Makes room for at least `events` pending events up front
+int office_reserve(office_t* office, int events) {
+    event_t* grown;
+
+    if (events <= office->heap_cap) {
+        return 0;
+    }
+    grown = (event_t*)realloc(office->heap, sizeof(event_t) * (size_t)events);
+    if (grown == NULL) {
+        return -1;
+    }
+    office->heap = grown;
+    office->heap_cap = events;
+    return 0;
+} //end office_reserve
+
+int office_push(office_t* office, const event_t* ev) {
+    int i;
+
+    if (office->heap_len == office->heap_cap) {
+        int new_cap = office->heap_cap ? office->heap_cap * 2 : 64;
+        event_t* grown = (event_t*)realloc(office->heap, sizeof(event_t) * (size_t)new_cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        office->heap = grown;
+        office->heap_cap = new_cap;
+    }
+
+    //Sift the new event up from the bottom of the heap
+    i = office->heap_len++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!event_before(ev, &office->heap[parent])) {
+            break;
+        }
+        office->heap[i] = office->heap[parent];
+        i = parent;
+    }
+    office->heap[i] = *ev;
+    return 0;
+} //end office_push
+
+int office_pop(office_t* office, event_t* ev) {
+    event_t last;
+    int i = 0;
+
+    if (office->heap_len == 0) {
+        return 0;
+    }
+    *ev = office->heap[0];
+    last = office->heap[--office->heap_len];
+
+    //Sift the last event down from the top of the heap
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= office->heap_len) {
+            break;
+        }
+        if (child + 1 < office->heap_len &&
+            event_before(&office->heap[child + 1], &office->heap[child])) {
+            child++;
+        }
+        if (!event_before(&office->heap[child], &last)) {
+            break;
+        }
+        office->heap[i] = office->heap[child];
+        i = child;
+    }
+    office->heap[i] = last;
+    return 1;
+} //end office_pop
+
+double office_next_time(const office_t* office) {
+    return office->heap_len > 0 ? office->heap[0].time : INFINITY;
+}
+
+void office_send_local(void* ctx, int dest, const event_t* ev) {
+    (void)dest; //single office: every event stays here
+    office_push((office_t*)ctx, ev);
+}
+
+//Hands a new event to send(), or without OF_SEND straight to our own heap
+ALWAYS_INLINE void emit(office_t* office, int dest, const event_t* ev,
+                        office_send_fn send, void* ctx, unsigned features) {
+    if (features & OF_SEND) {
+        send(ctx, dest, ev);
+    } else {
+        office_push(office, ev);
+    }
+}
+
+/****************************************************************************
+* Function: schedule_next_visit
+* What it does: Sends a student off to their next visit at time `when`,
+*               either back to this office or (with transfer_prob) to a
+*               different office, which costs an extra transfer_time.
+****************************************************************************/
+ALWAYS_INLINE void schedule_next_visit(office_t* office, student_t* student, double when,
+                                       office_send_fn send, void* ctx, unsigned features) {
+    event_t ev;
+    int dest = office->id;
+
+    if ((features & OF_TRANSFER) && office->num_offices > 1 && office->params.transfer_prob > 0.0 &&
+        rng_uniform(&student->rng) < office->params.transfer_prob) {
+        //Pick one of the other offices uniformly
+        dest = (int)(rng_uniform(&student->rng) * (office->num_offices - 1));
+        if (dest >= office->id) {
+            dest++;
+        }
+        when += office->params.transfer_time;
+        office->stats.transfers_out++;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = EV_ARRIVE;
+    ev.time = when;
+    ev.student = *student;
+    emit(office, dest, &ev, send, ctx, features);
+} //end schedule_next_visit
+
+/****************************************************************************
+* Hallway line
+* Every chair written is saved in the undo record first (newest last), so
+* office_undo can put the line back exactly.
+****************************************************************************/
+ALWAYS_INLINE void save_chair(office_t* office, office_undo_t* undo, int chair,
+                              unsigned features) {
+    if ((features & OF_UNDO) && undo != NULL && chair >= 0) {
+        undo->chair_idx[undo->chairs_saved] = chair;
+        undo->chair_old[undo->chairs_saved] = office->chairs[chair];
+        undo->chairs_saved++;
+    }
+}
+
+//Seats a student at the back of the line; returns the chair used
+ALWAYS_INLINE int hall_push(office_t* office, const student_t* student, office_undo_t* undo,
+                            unsigned features) {
+    int chair = office->free_chair;
+    chair_t* c = &office->chairs[chair];
+
+    save_chair(office, undo, chair, features);
+    save_chair(office, undo, office->hall_tail, features);
+    office->free_chair = c->next;
+    c->student = *student;
+    c->used = 1;
+    c->prev = office->hall_tail;
+    c->next = -1;
+    if (office->hall_tail >= 0) {
+        office->chairs[office->hall_tail].next = chair;
+    } else {
+        office->hall_head = chair;
+    }
+    office->hall_tail = chair;
+    office->hall_len++;
+    return chair;
+} //end hall_push
+
+//Takes the student in `chair` out of the line, wherever they are in it
+ALWAYS_INLINE student_t hall_remove(office_t* office, int chair, office_undo_t* undo,
+                                    unsigned features) {
+    chair_t* c = &office->chairs[chair];
+
+    save_chair(office, undo, chair, features);
+    save_chair(office, undo, c->prev, features);
+    save_chair(office, undo, c->next, features);
+    if (c->prev >= 0) {
+        office->chairs[c->prev].next = c->next;
+    } else {
+        office->hall_head = c->next;
+    }
+    if (c->next >= 0) {
+        office->chairs[c->next].prev = c->prev;
+    } else {
+        office->hall_tail = c->prev;
+    }
+    c->used = 0;
+    c->prev = -1;
+    c->next = office->free_chair;
+    office->free_chair = chair;
+    office->hall_len--;
+    return c->student;
+} //end hall_remove
+
+/****************************************************************************
+* Function: start_help
+* What it does: Puts a student in front of TA number `ta` and schedules
+*               the end of the help session.
+****************************************************************************/
+ALWAYS_INLINE void start_help(office_t* office, int ta, student_t* student, office_undo_t* undo,
+                              office_send_fn send, void* ctx, unsigned features) {
+    event_t ev;
+    double wait = office->now - student->seated_at;
+
+    if ((features & OF_UNDO) && undo != NULL) {
+        undo->ta_idx = ta;
+        undo->ta_old = office->helping[ta];
+        undo->ta_was_busy = office->ta_busy[ta];
+    }
+
+    office->stats.wait_sum += wait;
+    if (wait > office->stats.wait_max) {
+        office->stats.wait_max = wait;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = EV_DONE;
+    ev.slot = ta;
+    ev.time = office->now + draw(&office->params.help_time, &student->rng);
+    ev.student = *student;
+
+    office->helping[ta] = *student;
+    office->ta_busy[ta] = 1;
+    office->busy++;
+    emit(office, office->id, &ev, send, ctx, features);
+} //end start_help
+
+/****************************************************************************
+* Function: office_handle
+* What it does: Applies one event to the office: a student arriving at
+*               the door, or a TA finishing a help session. New events are
+*               handed to `send` (including ones for this same office).
+* Inputs: office -> office the event belongs to
+*         ev -> event to apply (must not be earlier than office->now)
+*         undo -> if not NULL, filled in so office_undo can reverse this
+*         send, ctx -> where newly scheduled events go
+****************************************************************************/
+ALWAYS_INLINE void handle_event(office_t* office, const event_t* ev, office_undo_t* undo,
+                                office_send_fn send, void* ctx, unsigned features) {
+    student_t student = ev->student;
+    int ta;
+
+    if ((features & OF_UNDO) && undo != NULL) {
+        undo->now = office->now;
+        undo->stats = office->stats;
+        undo->busy = office->busy;
+        undo->leaving = office->leaving;
+        undo->hall_head = office->hall_head;
+        undo->hall_tail = office->hall_tail;
+        undo->hall_len = office->hall_len;
+        undo->free_chair = office->free_chair;
+        undo->chairs_saved = 0;
+        undo->ta_idx = -1;
+    }
+
+    office->now = ev->time;
+    office->stats.events++;
+
+    if (ev->type == EV_ARRIVE) {
+        office->stats.arrivals++;
+
+        if (office->busy - office->leaving < office->params.num_tas) {
+            //A TA is asleep, so the hallway is empty: wake the TA right away
+            for (ta = 0; office->ta_busy[ta]; ta++) {
+            }
+            office->stats.seated++;
+            student.seated_at = office->now;
+            start_help(office, ta, &student, undo, send, ctx, features);
+        } else if (office->hall_len < office->params.num_chairs) {
+            //Sit down in the next free chair, and start the patience timer
+            int chair;
+            student.seated_at = office->now;
+            chair = hall_push(office, &student, undo, features);
+            office->stats.seated++;
+            if ((features & OF_PATIENCE) && office->params.patience.kind != DIST_NEVER) {
+                event_t timer;
+                memset(&timer, 0, sizeof(timer));
+                timer.type = EV_RENEGE;
+                timer.slot = chair;
+                timer.time = office->now +
+                             draw(&office->params.patience, &office->chairs[chair].student.rng);
+                timer.student = office->chairs[chair].student;
+                emit(office, office->id, &timer, send, ctx, features);
+            }
+        } else {
+            //Hallway full: come back later (maybe to a different office)
+            office->stats.rejected++;
+            schedule_next_visit(office, &student, office->now + office->params.retry_time,
+                                send, ctx, features);
+        }
+    } else if ((features & OF_PATIENCE) && ev->type == EV_RENEGE) {
+        //Only counts if the student is still sitting in that chair; the timer
+        //is left behind (stale) when the TA calls the student in first
+        const chair_t* c = ev->slot >= 0 ? &office->chairs[ev->slot] : NULL;
+        if (c != NULL && c->used && c->student.id == student.id &&
+            c->student.seated_at == student.seated_at) {
+            double program;
+            student = hall_remove(office, ev->slot, undo, features);
+            office->stats.reneged++;
+            office->stats.wait_sum += office->now - student.seated_at;
+
+            //Give up for now: back to programming, still needing help
+            program = draw(&office->params.program_time, &student.rng);
+            schedule_next_visit(office, &student, office->now + program, send, ctx, features);
+        }
+    } else {
+        //TA finished helping this student
+        ta = ev->slot;
+        if ((features & OF_UNDO) && undo != NULL) {
+            undo->ta_idx = ta;
+            undo->ta_old = office->helping[ta];
+            undo->ta_was_busy = office->ta_busy[ta];
+        }
+        office->ta_busy[ta] = 0;
+        office->busy--;
+        office->stats.helped++;
+        if (ta >= office->params.num_tas) {
+            office->leaving--; //this TA was sent home and now leaves
+        }
+
+        student.helps_left--;
+        if (student.helps_left > 0) {
+            double program = draw(&office->params.program_time, &student.rng);
+            schedule_next_visit(office, &student, office->now + program, send, ctx, features);
+        } else {
+            office->stats.finished++;
+        }
+
+        if (office->hall_len > 0 && ta < office->params.num_tas) {
+            //Call in the next student from the hallway
+            student_t next = hall_remove(office, office->hall_head, undo, features);
+            start_help(office, ta, &next, NULL, send, ctx, features);
+        } else if (office->busy == 0) {
+            office->stats.ta_sleeps++;
+        }
+    }
+} //end handle_event
+
+void office_handle(office_t* office, const event_t* ev, office_undo_t* undo,
+                   office_send_fn send, void* ctx) {
+    handle_event(office, ev, undo, send, ctx, OF_ALL);
+}
+
+/****************************************************************************
+* Function: office_run
+* What it does: Handles this office's own events, in order, up to and
+*               including time `until`, for a single office that keeps
+*               its events on its own heap (what office_handle does with
+*               office_send_local). The loop is compiled once with
+*               reneging and once without, and neither copy makes an
+*               indirect call or checks for undo records and transfers.
+* Inputs: office -> a single office (num_offices == 1)
+*         until -> last event time to handle (INFINITY for the whole run)
+* Outputs: number of events handled
+****************************************************************************/
+static long run_plain(office_t* office, double until) {
+    event_t ev;
+    long n = 0;
+
+    while (office->heap_len > 0 && office->heap[0].time <= until) {
+        office_pop(office, &ev);
+        handle_event(office, &ev, NULL, NULL, NULL, 0);
+        n++;
+    }
+    return n;
+}
+
+static long run_patience(office_t* office, double until) {
+    event_t ev;
+    long n = 0;
+
+    while (office->heap_len > 0 && office->heap[0].time <= until) {
+        office_pop(office, &ev);
+        handle_event(office, &ev, NULL, NULL, NULL, OF_PATIENCE);
+        n++;
+    }
+    return n;
+}
+
+long office_run(office_t* office, double until) {
+    //Timers left from an earlier patience setting still need the renege path
+    int timers = office->params.patience.kind != DIST_NEVER;
+    int i;
+
+    for (i = 0; i < office->heap_len && !timers; i++) {
+        timers = office->heap[i].type == EV_RENEGE;
+    }
+    return timers ? run_patience(office, until) : run_plain(office, until);
+} //end office_run
+
+/****************************************************************************
+* Function: office_undo
+* What it does: Reverses one office_handle call. Undo records must be
+*               applied newest first. Events the handled event scheduled
+*               are not touched; the caller is responsible for those.
+****************************************************************************/
+void office_undo(office_t* office, const office_undo_t* undo) {
+    int i;
+
+    for (i = undo->chairs_saved - 1; i >= 0; i--) {
+        office->chairs[undo->chair_idx[i]] = undo->chair_old[i];
+    }
+    if (undo->ta_idx >= 0) {
+        office->helping[undo->ta_idx] = undo->ta_old;
+        office->ta_busy[undo->ta_idx] = (char)undo->ta_was_busy;
+    }
+    office->now = undo->now;
+    office->stats = undo->stats;
+    office->busy = undo->busy;
+    office->leaving = undo->leaving;
+    office->hall_head = undo->hall_head;
+    office->hall_tail = undo->hall_tail;
+    office->hall_len = undo->hall_len;
+    office->free_chair = undo->free_chair;
+} //end office_undo
+
+//Makes sure there are at least `slots` TA slots; new ones start idle
+static int office_grow_tas(office_t* office, int slots) {
+    student_t* helping;
+    char* ta_busy;
+    int i;
+
+    if (slots <= office->ta_slots) {
+        return 0;
+    }
+    helping = (student_t*)realloc(office->helping, sizeof(student_t) * (size_t)slots);
+    if (helping == NULL) {
+        return -1;
+    }
+    office->helping = helping;
+    ta_busy = (char*)realloc(office->ta_busy, (size_t)slots);
+    if (ta_busy == NULL) {
+        return -1;
+    }
+    office->ta_busy = ta_busy;
+    for (i = office->ta_slots; i < slots; i++) {
+        office->ta_busy[i] = 0;
+    }
+    office->ta_slots = slots;
+    return 0;
+} //end office_grow_tas
+
+/****************************************************************************
+* Function: office_reconfigure
+* What it does: Changes the office's settings in the middle of a run.
+*   - new chairs start empty; if chairs are taken away, the students at the
+*     back of the line are sent off to come back later
+*   - new TAs start by calling in students from the hallway
+*   - TAs that are sent home finish their current student first
+*   - a new help time applies to sessions that start from now on
+* Inputs: office -> office to change
+*         params -> new settings
+*         send, ctx -> where newly scheduled events go
+* Outputs: 0 on success, -1 if memory ran out (office unchanged)
+****************************************************************************/
+int office_reconfigure(office_t* office, const office_params_t* params,
+                       office_send_fn send, void* ctx) {
+    chair_t* old_chairs = office->chairs;
+    int* moved_to = (int*)malloc(sizeof(int) * (size_t)office->params.num_chairs);
+    chair_t* chairs = (chair_t*)calloc((size_t)params->num_chairs, sizeof(chair_t));
+    int chair;
+    int keep;
+    int i;
+
+    if (moved_to == NULL || chairs == NULL || office_grow_tas(office, params->num_tas) != 0) {
+        free(moved_to);
+        free(chairs);
+        return -1;
+    }
+
+    //Move the line into the new chairs, front of the line first
+    keep = office->hall_len < params->num_chairs ? office->hall_len : params->num_chairs;
+    for (i = 0; i < office->params.num_chairs; i++) {
+        moved_to[i] = -1;
+    }
+    chair = office->hall_head;
+    office->chairs = chairs;
+    office->hall_len = 0;
+    office->hall_head = -1;
+    office->hall_tail = -1;
+    office->free_chair = 0;
+    init_chairs(chairs, params->num_chairs);
+    for (i = 0; chair >= 0; i++, chair = old_chairs[chair].next) {
+        student_t student = old_chairs[chair].student;
+        if (i < keep) {
+            moved_to[chair] = hall_push(office, &student, NULL, OF_ALL);
+        } else {
+            schedule_next_visit(office, &student, office->now + params->retry_time, send, ctx,
+                                OF_ALL);
+        }
+    }
+
+    //Patience timers follow their student to the new chair
+    for (i = 0; i < office->heap_len; i++) {
+        event_t* ev = &office->heap[i];
+        if (ev->type == EV_RENEGE && ev->slot >= 0) {
+            ev->slot = moved_to[ev->slot];
+        }
+    }
+    free(old_chairs);
+    free(moved_to);
+    office->params = *params;
+
+    //Recount which busy TAs are now past the end of the roster
+    office->leaving = 0;
+    for (i = params->num_tas; i < office->ta_slots; i++) {
+        office->leaving += office->ta_busy[i];
+    }
+
+    //Any TA on the roster who is free calls in the next student
+    for (i = 0; i < params->num_tas && office->hall_len > 0; i++) {
+        if (!office->ta_busy[i]) {
+            student_t next = hall_remove(office, office->hall_head, NULL, OF_ALL);
+            start_help(office, i, &next, NULL, send, ctx, OF_ALL);
+        }
+    }
+    return 0;
+} //end office_reconfigure
+
+void office_stats_add(office_stats_t* total, const office_stats_t* part) {
+    total->events += part->events;
+    total->arrivals += part->arrivals;
+    total->seated += part->seated;
+    total->rejected += part->rejected;
+    total->reneged += part->reneged;
+    total->helped += part->helped;
+    total->transfers_out += part->transfers_out;
+    total->finished += part->finished;
+    total->ta_sleeps += part->ta_sleeps;
+    total->wait_sum += part->wait_sum;
+    if (part->wait_max > total->wait_max) {
+        total->wait_max = part->wait_max;
+    }
+} //end office_stats_add
+
+/****************************************************************************
+* Snapshots
+* A snapshot is everything needed to carry on exactly where the office
+* left off: settings, clock, counters, who sits in which chair, who each
+* TA is helping, and every pending event. Every student is either in a
+* chair, with a TA, or inside exactly one pending event, so this also
+* covers each student's visits left and random stream.
+*
+* Fields are written one by one (no struct padding) in the machine's own
+* byte order, so a snapshot is meant to be resumed on the same kind of
+* machine that wrote it.
+****************************************************************************/
+#define SNAPSHOT_MAGIC   "TAOFFICE"
+#define SNAPSHOT_VERSION 3
+
+#define PUT(value) fwrite(&(value), sizeof(value), 1, out)
+#define GET(value) (ok = ok && fread(&(value), sizeof(value), 1, in) == 1)
+
+static void put_dist(FILE* out, const dist_t* dist) {
+    PUT(dist->kind);
+    PUT(dist->a);
+    PUT(dist->b);
+}
+
+static int get_dist(FILE* in, dist_t* dist) {
+    int ok = 1;
+    GET(dist->kind);
+    GET(dist->a);
+    GET(dist->b);
+    return ok;
+}
+
+static void put_student(FILE* out, const student_t* student) {
+    PUT(student->rng);
+    PUT(student->id);
+    PUT(student->helps_left);
+    PUT(student->seated_at);
+}
+
+static int get_student(FILE* in, student_t* student) {
+    int ok = 1;
+    memset(student, 0, sizeof(*student));
+    GET(student->rng);
+    GET(student->id);
+    GET(student->helps_left);
+    GET(student->seated_at);
+    return ok;
+}
+
+/****************************************************************************
+* Function: office_save
+* What it does: Writes a snapshot of the office to an open file.
+* Outputs: 0 on success, -1 on a write error
+****************************************************************************/
+int office_save(const office_t* office, FILE* out) {
+    const office_params_t* p = &office->params;
+    const office_stats_t* st = &office->stats;
+    int version = SNAPSHOT_VERSION;
+    int i;
+
+    fwrite(SNAPSHOT_MAGIC, 1, 8, out);
+    PUT(version);
+    PUT(office->id);
+    PUT(office->num_offices);
+
+    PUT(p->num_chairs);
+    PUT(p->num_tas);
+    PUT(p->help_requests);
+    put_dist(out, &p->program_time);
+    put_dist(out, &p->help_time);
+    put_dist(out, &p->patience);
+    PUT(p->retry_time);
+    PUT(p->transfer_prob);
+    PUT(p->transfer_time);
+
+    PUT(office->now);
+    PUT(st->events);
+    PUT(st->arrivals);
+    PUT(st->seated);
+    PUT(st->rejected);
+    PUT(st->reneged);
+    PUT(st->helped);
+    PUT(st->transfers_out);
+    PUT(st->finished);
+    PUT(st->ta_sleeps);
+    PUT(st->wait_sum);
+    PUT(st->wait_max);
+
+    //Hallway chairs as they are (patience timers refer to chair numbers)
+    PUT(office->hall_head);
+    PUT(office->hall_tail);
+    PUT(office->hall_len);
+    PUT(office->free_chair);
+    for (i = 0; i < p->num_chairs; i++) {
+        const chair_t* c = &office->chairs[i];
+        PUT(c->used);
+        PUT(c->prev);
+        PUT(c->next);
+        put_student(out, &c->student);
+    }
+
+    //TA slots (including TAs who were sent home and are finishing up)
+    PUT(office->ta_slots);
+    for (i = 0; i < office->ta_slots; i++) {
+        char busy = office->ta_busy[i];
+        PUT(busy);
+        if (busy) {
+            put_student(out, &office->helping[i]);
+        }
+    }
+
+    //Pending events, in heap order so loading needs no re-sorting
+    PUT(office->heap_len);
+    for (i = 0; i < office->heap_len; i++) {
+        const event_t* ev = &office->heap[i];
+        unsigned char type = (unsigned char)ev->type;
+        PUT(ev->time);
+        PUT(type);
+        PUT(ev->slot);
+        put_student(out, &ev->student);
+    }
+
+    return ferror(out) ? -1 : 0;
+} //end office_save
+
+//A loaded hallway is only used if the line runs from hall_head to
+//hall_tail through hall_len taken chairs and the free list holds all the
+//others, so every link points at a real chair and neither loops
+static int chairs_ok(const office_t* office) {
+    int n = office->params.num_chairs;
+    int steps = 0;
+    int prev = -1;
+    int i;
+
+    if (office->hall_head < -1 || office->hall_head >= n || office->hall_tail < -1 ||
+        office->hall_tail >= n || office->free_chair < -1 || office->free_chair >= n) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        const chair_t* c = &office->chairs[i];
+        if (c->prev < -1 || c->prev >= n || c->next < -1 || c->next >= n) {
+            return 0;
+        }
+    }
+    for (i = office->hall_head; i >= 0; i = office->chairs[i].next) {
+        if (++steps > office->hall_len || !office->chairs[i].used ||
+            office->chairs[i].prev != prev) {
+            return 0;
+        }
+        prev = i;
+    }
+    if (steps != office->hall_len || prev != office->hall_tail) {
+        return 0;
+    }
+    for (i = office->free_chair; i >= 0; i = office->chairs[i].next) {
+        if (++steps > n || office->chairs[i].used) {
+            return 0;
+        }
+    }
+    return steps == n;
+} //end chairs_ok
+
+/****************************************************************************
+* Function: office_load
+* What it does: Rebuilds an office from a snapshot written by office_save.
+*               The office must not be initialized yet. Every chair link,
+*               TA slot and event type is checked before it is used, so a
+*               truncated or corrupt file is turned down, not indexed.
+* Outputs: 0 on success, -1 if the file is not a valid snapshot
+****************************************************************************/
+int office_load(office_t* office, FILE* in) {
+    office_params_t p;
+    char magic[8];
+    int version = 0;
+    int id = 0;
+    int num_offices = 0;
+    int slots = 0;
+    int count = 0;
+    int ok = 1;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    ok = fread(magic, 1, 8, in) == 8 && memcmp(magic, SNAPSHOT_MAGIC, 8) == 0;
+    GET(version);
+    if (!ok || version != SNAPSHOT_VERSION) {
+        return -1;
+    }
+    GET(id);
+    GET(num_offices);
+    GET(p.num_chairs);
+    GET(p.num_tas);
+    GET(p.help_requests);
+    ok = ok && get_dist(in, &p.program_time) && get_dist(in, &p.help_time) &&
+         get_dist(in, &p.patience);
+    GET(p.retry_time);
+    GET(p.transfer_prob);
+    GET(p.transfer_time);
+    if (!ok || p.num_chairs < 1 || p.num_tas < 1 || office_init(office, id, num_offices, &p) != 0) {
+        return -1;
+    }
+
+    GET(office->now);
+    GET(office->stats.events);
+    GET(office->stats.arrivals);
+    GET(office->stats.seated);
+    GET(office->stats.rejected);
+    GET(office->stats.reneged);
+    GET(office->stats.helped);
+    GET(office->stats.transfers_out);
+    GET(office->stats.finished);
+    GET(office->stats.ta_sleeps);
+    GET(office->stats.wait_sum);
+    GET(office->stats.wait_max);
+
+    GET(office->hall_head);
+    GET(office->hall_tail);
+    GET(office->hall_len);
+    GET(office->free_chair);
+    if (!ok || office->hall_len < 0 || office->hall_len > p.num_chairs) {
+        office_free(office);
+        return -1;
+    }
+    for (i = 0; ok && i < p.num_chairs; i++) {
+        chair_t* c = &office->chairs[i];
+        GET(c->used);
+        GET(c->prev);
+        GET(c->next);
+        ok = ok && get_student(in, &c->student);
+    }
+    if (!ok || !chairs_ok(office)) {
+        office_free(office);
+        return -1;
+    }
+
+    GET(slots);
+    if (!ok || slots < p.num_tas || office_grow_tas(office, slots) != 0) {
+        office_free(office);
+        return -1;
+    }
+    for (i = 0; ok && i < slots; i++) {
+        GET(office->ta_busy[i]);
+        if (ok && office->ta_busy[i]) {
+            ok = get_student(in, &office->helping[i]);
+            office->busy++;
+            if (i >= p.num_tas) {
+                office->leaving++;
+            }
+        }
+    }
+
+    GET(count);
+    if (!ok || count < 0 || office_reserve(office, count) != 0) {
+        office_free(office);
+        return -1;
+    }
+    for (i = 0; ok && i < count; i++) {
+        event_t* ev = &office->heap[i];
+        unsigned char type = 0;
+        memset(ev, 0, sizeof(*ev));
+        GET(ev->time);
+        GET(type);
+        GET(ev->slot);
+        ok = ok && get_student(in, &ev->student);
+        ev->type = type;
+        if (type == EV_DONE) {
+            ok = ok && ev->slot >= 0 && ev->slot < slots;
+        } else if (type == EV_RENEGE) {
+            ok = ok && ev->slot >= -1 && ev->slot < p.num_chairs; //-1: chair gone
+        } else {
+            ok = ok && type == EV_ARRIVE;
+        }
+    }
+    office->heap_len = count;
+
+    if (!ok) {
+        office_free(office);
+        return -1;
+    }
+    return 0;
+} //end office_load
+
+#undef PUT
+#undef GET
@@ -0,0 +1,172 @@
+//office_model.h
+#ifndef OFFICE_MODEL_H
+#define OFFICE_MODEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/****************************************************************************
+* Virtual-time model of one TA office
+* Follows the same rules as TA_Sim.c (students program, walk to the office,
+* sit in one of num_chairs hallway chairs or come back later when the
+* hallway is full, and the TA helps waiting students one at a time), but
+* moves a simulated clock forward instead of calling sleep(). A seated
+* student with limited patience leaves the line when it runs out and
+* comes back after another round of programming.
+*
+* Every student carries its own random stream inside its student_t, so the
+* result of a run does not depend on the order in which an engine happens
+* to process independent offices.
+****************************************************************************/
+
+//Kinds of random delays
+#define DIST_CONST    0                 //always a seconds
+#define DIST_UNIFORM  1                 //whole seconds a..b (like rand() % 5 + 1)
+#define DIST_EXP      2                 //exponential with mean a seconds
+#define DIST_NEVER    3                 //never happens (infinitely patient)
+
+typedef struct {
+    int kind;
+    double a;
+    double b;
+} dist_t;
+
+//Settings shared by every office in a run
+typedef struct {
+    int num_chairs;                     //chairs in the hallway (at least 1)
+    int num_tas;                        //TAs helping in the office
+    int help_requests;                  //visits each student needs help for
+    dist_t program_time;                //time programming between visits
+    dist_t help_time;                   //time the TA spends with one student
+    dist_t patience;                    //how long a seated student waits before leaving
+    double retry_time;                  //wait before retrying a full hallway
+    double transfer_prob;               //chance the next visit is to another office
+    double transfer_time;               //extra walking time to another office
+} office_params_t;
+
+//One student; lives inside whatever event, chair or TA slot holds it
+typedef struct {
+    uint64_t rng;                       //student's own random stream
+    int id;                             //global student id (1..num_students)
+    int helps_left;                     //help visits still needed
+    double seated_at;                   //time the student sat down in the hallway
+} student_t;
+
+#define EV_ARRIVE 0                     //student shows up at the office door
+#define EV_DONE   1                     //a TA finishes helping a student
+#define EV_RENEGE 2                     //a seated student runs out of patience
+
+typedef struct {
+    double time;
+    int type;
+    int slot;                           //TA (EV_DONE) or chair (EV_RENEGE)
+    student_t student;
+} event_t;
+
+//One hallway chair; taken chairs form a line, free ones a free list
+typedef struct {
+    student_t student;
+    int used;
+    int prev;                           //chair ahead in line (-1 for the front)
+    int next;                           //chair behind in line, or next free chair
+} chair_t;
+
+typedef struct {
+    long events;                        //events handled
+    long arrivals;                      //visits to the office door
+    long seated;                        //visits that got a chair (or the TA right away)
+    long rejected;                      //"Hallway full" visits
+    long reneged;                       //seated students who gave up waiting
+    long helped;                        //help sessions finished
+    long transfers_out;                 //visits sent on to another office
+    long finished;                      //students done for the day
+    long ta_sleeps;                     //times the TA went back to sleep
+    double wait_sum;                    //total time spent sitting in the hallway
+    double wait_max;                    //longest single hallway wait
+} office_stats_t;
+
+//Everything one handled event may overwrite, so it can be undone later
+typedef struct {
+    double now;
+    office_stats_t stats;
+    int busy;
+    int leaving;
+    int hall_head;
+    int hall_tail;
+    int hall_len;
+    int free_chair;
+    int chairs_saved;                   //chairs written (at most 3)
+    int chair_idx[3];
+    chair_t chair_old[3];
+    int ta_idx;                         //TA slot written (-1 for none)
+    student_t ta_old;
+    int ta_was_busy;
+} office_undo_t;
+
+typedef struct {
+    int id;                             //office number (0..num_offices-1)
+    int num_offices;
+    office_params_t params;
+    double now;                         //virtual clock of this office
+
+    //Pending events (binary min-heap ordered by time, then student id)
+    event_t* heap;
+    int heap_len;
+    int heap_cap;
+
+    //Hallway: num_chairs chairs linked in arrival order, so a student who
+    //gives up can leave from the middle of the line in O(1)
+    chair_t* chairs;
+    int hall_head;                      //front of the line (-1 if empty)
+    int hall_tail;                      //back of the line (-1 if empty)
+    int hall_len;
+    int free_chair;                     //first free chair (-1 if full)
+
+    //TA slots: who each TA is helping. Slots past num_tas belong to TAs
+    //that were sent home by office_reconfigure and are finishing up.
+    student_t* helping;
+    char* ta_busy;
+    int ta_slots;
+    int busy;                           //busy slots, including leaving TAs
+    int leaving;                        //busy slots at or past num_tas
+
+    office_stats_t stats;
+} office_t;
+
+//Called for every event an office schedules, including ones for itself
+typedef void (*office_send_fn)(void* ctx, int dest, const event_t* ev);
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+void office_default_params(office_params_t* params);
+int office_init(office_t* office, int id, int num_offices, const office_params_t* params);
+void office_free(office_t* office);
+int office_clone(office_t* copy, const office_t* office);
+
+student_t office_new_student(int id, uint64_t seed, const office_params_t* params);
+void office_add_student(office_t* office, student_t student);
+
+int office_push(office_t* office, const event_t* ev);
+int office_pop(office_t* office, event_t* ev);
+double office_next_time(const office_t* office);
+int event_before(const event_t* a, const event_t* b);
+
+void office_handle(office_t* office, const event_t* ev, office_undo_t* undo,
+                   office_send_fn send, void* ctx);
+void office_undo(office_t* office, const office_undo_t* undo);
+long office_run(office_t* office, double until);
+void office_send_local(void* ctx, int dest, const event_t* ev);
+
+int office_reserve(office_t* office, int events);
+int office_reconfigure(office_t* office, const office_params_t* params,
+                       office_send_fn send, void* ctx);
+int office_save(const office_t* office, FILE* out);
+int office_load(office_t* office, FILE* in);
+
+void office_stats_add(office_stats_t* total, const office_stats_t* part);
+double dist_draw(const dist_t* dist, uint64_t* rng);
+int dist_parse(dist_t* dist, const char* text);
+double rng_uniform(uint64_t* rng);
+
+#endif
@@ -0,0 +1,360 @@
+//ta_metrics.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ta_metrics.h"
+
+/****************************************************************************
+* Shards
+* Aligned to a cache line so two threads never write the same line.
+****************************************************************************/
+typedef struct {
+    _Atomic long counters[MET_COUNT];
+    _Atomic long buckets[MET_HISTS][MET_HIST_BUCKETS];
+    _Atomic double sums[MET_HISTS];
+} __attribute__((aligned(64))) metrics_shard_t;
+
+static metrics_shard_t* shards = NULL;
+static int num_shards = 0;
+
+static const char* counter_names[MET_COUNT] = {
+    "tasim_arrivals_total",
+    "tasim_seated_total",
+    "tasim_rejected_total",
+    "tasim_reneged_total",
+    "tasim_balked_total",
+    "tasim_parked_total",
+    "tasim_helped_total",
+    "tasim_finished_total",
+    "tasim_ta_sleeps_total",
+    "tasim_ta_wakeups_total",
+    "tasim_ta_spurious_wakeups_total",
+};
+
+static const char* hist_names[MET_HISTS] = {
+    "tasim_wait_seconds",
+    "tasim_timer_overshoot_seconds",
+};
+
+static const char* hist_help[MET_HISTS] = {
+    "Time seated students waited to be called in.",
+    "How late timed sleeps woke up after their deadline.",
+};
+
+static const char* counter_help[MET_COUNT] = {
+    "Visits to the office door.",
+    "Visits that got a hallway chair.",
+    "Visits turned away by a full hallway.",
+    "Seated students who gave up waiting.",
+    "Trips skipped because the published wait estimate was too long.",
+    "Callback tickets taken by turned-away students.",
+    "Help sessions given by the TA.",
+    "Students done for the day.",
+    "Times the TA went to sleep waiting for a student.",
+    "Times the TA woke up.",
+    "TA wake-ups that found no student waiting.",
+};
+
+/****************************************************************************
+* Function: metrics_init / metrics_free
+* What it does: Allocates zeroed shards, one per writing thread.
+* Inputs: shards -> number of shards (threads that record metrics)
+* Outputs: 0 on success, 1 if memory runs out
+****************************************************************************/
+int metrics_init(int count) {
+    shards = (metrics_shard_t*)aligned_alloc(64, sizeof(metrics_shard_t) * (size_t)count);
+    if (shards == NULL) {
+        return 1;
+    }
+    memset(shards, 0, sizeof(metrics_shard_t) * (size_t)count);
+    num_shards = count;
+    return 0;
+} //end metrics_init
+
+void metrics_free(void) {
+    free(shards);
+    shards = NULL;
+    num_shards = 0;
+}
+
+//Only the thread that owns `shard` may call these
+void metrics_add(int shard, int counter, long n) {
+    _Atomic long* slot = &shards[shard].counters[counter];
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+void metrics_observe(int shard, int hist, double seconds) {
+    metrics_shard_t* own = &shards[shard];
+    int bucket = seconds > 1e-6 ? (int)(log2(seconds * 1e6) * 4.0) : 0;
+
+    if (bucket >= MET_HIST_BUCKETS) {
+        bucket = MET_HIST_BUCKETS - 1;
+    }
+    atomic_store_explicit(&own->buckets[hist][bucket],
+                          atomic_load_explicit(&own->buckets[hist][bucket], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&own->sums[hist],
+                          atomic_load_explicit(&own->sums[hist], memory_order_relaxed) + seconds,
+                          memory_order_relaxed);
+} //end metrics_observe
+
+long metrics_total(int counter) {
+    long total = 0;
+    int i;
+
+    for (i = 0; i < num_shards; i++) {
+        total += atomic_load_explicit(&shards[i].counters[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+/****************************************************************************
+* Function: metrics_count / metrics_sum / metrics_quantile
+* What it does: The number of observations in a histogram, their total,
+*               and the upper edge of the bucket holding quantile q (0..1)
+*               of them.
+* Outputs: metrics_quantile returns NAN if the histogram is empty
+****************************************************************************/
+static void sum_buckets(int hist, long* buckets, double* sum) {
+    int b;
+    int i;
+
+    memset(buckets, 0, sizeof(long) * MET_HIST_BUCKETS);
+    *sum = 0.0;
+    for (i = 0; i < num_shards; i++) {
+        for (b = 0; b < MET_HIST_BUCKETS; b++) {
+            buckets[b] += atomic_load_explicit(&shards[i].buckets[hist][b], memory_order_relaxed);
+        }
+        *sum += atomic_load_explicit(&shards[i].sums[hist], memory_order_relaxed);
+    }
+} //end sum_buckets
+
+long metrics_count(int hist) {
+    long buckets[MET_HIST_BUCKETS];
+    long count = 0;
+    double sum;
+    int b;
+
+    sum_buckets(hist, buckets, &sum);
+    for (b = 0; b < MET_HIST_BUCKETS; b++) {
+        count += buckets[b];
+    }
+    return count;
+} //end metrics_count
+
+double metrics_sum(int hist) {
+    long buckets[MET_HIST_BUCKETS];
+    double sum;
+
+    sum_buckets(hist, buckets, &sum);
+    return sum;
+} //end metrics_sum
+
+double metrics_quantile(int hist, double q) {
+    long buckets[MET_HIST_BUCKETS];
+    long count = 0;
+    long seen = 0;
+    double sum;
+    int b;
+
+    sum_buckets(hist, buckets, &sum);
+    for (b = 0; b < MET_HIST_BUCKETS; b++) {
+        count += buckets[b];
+    }
+    for (b = 0; b < MET_HIST_BUCKETS && count > 0; b++) {
+        seen += buckets[b];
+        if (seen >= q * count) {
+            return 1e-6 * exp2((b + 1) / 4.0);
+        }
+    }
+    return NAN;
+} //end metrics_quantile
+
+/****************************************************************************
+* Function: metrics_write
+* What it does: Writes every counter, the caller's gauges and a summary of
+*               each histogram (count, sum and the 0.5/0.9/0.99 quantiles,
+*               each the upper edge of its histogram bucket) in Prometheus
+*               text format.
+* Inputs: out -> where to write
+*         gauges -> writes extra gauge lines (may be NULL)
+****************************************************************************/
+void metrics_write(FILE* out, metrics_gauge_fn gauges) {
+    static const double quantiles[3] = { 0.5, 0.9, 0.99 };
+    long buckets[MET_HIST_BUCKETS];
+    long count;
+    long seen;
+    double sum;
+    int q;
+    int h;
+    int b;
+    int i;
+
+    for (i = 0; i < MET_COUNT; i++) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %ld\n", counter_names[i],
+                counter_help[i], counter_names[i], counter_names[i], metrics_total(i));
+    }
+    if (gauges != NULL) {
+        gauges(out);
+    }
+
+    for (h = 0; h < MET_HISTS; h++) {
+        sum_buckets(h, buckets, &sum);
+        count = 0;
+        for (b = 0; b < MET_HIST_BUCKETS; b++) {
+            count += buckets[b];
+        }
+
+        fprintf(out, "# HELP %s %s\n# TYPE %s summary\n", hist_names[h], hist_help[h],
+                hist_names[h]);
+        seen = 0;
+        q = 0;
+        for (b = 0; b < MET_HIST_BUCKETS && q < 3; b++) {
+            seen += buckets[b];
+            while (q < 3 && count > 0 && seen >= quantiles[q] * count) {
+                fprintf(out, "%s{quantile=\"%g\"} %.9g\n", hist_names[h], quantiles[q],
+                        1e-6 * exp2((b + 1) / 4.0));
+                q++;
+            }
+        } //end for
+        for (; q < 3; q++) {
+            fprintf(out, "%s{quantile=\"%g\"} NaN\n", hist_names[h], quantiles[q]);
+        }
+        fprintf(out, "%s_sum %.9g\n%s_count %ld\n", hist_names[h], sum, hist_names[h], count);
+    } //end for (each histogram)
+} //end metrics_write
+
+/****************************************************************************
+* Exporter
+* One thread accepts connections on a Unix domain socket and answers each
+* with a plain HTTP response holding a fresh scrape, so
+*     curl --unix-socket PATH http://localhost/metrics
+* works. The thread polls its listening socket so it can notice a stop.
+****************************************************************************/
+static pthread_t serve_handle;
+static int serve_fd = -1;
+static atomic_int serve_stop = 0;
+static metrics_gauge_fn serve_gauges = NULL;
+static char serve_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static void serve_one(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char request[1024];
+    size_t have = 0;
+    char* body = NULL;
+    size_t body_len = 0;
+    FILE* out;
+    char header[128];
+    int header_len;
+    ssize_t n;
+
+    //Read the request head (if the client sends one) before answering
+    while (have < sizeof(request) - 1 && poll(&pfd, 1, 100) > 0) {
+        n = read(fd, request + have, sizeof(request) - 1 - have);
+        if (n <= 0) {
+            break;
+        }
+        have += (size_t)n;
+        request[have] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL) {
+            break;
+        }
+    } //end while
+
+    out = open_memstream(&body, &body_len);
+    if (out == NULL) {
+        return;
+    }
+    metrics_write(out, serve_gauges);
+    fclose(out);
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %zu\r\n\r\n", body_len);
+    if (write(fd, header, (size_t)header_len) == header_len) {
+        size_t done = 0;
+        while (done < body_len && (n = write(fd, body + done, body_len - done)) > 0) {
+            done += (size_t)n;
+        }
+    }
+    free(body);
+} //end serve_one
+
+static void* serve_thread(void* param) {
+    struct pollfd pfd = { serve_fd, POLLIN, 0 };
+    int fd;
+
+    (void)param; // unused parameter
+    while (!atomic_load(&serve_stop)) {
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+        fd = accept(serve_fd, NULL, NULL);
+        if (fd >= 0) {
+            serve_one(fd);
+            close(fd);
+        }
+    } //end while
+    return NULL;
+} //end serve_thread
+
+/****************************************************************************
+* Function: metrics_serve_start / metrics_serve_stop
+* What it does: Starts the exporter thread on a Unix socket at `path`
+*               (replacing a stale socket file), or stops it and removes
+*               the socket file.
+* Outputs: metrics_serve_start returns 0 on success, 1 on failure
+****************************************************************************/
+int metrics_serve_start(const char* path, metrics_gauge_fn gauges) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    strcpy(serve_path, path);
+
+    serve_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (serve_fd < 0) {
+        return 1;
+    }
+    unlink(path);
+    if (bind(serve_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(serve_fd, 16) != 0) {
+        close(serve_fd);
+        serve_fd = -1;
+        return 1;
+    }
+
+    serve_gauges = gauges;
+    atomic_store(&serve_stop, 0);
+    if (pthread_create(&serve_handle, NULL, serve_thread, NULL) != 0) {
+        close(serve_fd);
+        unlink(path);
+        serve_fd = -1;
+        return 1;
+    }
+    return 0;
+} //end metrics_serve_start
+
+void metrics_serve_stop(void) {
+    if (serve_fd < 0) {
+        return;
+    }
+    atomic_store(&serve_stop, 1);
+    pthread_join(serve_handle, NULL);
+    close(serve_fd);
+    unlink(serve_path);
+    serve_fd = -1;
+} //end metrics_serve_stop
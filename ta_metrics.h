@@ -0,0 +1,54 @@
+//ta_metrics.h
+#ifndef TA_METRICS_H
+#define TA_METRICS_H
+
+#include <stdio.h>
+
+/****************************************************************************
+* Sharded metrics with a Prometheus text exporter
+* Each thread owns one shard and is the only one that writes it, so an
+* update is a plain relaxed load and store on a cache line nobody else
+* writes. A scrape adds the shards up; it never takes the simulation's
+* mutex and never stalls the threads being measured.
+****************************************************************************/
+
+//Counters (one slot per shard each)
+#define MET_ARRIVALS      0             //visits to the office door
+#define MET_SEATED        1             //visits that got a chair
+#define MET_REJECTED      2             //"Hallway full" turn-aways
+#define MET_RENEGED       3             //seated students who gave up waiting
+#define MET_BALKED        4             //trips skipped on the published estimate
+#define MET_PARKED        5             //callback tickets taken
+#define MET_HELPED        6             //help sessions given
+#define MET_FINISHED      7             //students done for the day
+#define MET_TA_SLEEPS     8             //times the TA went to sleep
+#define MET_TA_WAKEUPS    9             //times the TA woke up
+#define MET_TA_SPURIOUS   10            //wake-ups that found nobody waiting
+#define MET_COUNT         11
+
+//Histograms: 4 buckets per doubling, starting at 1 microsecond
+#define MET_HIST_WAIT      0            //time seated students waited to be called in
+#define MET_HIST_OVERSHOOT 1            //how late timed sleeps woke up
+#define MET_HISTS          2
+#define MET_HIST_BUCKETS   128
+
+//Writes extra gauge lines into a scrape (called on the exporter thread)
+typedef void (*metrics_gauge_fn)(FILE* out);
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+int metrics_init(int count);
+void metrics_free(void);
+void metrics_add(int shard, int counter, long n);
+void metrics_observe(int shard, int hist, double seconds);
+long metrics_total(int counter);
+long metrics_count(int hist);
+double metrics_sum(int hist);
+double metrics_quantile(int hist, double q);
+void metrics_write(FILE* out, metrics_gauge_fn gauges);
+
+int metrics_serve_start(const char* path, metrics_gauge_fn gauges);
+void metrics_serve_stop(void);
+
+#endif
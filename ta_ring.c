@@ -0,0 +1,158 @@
+//ta_ring.c
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "ta_ring.h"
+
+/****************************************************************************
+* Shared-memory help request ring (see ta_ring.h)
+*
+* Sleeping without lost wake-ups: the sleeper raises its flag and then
+* checks again for work; the waker publishes its work and then checks the
+* flag. Both put a full fence between the two steps, so at least one of
+* them sees the other and nobody sleeps through a request or a reply.
+****************************************************************************/
+
+static void futex_wait(atomic_uint* word, unsigned value) {
+    //Not FUTEX_PRIVATE: the word is shared between processes
+    syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/****************************************************************************
+* Function: ta_ring_size / ta_ring_init
+* What it does: Bytes needed for a ring of `capacity` slots (a power of
+*               two), and setting one up in shared memory before any
+*               process uses it.
+****************************************************************************/
+size_t ta_ring_size(uint32_t capacity) {
+    return sizeof(ta_ring_t) + sizeof(ring_slot_t) * (size_t)capacity;
+}
+
+void ta_ring_init(ta_ring_t* ring, uint32_t capacity) {
+    uint32_t i;
+
+    memset(ring, 0, ta_ring_size(capacity));
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    for (i = 0; i < capacity; i++) {
+        atomic_init(&ring->slots[i].seq, i);
+    }
+} //end ta_ring_init
+
+/****************************************************************************
+* Function: ta_ring_claim / ta_ring_publish
+* What it does: A student claims the next free slot, fills in the request
+*               in place and publishes it. Publishing wakes the TA only if
+*               it is asleep.
+* Outputs: ta_ring_claim returns the slot, or NULL if the ring is full.
+****************************************************************************/
+ring_slot_t* ta_ring_claim(ta_ring_t* ring) {
+    unsigned pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    while (1) {
+        ring_slot_t* slot = &ring->slots[pos & ring->mask];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+
+        if (diff == 0) {
+            //Free for this position: try to take it
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                return slot;
+            }
+        } else if (diff < 0) {
+            return NULL; //the TA has not read this slot from the last lap yet
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    } //end while
+} //end ta_ring_claim
+
+void ta_ring_publish(ta_ring_t* ring, ring_slot_t* slot) {
+    unsigned pos = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->ta_sleeping, memory_order_relaxed) &&
+        atomic_exchange(&ring->ta_sleeping, 0)) {
+        atomic_fetch_add_explicit(&ring->ta_wakeups, 1, memory_order_relaxed);
+        futex_wake(&ring->ta_sleeping);
+    }
+} //end ta_ring_publish
+
+/****************************************************************************
+* Function: ta_ring_next / ta_ring_done
+* What it does: The TA looks at the next request in the ring, sleeping
+*               until one arrives if `wait` is set, and frees its slot with
+*               ta_ring_done once it has read it.
+* Outputs: ta_ring_next returns the request, or NULL if there is none and
+*          `wait` is 0.
+****************************************************************************/
+help_request_t* ta_ring_next(ta_ring_t* ring, int wait) {
+    ring_slot_t* slot = &ring->slots[ring->head & ring->mask];
+    unsigned ready = ring->head + 1;
+
+    while (atomic_load_explicit(&slot->seq, memory_order_acquire) != ready) {
+        if (!wait) {
+            return NULL;
+        }
+        atomic_store(&ring->ta_sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) == ready) {
+            atomic_store(&ring->ta_sleeping, 0);
+            break;
+        }
+        atomic_fetch_add_explicit(&ring->ta_sleeps, 1, memory_order_relaxed);
+        futex_wait(&ring->ta_sleeping, 1);
+        atomic_store(&ring->ta_sleeping, 0);
+    } //end while
+    return &slot->req;
+} //end ta_ring_next
+
+void ta_ring_done(ta_ring_t* ring) {
+    ring_slot_t* slot = &ring->slots[ring->head & ring->mask];
+
+    //The slot is free again one lap later
+    atomic_store_explicit(&slot->seq, ring->head + ring->capacity, memory_order_release);
+    ring->head++;
+} //end ta_ring_done
+
+/****************************************************************************
+* Function: ring_mailbox_post / ring_mailbox_wait
+* What it does: The TA posts after writing a reply into a student's
+*               mailbox; the student waits until `want` replies in all
+*               have been posted. Posting wakes the student only if it is
+*               asleep.
+****************************************************************************/
+void ring_mailbox_post(ring_mailbox_t* box) {
+    atomic_fetch_add_explicit(&box->answered, 1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&box->sleeping, memory_order_relaxed) &&
+        atomic_exchange(&box->sleeping, 0)) {
+        atomic_fetch_add_explicit(&box->wakeups, 1, memory_order_relaxed);
+        futex_wake(&box->answered);
+    }
+} //end ring_mailbox_post
+
+void ring_mailbox_wait(ring_mailbox_t* box, uint32_t want) {
+    unsigned seen;
+
+    while ((int)((seen = atomic_load_explicit(&box->answered, memory_order_acquire)) - want) < 0) {
+        atomic_store(&box->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        seen = atomic_load_explicit(&box->answered, memory_order_acquire);
+        if ((int)(seen - want) >= 0) {
+            atomic_store(&box->sleeping, 0);
+            break;
+        }
+        atomic_fetch_add_explicit(&box->sleeps, 1, memory_order_relaxed);
+        futex_wait(&box->answered, seen);
+        atomic_store(&box->sleeping, 0);
+    } //end while
+} //end ring_mailbox_wait
@@ -0,0 +1,69 @@
+//ta_ring.h
+#ifndef TA_RING_H
+#define TA_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "ta_wire.h"
+
+/****************************************************************************
+* Shared-memory help request ring
+* Many student processes, one TA, all mapping the same memory. A student
+* claims a slot, writes its help request straight into it and publishes
+* it; the TA reads requests where they lie. Nothing is copied through the
+* kernel, and while requests keep coming nobody makes a system call.
+*
+* The only system calls are futex waits and wakes, for sleeping:
+*   - the TA sleeps when the ring is empty ("TA: Waiting for a student
+*     (sleeping)"), and a student wakes it only if it is asleep
+*   - a student waiting for replies sleeps on its mailbox, and the TA
+*     wakes it only if it is asleep
+*
+* The ring is a bounded multi-producer queue in the style of Vyukov's:
+* every slot carries a sequence number that says whose turn it is, so
+* producers only share one counter and the TA shares none.
+* Everything here lives in memory mapped MAP_SHARED by every process.
+****************************************************************************/
+
+#define RING_WINDOW 64                  //most requests a student may have out at once
+
+typedef struct {
+    atomic_uint seq;                    //pos: free for producer pos; pos + 1: holds request pos
+    help_request_t req;
+} ring_slot_t;
+
+typedef struct {
+    uint32_t capacity;                  //a power of two
+    uint32_t mask;
+    atomic_uint tail __attribute__((aligned(64)));     //next position producers claim
+    uint32_t head __attribute__((aligned(64)));        //next position the TA reads
+    atomic_uint ta_sleeping;            //futex word: 1 while the TA sleeps
+    atomic_long ta_sleeps;              //times the TA went to sleep
+    atomic_long ta_wakeups;             //futex wakes students made for the TA
+    ring_slot_t slots[] __attribute__((aligned(64)));
+} ta_ring_t;
+
+//Replies for one student, written in place by the TA
+typedef struct {
+    atomic_uint answered;               //futex word: replies written so far
+    atomic_uint sleeping;               //1 while the student sleeps on `answered`
+    atomic_long sleeps;
+    atomic_long wakeups;
+    help_reply_t replies[RING_WINDOW];  //reply to request seq in [seq % RING_WINDOW]
+} __attribute__((aligned(64))) ring_mailbox_t;
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+size_t ta_ring_size(uint32_t capacity);
+void ta_ring_init(ta_ring_t* ring, uint32_t capacity);
+ring_slot_t* ta_ring_claim(ta_ring_t* ring);
+void ta_ring_publish(ta_ring_t* ring, ring_slot_t* slot);
+help_request_t* ta_ring_next(ta_ring_t* ring, int wait);
+void ta_ring_done(ta_ring_t* ring);
+
+void ring_mailbox_post(ring_mailbox_t* box);
+void ring_mailbox_wait(ring_mailbox_t* box, uint32_t want);
+
+#endif
@@ -0,0 +1,142 @@
+//ta_trace.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "ta_trace.h"
+
+//Writes the buffered bytes out
+static void trace_flush(trace_t* trace) {
+    fwrite(trace->buf, 1, trace->len, trace->out);
+    trace->len = 0;
+}
+
+//Makes room for at least `bytes` more bytes in the buffer
+static char* trace_room(trace_t* trace, size_t bytes) {
+    if (trace->len + bytes > TRACE_BUFFER) {
+        trace_flush(trace);
+    }
+    return trace->buf + trace->len;
+}
+
+static char* put_str(char* p, const char* s) {
+    while (*s != '\0') {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static char* put_u64(char* p, uint64_t v) {
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+//Starts one event: the separator from the previous one and the track
+static char* put_head(trace_t* trace, char* p, const char* ph, int pid, int tid) {
+    p = put_str(p, trace->first ? "\n{\"ph\":\"" : ",\n{\"ph\":\"");
+    trace->first = 0;
+    p = put_str(p, ph);
+    p = put_str(p, "\",\"pid\":");
+    p = put_u64(p, (uint64_t)pid);
+    p = put_str(p, ",\"tid\":");
+    return put_u64(p, (uint64_t)tid);
+}
+
+/****************************************************************************
+* Function: trace_open / trace_close
+* What it does: Creates the trace file and writes the opening of the JSON
+*               object, or finishes the JSON and closes the file.
+* Outputs: 0 on success, -1 on failure
+****************************************************************************/
+int trace_open(trace_t* trace, const char* path) {
+    memset(trace, 0, sizeof(*trace));
+    trace->out = fopen(path, "wb");
+    trace->buf = (char*)malloc(TRACE_BUFFER);
+    if (trace->out == NULL || trace->buf == NULL) {
+        if (trace->out != NULL) {
+            fclose(trace->out);
+        }
+        free(trace->buf);
+        return -1;
+    }
+    trace->first = 1;
+    trace->len = (size_t)(put_str(trace->buf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") -
+                          trace->buf);
+    return 0;
+} //end trace_open
+
+int trace_close(trace_t* trace) {
+    char* p = trace_room(trace, 8);
+    int failed;
+
+    p = put_str(p, "\n]}\n");
+    trace->len = (size_t)(p - trace->buf);
+    trace_flush(trace);
+    failed = ferror(trace->out) != 0;
+    failed |= fclose(trace->out) != 0;
+    free(trace->buf);
+    return failed ? -1 : 0;
+} //end trace_close
+
+/****************************************************************************
+* Function: trace_name_process / trace_name_track
+* What it does: Writes the metadata events that label a process (a group
+*               of tracks) or one track in the viewer.
+* Inputs: name -> label (must not need JSON escaping)
+****************************************************************************/
+void trace_name_process(trace_t* trace, int pid, const char* name) {
+    char* p = trace_room(trace, 128 + strlen(name));
+
+    p = put_head(trace, p, "M", pid, 0);
+    p = put_str(p, ",\"name\":\"process_name\",\"args\":{\"name\":\"");
+    p = put_str(p, name);
+    p = put_str(p, "\"}}");
+    trace->len = (size_t)(p - trace->buf);
+}
+
+void trace_name_track(trace_t* trace, int pid, int tid, const char* name) {
+    char* p = trace_room(trace, 128 + strlen(name));
+
+    p = put_head(trace, p, "M", pid, tid);
+    p = put_str(p, ",\"name\":\"thread_name\",\"args\":{\"name\":\"");
+    p = put_str(p, name);
+    p = put_str(p, "\"}}");
+    trace->len = (size_t)(p - trace->buf);
+}
+
+/****************************************************************************
+* Function: trace_span
+* What it does: Writes one span on a track. Times are seconds and are
+*               written as whole microseconds; the duration is taken
+*               between the rounded ends so back-to-back spans never
+*               overlap.
+* Inputs: name -> span label (must not need JSON escaping)
+*         start, end -> span in seconds (end >= start)
+****************************************************************************/
+void trace_span(trace_t* trace, int pid, int tid, const char* name,
+                double start, double end) {
+    uint64_t ts = (uint64_t)llround(start * 1e6);
+    uint64_t te = (uint64_t)llround(end * 1e6);
+    char* p = trace_room(trace, 128 + strlen(name));
+
+    p = put_head(trace, p, "X", pid, tid);
+    p = put_str(p, ",\"name\":\"");
+    p = put_str(p, name);
+    p = put_str(p, "\",\"ts\":");
+    p = put_u64(p, ts);
+    p = put_str(p, ",\"dur\":");
+    p = put_u64(p, te > ts ? te - ts : 0);
+    *p++ = '}';
+    trace->len = (size_t)(p - trace->buf);
+    trace->spans++;
+} //end trace_span
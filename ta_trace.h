@@ -0,0 +1,36 @@
+//ta_trace.h
+#ifndef TA_TRACE_H
+#define TA_TRACE_H
+
+#include <stdio.h>
+
+/****************************************************************************
+* Chrome Trace Event writer
+* Streams complete ("X") spans into a JSON trace that chrome://tracing and
+* ui.perfetto.dev both load. Every track is a (process, thread) pair; the
+* names shown for them are written once with trace_name_track. Output goes
+* through one large buffer and is formatted by hand, since fprintf would
+* dominate a million-span export.
+****************************************************************************/
+
+#define TRACE_BUFFER (1 << 20)          //bytes buffered between writes
+
+typedef struct {
+    FILE* out;
+    char* buf;
+    size_t len;
+    long spans;                         //spans written so far
+    int first;                          //1 until the first event is written
+} trace_t;
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+int trace_open(trace_t* trace, const char* path);
+int trace_close(trace_t* trace);
+void trace_name_track(trace_t* trace, int pid, int tid, const char* name);
+void trace_name_process(trace_t* trace, int pid, const char* name);
+void trace_span(trace_t* trace, int pid, int tid, const char* name,
+                double start, double end);
+
+#endif
@@ -0,0 +1,298 @@
+//ta_vclock.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "ta_vclock.h"
+
+/****************************************************************************
+* Clock state (see ta_vclock.h)
+* Pending alarms are a binary min-heap ordered by time, then key, then
+* the order they were set in. The counts for each semaphore live in a
+* hash table keyed by its address. Everything but `now` is under the
+* lock; `now` only changes under it, but anyone may read it.
+****************************************************************************/
+typedef struct {
+    double time;
+    int key;
+    long id;
+    sem_t* sem;                         //posted when the alarm goes off
+} vclock_alarm_t;
+
+typedef struct {
+    sem_t* sem;                         //NULL for an empty slot
+    int waiting;                        //threads blocked on it
+    int banked;                         //posts nobody has taken yet
+} sem_count_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic double now = 0.0;
+static int running = 0;                 //threads that can run
+static vclock_alarm_t* alarms = NULL;
+static int alarm_len = 0;
+static int alarm_cap = 0;
+static long next_id = 0;
+static long jumps = 0;                  //times the clock moved forward
+static sem_count_t* counts = NULL;
+static int counts_cap = 0;              //a power of two
+static int counts_len = 0;
+
+static int alarm_before(const vclock_alarm_t* a, const vclock_alarm_t* b) {
+    if (a->time != b->time) {
+        return a->time < b->time;
+    }
+    if (a->key != b->key) {
+        return a->key < b->key;
+    }
+    return a->id < b->id;
+}
+
+static void sift_up(int k) {
+    while (k > 0 && alarm_before(&alarms[k], &alarms[(k - 1) / 2])) {
+        vclock_alarm_t swap = alarms[k];
+        alarms[k] = alarms[(k - 1) / 2];
+        alarms[(k - 1) / 2] = swap;
+        k = (k - 1) / 2;
+    }
+}
+
+static void sift_down(int k) {
+    while (1) {
+        int first = k;
+        int child = 2 * k + 1;
+        vclock_alarm_t swap;
+
+        if (child < alarm_len && alarm_before(&alarms[child], &alarms[first])) {
+            first = child;
+        }
+        if (child + 1 < alarm_len && alarm_before(&alarms[child + 1], &alarms[first])) {
+            first = child + 1;
+        }
+        if (first == k) {
+            return;
+        }
+        swap = alarms[k];
+        alarms[k] = alarms[first];
+        alarms[first] = swap;
+        k = first;
+    } //end while
+}
+
+static void remove_alarm(int k) {
+    alarms[k] = alarms[--alarm_len];
+    if (k < alarm_len) {
+        sift_down(k);
+        sift_up(k);
+    }
+}
+
+//The counts for a semaphore, added the first time it is seen
+static sem_count_t* count_of(sem_t* sem) {
+    unsigned slot = (unsigned)(((uintptr_t)sem * 0x9E3779B97F4A7C15ULL) >> 32);
+    int i;
+
+    if (2 * (counts_len + 1) > counts_cap) {
+        sem_count_t* old = counts;
+        int old_cap = counts_cap;
+        counts_cap = counts_cap ? 2 * counts_cap : 64;
+        counts = (sem_count_t*)calloc(counts_cap, sizeof(sem_count_t));
+        if (counts == NULL) {
+            printf("Error: the virtual clock ran out of memory.\n");
+            exit(1);
+        }
+        counts_len = 0;
+        for (i = 0; i < old_cap; i++) {
+            if (old[i].sem != NULL) {
+                *count_of(old[i].sem) = old[i];
+            }
+        }
+        free(old);
+    }
+    for (i = slot & (counts_cap - 1); ; i = (i + 1) & (counts_cap - 1)) {
+        if (counts[i].sem == sem) {
+            return &counts[i];
+        }
+        if (counts[i].sem == NULL) {
+            counts[i].sem = sem;
+            counts_len++;
+            return &counts[i];
+        }
+    }
+} //end count_of
+
+//A post: lets a blocked thread run, or waits for whoever takes it
+static void count_post(sem_t* sem) {
+    sem_count_t* count = count_of(sem);
+
+    if (count->waiting > 0) {
+        count->waiting--;
+        running++;
+    } else {
+        count->banked++;
+    }
+}
+
+//Nobody can run: set off alarms until somebody can
+static void fire_alarms(void) {
+    while (running == 0 && alarm_len > 0) {
+        vclock_alarm_t due = alarms[0];
+        remove_alarm(0);
+        if (due.time > atomic_load(&now)) {
+            atomic_store(&now, due.time);
+            jumps++;
+        }
+        count_post(due.sem);
+        sem_post(due.sem);
+    } //end while
+}
+
+/****************************************************************************
+* Function: vclock_start / vclock_stop
+* What it does: Sets the clock to `start` with `threads` threads taking
+*               part, all of them counted as able to run until they block,
+*               and room for counts on about `semaphores` semaphores.
+*               vclock_stop frees it all when the run is over.
+* Outputs: vclock_start returns 0 on success, -1 if memory ran out
+****************************************************************************/
+int vclock_start(double start, int threads, int semaphores) {
+    //Each thread has at most one alarm set at a time
+    alarm_cap = threads > 0 ? threads : 1;
+    for (counts_cap = 64; counts_cap < 2 * semaphores; counts_cap *= 2) {
+    }
+    alarms = (vclock_alarm_t*)malloc(sizeof(vclock_alarm_t) * alarm_cap);
+    counts = (sem_count_t*)calloc(counts_cap, sizeof(sem_count_t));
+    if (alarms == NULL || counts == NULL) {
+        free(alarms);
+        free(counts);
+        alarms = NULL;
+        counts = NULL;
+        return -1;
+    }
+    counts_len = 0;
+    alarm_len = 0;
+    running = threads;
+    jumps = 0;
+    atomic_store(&now, start);
+    return 0;
+} //end vclock_start
+
+void vclock_stop(void) {
+    free(alarms);
+    free(counts);
+    alarms = NULL;
+    counts = NULL;
+    alarm_len = alarm_cap = 0;
+    counts_len = counts_cap = 0;
+} //end vclock_stop
+
+double vclock_now(void) {
+    return atomic_load(&now);
+}
+
+long vclock_jumps(void) {
+    return jumps;
+}
+
+/****************************************************************************
+* Function: vclock_post / vclock_wait / vclock_trywait / vclock_exit
+* What it does: Called just before posting `sem`, just before waiting on
+*               it, instead of sem_trywait, and when a thread ends. When
+*               the last thread that can run blocks or ends, the earliest
+*               alarm goes off: the clock moves to its time and its
+*               semaphore is posted.
+* Outputs: vclock_trywait returns 1 if it took a post nobody had waited
+*          for (the caller then sem_waits for it, which may still be on
+*          its way), 0 if there was none
+****************************************************************************/
+void vclock_post(sem_t* sem) {
+    pthread_mutex_lock(&lock);
+    count_post(sem);
+    pthread_mutex_unlock(&lock);
+} //end vclock_post
+
+void vclock_wait(sem_t* sem) {
+    sem_count_t* count;
+
+    pthread_mutex_lock(&lock);
+    count = count_of(sem);
+    if (count->banked > 0) {
+        count->banked--; //a post is already there: sem_wait returns at once
+    } else {
+        count->waiting++;
+        running--;
+        fire_alarms();
+    }
+    pthread_mutex_unlock(&lock);
+} //end vclock_wait
+
+int vclock_trywait(sem_t* sem) {
+    sem_count_t* count;
+    int took = 0;
+
+    pthread_mutex_lock(&lock);
+    count = count_of(sem);
+    if (count->banked > 0) {
+        count->banked--;
+        took = 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return took;
+} //end vclock_trywait
+
+void vclock_exit(void) {
+    pthread_mutex_lock(&lock);
+    running--;
+    fire_alarms();
+    pthread_mutex_unlock(&lock);
+} //end vclock_exit
+
+/****************************************************************************
+* Function: vclock_alarm / vclock_cancel
+* What it does: Sets an alarm that posts `sem` at virtual time `when`
+*               (the caller then blocks on it), and takes one back before
+*               it goes off.
+* Inputs: key -> orders alarms due at the same time (lowest first)
+* Outputs: vclock_alarm returns the alarm's id, or -1 if memory ran out;
+*          vclock_cancel returns 1 if the alarm was taken back, 0 if it
+*          already went off
+****************************************************************************/
+long vclock_alarm(int key, double when, sem_t* sem) {
+    long id;
+
+    pthread_mutex_lock(&lock);
+    if (alarm_len == alarm_cap) {
+        vclock_alarm_t* grown = (vclock_alarm_t*)realloc(alarms,
+                                                         sizeof(vclock_alarm_t) * 2 * alarm_cap);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        alarms = grown;
+        alarm_cap *= 2;
+    }
+    id = next_id++;
+    alarms[alarm_len].time = when;
+    alarms[alarm_len].key = key;
+    alarms[alarm_len].id = id;
+    alarms[alarm_len].sem = sem;
+    alarm_len++;
+    sift_up(alarm_len - 1);
+    pthread_mutex_unlock(&lock);
+    return id;
+} //end vclock_alarm
+
+int vclock_cancel(long alarm) {
+    int k;
+
+    pthread_mutex_lock(&lock);
+    for (k = 0; k < alarm_len; k++) {
+        if (alarms[k].id == alarm) {
+            remove_alarm(k);
+            pthread_mutex_unlock(&lock);
+            return 1;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+} //end vclock_cancel
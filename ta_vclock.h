@@ -0,0 +1,41 @@
+//ta_vclock.h
+#ifndef TA_VCLOCK_H
+#define TA_VCLOCK_H
+
+#include <semaphore.h>
+
+/****************************************************************************
+* Virtual clock for real threads
+* The threads still take the real mutex and post and wait on real
+* semaphores, but time only moves when none of them can run. A sleep is
+* an alarm on the clock; once every thread is blocked, the clock jumps to
+* the earliest alarm and posts its semaphore.
+*
+* To know when everyone is blocked, the clock keeps its own count for
+* every semaphore it is told about: threads blocked on it, and posts
+* nobody has taken yet. A thread calls vclock_wait just before sem_wait
+* (vclock_trywait instead of sem_trywait) and vclock_exit when it ends;
+* whoever posts calls vclock_post just before sem_post. A post to a
+* blocked thread counts that thread as running again before it has even
+* woken up, so the clock never jumps while a wake-up is on its way.
+*
+* Alarms due at the same time go off one at a time, lowest key first, and
+* the next one waits until everything the last one woke is blocked again.
+* So with the same seeds a run takes the same steps at the same times.
+****************************************************************************/
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+int vclock_start(double start, int threads, int semaphores);
+void vclock_stop(void);
+double vclock_now(void);
+void vclock_post(sem_t* sem);
+void vclock_wait(sem_t* sem);
+int vclock_trywait(sem_t* sem);
+void vclock_exit(void);
+long vclock_alarm(int key, double when, sem_t* sem);
+int vclock_cancel(long alarm);
+long vclock_jumps(void);
+
+#endif
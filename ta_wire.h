@@ -0,0 +1,29 @@
+//ta_wire.h
+#ifndef TA_WIRE_H
+#define TA_WIRE_H
+
+#include <stdint.h>
+
+/****************************************************************************
+* Help request protocol between students and the TA server
+* Fixed-size binary messages over a Unix stream socket, in host byte
+* order (both ends run on the same machine). A student sends one request
+* and waits for its reply before sending the next.
+****************************************************************************/
+
+#define REPLY_HELPED 0                  //the TA helped the student
+#define REPLY_FULL   1                  //hallway full, come back later
+
+typedef struct {
+    uint32_t seq;                       //echoed in the reply
+    uint32_t student;                   //student id (for the TA's log only)
+} help_request_t;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t status;                    //REPLY_HELPED or REPLY_FULL
+    double waited;                      //seconds in the hallway
+    double helped_for;                  //seconds with the TA
+} help_reply_t;
+
+#endif
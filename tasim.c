@@ -0,0 +1,560 @@
+//tasim.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "tasim.h"
+
+/****************************************************************************
+* Thread pool
+* Workers sleep on a condition variable between batches. A batch is an
+* array of configurations; every worker (and the caller) takes the next
+* one with an atomic counter until none are left, so long and short runs
+* even out on their own. Batches run one at a time.
+****************************************************************************/
+struct tasim_pool {
+    pthread_t* threads;
+    int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;                //a new batch is ready
+    pthread_cond_t idle;                //the last worker left the batch
+    pthread_mutex_t batch_lock;         //one batch at a time
+
+    const tasim_config_t* configs;      //current batch
+    tasim_result_t* results;
+    int count;
+    atomic_int next;                    //next configuration to run
+    int generation;                     //batches started so far
+    int active;                         //workers still in the current batch
+    int stop;
+};
+
+/****************************************************************************
+* Function: tasim_init
+* What it does: Sets up one simulation: a new office with num_students
+*               students, or a copy of config->start with config->params
+*               applied to it.
+* Outputs: 0 on success, -1 if memory could not be allocated
+****************************************************************************/
+int tasim_init(tasim_t* sim, const tasim_config_t* config) {
+    int i;
+
+    memset(sim, 0, sizeof(*sim));
+    if (config->start != NULL) {
+        if (office_clone(&sim->office, config->start) != 0) {
+            return -1;
+        }
+        sim->base = config->start->stats;
+        if (office_reconfigure(&sim->office, &config->params, office_send_local,
+                               &sim->office) != 0) {
+            office_free(&sim->office);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (office_init(&sim->office, 0, 1, &config->params) != 0 ||
+        office_reserve(&sim->office, config->num_students + config->params.num_tas) != 0) {
+        office_free(&sim->office);
+        return -1;
+    }
+    for (i = 0; i < config->num_students; i++) {
+        office_add_student(&sim->office, office_new_student(i + 1, config->seed, &config->params));
+    }
+    return 0;
+} //end tasim_init
+
+void tasim_free(tasim_t* sim) {
+    office_free(&sim->office);
+}
+
+/****************************************************************************
+* Function: tasim_run / tasim_step
+* What it does: Handles events up to and including time `until`. If events
+*               are left, tasim_run moves the clock to `until` so the run
+*               can be continued later with another call. tasim_step stops
+*               after at most max_events events and leaves the clock alone.
+* Outputs: number of events handled
+****************************************************************************/
+long tasim_step(tasim_t* sim, long max_events, double until) {
+    office_t* office = &sim->office;
+    event_t ev;
+    long n = 0;
+
+    while (n < max_events && office->heap_len > 0 && office->heap[0].time <= until) {
+        sim->line_area += office->hall_len * (office->heap[0].time - office->now);
+        office_pop(office, &ev);
+        office_handle(office, &ev, NULL, office_send_local, office);
+        n++;
+    }
+    return n;
+} //end tasim_step
+
+long tasim_run(tasim_t* sim, double until) {
+    office_t* office = &sim->office;
+    long n = tasim_step(sim, LONG_MAX, until);
+
+    if (office->heap_len > 0 && until > office->now) {
+        sim->line_area += office->hall_len * (until - office->now);
+        office->now = until;
+    }
+    return n;
+} //end tasim_run
+
+//Bytes the simulation has allocated
+size_t tasim_memory(const tasim_t* sim) {
+    const office_t* office = &sim->office;
+
+    return sizeof(event_t) * (size_t)office->heap_cap +
+           sizeof(chair_t) * (size_t)office->params.num_chairs +
+           (sizeof(student_t) + 1) * (size_t)office->ta_slots;
+}
+
+void tasim_result(const tasim_t* sim, tasim_result_t* result) {
+    const office_stats_t* now = &sim->office.stats;
+    const office_stats_t* base = &sim->base;
+
+    memset(result, 0, sizeof(*result));
+    result->stats = *now;
+    result->stats.events -= base->events;
+    result->stats.arrivals -= base->arrivals;
+    result->stats.seated -= base->seated;
+    result->stats.rejected -= base->rejected;
+    result->stats.reneged -= base->reneged;
+    result->stats.helped -= base->helped;
+    result->stats.transfers_out -= base->transfers_out;
+    result->stats.finished -= base->finished;
+    result->stats.ta_sleeps -= base->ta_sleeps;
+    result->stats.wait_sum -= base->wait_sum;
+    result->end_time = sim->office.now;
+    result->line_area = sim->line_area;
+    result->pending = sim->office.heap_len;
+    result->ok = 1;
+} //end tasim_result
+
+//Runs configurations of the current batch until none are left
+static void run_share(tasim_pool_t* pool) {
+    int i;
+
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+        tasim_t sim;
+        if (tasim_init(&sim, &pool->configs[i]) != 0) {
+            memset(&pool->results[i], 0, sizeof(pool->results[i]));
+            continue;
+        }
+        tasim_run(&sim, pool->configs[i].until);
+        tasim_result(&sim, &pool->results[i]);
+        tasim_free(&sim);
+    }
+} //end run_share
+
+static void* pool_thread(void* param) {
+    tasim_pool_t* pool = (tasim_pool_t*)param;
+    int seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_share(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->idle);
+        }
+    } //end while
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+} //end pool_thread
+
+/****************************************************************************
+* Function: tasim_pool_create / tasim_pool_destroy
+* What it does: Starts a pool with `threads` threads in total, counting the
+*               thread that calls tasim_run_batch (so 1 starts no workers).
+* Outputs: the pool, or NULL if it could not be started
+****************************************************************************/
+tasim_pool_t* tasim_pool_create(int threads) {
+    tasim_pool_t* pool = (tasim_pool_t*)calloc(1, sizeof(tasim_pool_t));
+    int i;
+
+    if (pool == NULL || threads < 1) {
+        free(pool);
+        return NULL;
+    }
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)threads);
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pthread_mutex_init(&pool->batch_lock, NULL);
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&pool->threads[pool->num_threads], NULL, pool_thread, pool) != 0) {
+            break; //fewer workers; the batch still gets done
+        }
+        pool->num_threads++;
+    }
+    return pool;
+} //end tasim_pool_create
+
+void tasim_pool_destroy(tasim_pool_t* pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->batch_lock);
+    free(pool->threads);
+    free(pool);
+} //end tasim_pool_destroy
+
+/****************************************************************************
+* Function: tasim_run_batch
+* What it does: Runs every configuration to its `until` time on the pool
+*               and fills in results[i] for configs[i]. Returns when all
+*               of them are done. Safe to call from several threads; the
+*               batches then take turns.
+* Outputs: number of runs that could not be set up (their ok is 0)
+****************************************************************************/
+int tasim_run_batch(tasim_pool_t* pool, const tasim_config_t* configs,
+                    tasim_result_t* results, int count) {
+    int failed = 0;
+    int i;
+
+    pthread_mutex_lock(&pool->batch_lock);
+    pthread_mutex_lock(&pool->lock);
+    pool->configs = configs;
+    pool->results = results;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+    pool->active = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_share(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->batch_lock);
+
+    for (i = 0; i < count; i++) {
+        failed += !results[i].ok;
+    }
+    return failed;
+} //end tasim_run_batch
+
+/****************************************************************************
+* Host
+* Every host thread owns a line of simulations. A thread takes the
+* simulation at the front of its own line, runs one slice of it (quantum
+* events, times its weight) and puts it at the back, so the simulations in
+* a line take turns. A thread whose line is empty takes the simulation at
+* the front of another thread's line (work stealing): that is the one that
+* has waited longest there. Threads with nothing to do anywhere sleep.
+*
+* Each line has its own small lock; a slice is thousands of events, so
+* the locks are taken rarely. Memory is checked after every slice; within
+* one slice the event heap can at most double, so a simulation never goes
+* past twice its quota.
+****************************************************************************/
+typedef struct host_task {
+    tasim_t sim;
+    tasim_config_t config;
+    tasim_result_t* result;
+    size_t mem_quota;                   //bytes (0 = no limit)
+    int weight;                         //slices are quantum * weight events
+    int started;
+    double submitted;                   //wall clock at submit
+    struct host_task* next;
+} host_task_t;
+
+//One thread's line
+typedef struct {
+    pthread_mutex_t lock;
+    host_task_t* head;
+    host_task_t* tail;
+    struct tasim_host* host;
+    int id;                             //thread number
+} __attribute__((aligned(64))) host_line_t;
+
+struct tasim_host {
+    pthread_t* threads;
+    host_line_t* lines;
+    int num_threads;
+    long quantum;
+    atomic_int next_line;               //where the next submitted simulation goes
+    atomic_int queued;                  //simulations waiting in all lines
+    atomic_int sleepers;                //threads asleep on `work`
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int live;                           //simulations submitted and not done
+    int stop;
+};
+
+static double host_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void line_push(tasim_host_t* host, int line, host_task_t* task) {
+    host_line_t* l = &host->lines[line];
+
+    task->next = NULL;
+    pthread_mutex_lock(&l->lock);
+    if (l->tail != NULL) {
+        l->tail->next = task;
+    } else {
+        l->head = task;
+    }
+    l->tail = task;
+    pthread_mutex_unlock(&l->lock);
+
+    //Wake a sleeping thread; queued goes up before sleepers is read, and a
+    //thread going to sleep does the opposite, so one of them sees the other
+    atomic_fetch_add(&host->queued, 1);
+    if (atomic_load(&host->sleepers) > 0) {
+        pthread_mutex_lock(&host->lock);
+        pthread_cond_signal(&host->work);
+        pthread_mutex_unlock(&host->lock);
+    }
+} //end line_push
+
+static host_task_t* line_pop(tasim_host_t* host, int line) {
+    host_line_t* l = &host->lines[line];
+    host_task_t* task;
+
+    pthread_mutex_lock(&l->lock);
+    task = l->head;
+    if (task != NULL) {
+        l->head = task->next;
+        if (l->head == NULL) {
+            l->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&l->lock);
+    if (task != NULL) {
+        atomic_fetch_sub(&host->queued, 1);
+    }
+    return task;
+} //end line_pop
+
+#define TASK_FAILED     0
+#define TASK_DONE       1
+#define TASK_OVER_QUOTA 2
+
+//Fills in the result and frees the simulation
+static void task_finish(tasim_host_t* host, host_task_t* task, int how) {
+    if (how != TASK_FAILED) {
+        tasim_result(&task->sim, task->result);
+        task->result->over_quota = how == TASK_OVER_QUOTA;
+    } else {
+        memset(task->result, 0, sizeof(*task->result));
+    }
+    task->result->wall_time = host_clock() - task->submitted;
+    if (task->started) {
+        tasim_free(&task->sim);
+    }
+    free(task);
+
+    pthread_mutex_lock(&host->lock);
+    if (--host->live == 0) {
+        pthread_cond_broadcast(&host->done);
+    }
+    pthread_mutex_unlock(&host->lock);
+} //end task_finish
+
+static void* host_thread(void* param) {
+    tasim_host_t* host = ((host_line_t*)param)->host;
+    int self = ((host_line_t*)param)->id;
+    host_task_t* task;
+    int i;
+
+    while (1) {
+        //Own line first, then steal from the others
+        task = line_pop(host, self);
+        for (i = 1; task == NULL && i < host->num_threads; i++) {
+            task = line_pop(host, (self + i) % host->num_threads);
+        }
+        if (task == NULL) {
+            pthread_mutex_lock(&host->lock);
+            atomic_fetch_add(&host->sleepers, 1);
+            while (atomic_load(&host->queued) == 0 && !host->stop) {
+                pthread_cond_wait(&host->work, &host->lock);
+            }
+            atomic_fetch_sub(&host->sleepers, 1);
+            if (host->stop && atomic_load(&host->queued) == 0) {
+                pthread_mutex_unlock(&host->lock);
+                break;
+            }
+            pthread_mutex_unlock(&host->lock);
+            continue;
+        }
+
+        if (!task->started) {
+            if (tasim_init(&task->sim, &task->config) != 0) {
+                task_finish(host, task, TASK_FAILED);
+                continue;
+            }
+            task->started = 1;
+        }
+        tasim_step(&task->sim, host->quantum > LONG_MAX / task->weight ? LONG_MAX :
+                               host->quantum * task->weight, task->config.until);
+
+        if (task->sim.office.heap_len == 0 ||
+            task->sim.office.heap[0].time > task->config.until) {
+            tasim_run(&task->sim, task->config.until); //moves the clock to `until`
+            task_finish(host, task, TASK_DONE);
+        } else if (task->mem_quota > 0 && tasim_memory(&task->sim) > task->mem_quota) {
+            task_finish(host, task, TASK_OVER_QUOTA);
+        } else {
+            line_push(host, self, task);
+        }
+    } //end while
+    return NULL;
+} //end host_thread
+
+/****************************************************************************
+* Function: tasim_host_create / tasim_host_destroy
+* What it does: Starts a host with exactly `threads` threads (the caller
+*               only submits and waits), or waits for the simulations left
+*               and stops it.
+* Inputs: quantum -> events per slice for a simulation of weight 1
+* Outputs: the host, or NULL if it could not be started
+****************************************************************************/
+tasim_host_t* tasim_host_create(int threads, long quantum) {
+    tasim_host_t* host = (tasim_host_t*)calloc(1, sizeof(tasim_host_t));
+    int i;
+
+    if (host == NULL || threads < 1 || quantum < 1) {
+        free(host);
+        return NULL;
+    }
+    host->threads = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)threads);
+    host->lines = (host_line_t*)aligned_alloc(64, sizeof(host_line_t) * (size_t)threads);
+    if (host->threads == NULL || host->lines == NULL) {
+        free(host->threads);
+        free(host->lines);
+        free(host);
+        return NULL;
+    }
+    host->quantum = quantum;
+    pthread_mutex_init(&host->lock, NULL);
+    pthread_cond_init(&host->work, NULL);
+    pthread_cond_init(&host->done, NULL);
+    for (i = 0; i < threads; i++) {
+        pthread_mutex_init(&host->lines[i].lock, NULL);
+        host->lines[i].head = NULL;
+        host->lines[i].tail = NULL;
+        host->lines[i].host = host;
+        host->lines[i].id = i;
+    }
+    //Every line must exist before any thread starts stealing
+    host->num_threads = threads;
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&host->threads[i], NULL, host_thread, &host->lines[i]) != 0) {
+            break;
+        }
+    }
+    if (i < threads) {
+        //Lines without a thread would only be emptied by stealing: give up
+        pthread_mutex_lock(&host->lock);
+        host->stop = 1;
+        pthread_cond_broadcast(&host->work);
+        pthread_mutex_unlock(&host->lock);
+        while (--i >= 0) {
+            pthread_join(host->threads[i], NULL);
+        }
+        free(host->threads);
+        free(host->lines);
+        free(host);
+        return NULL;
+    }
+    return host;
+} //end tasim_host_create
+
+void tasim_host_destroy(tasim_host_t* host) {
+    int i;
+
+    tasim_host_wait(host);
+    pthread_mutex_lock(&host->lock);
+    host->stop = 1;
+    pthread_cond_broadcast(&host->work);
+    pthread_mutex_unlock(&host->lock);
+    for (i = 0; i < host->num_threads; i++) {
+        pthread_join(host->threads[i], NULL);
+    }
+    for (i = 0; i < host->num_threads; i++) {
+        pthread_mutex_destroy(&host->lines[i].lock);
+    }
+    pthread_mutex_destroy(&host->lock);
+    pthread_cond_destroy(&host->work);
+    pthread_cond_destroy(&host->done);
+    free(host->threads);
+    free(host->lines);
+    free(host);
+} //end tasim_host_destroy
+
+/****************************************************************************
+* Function: tasim_host_submit
+* What it does: Hands one simulation to the host. It starts as soon as a
+*               thread gets to it; `result` is filled in when it is done
+*               and must stay valid until then. Can be called from any
+*               thread at any time, also while other simulations run.
+* Inputs: weight -> share of the threads relative to others (at least 1)
+*         mem_quota -> bytes the simulation may use (0 = no limit)
+* Outputs: 0 on success, -1 if memory ran out
+****************************************************************************/
+int tasim_host_submit(tasim_host_t* host, const tasim_config_t* config, int weight,
+                      size_t mem_quota, tasim_result_t* result) {
+    host_task_t* task = (host_task_t*)calloc(1, sizeof(host_task_t));
+
+    if (task == NULL) {
+        return -1;
+    }
+    task->config = *config;
+    task->result = result;
+    task->mem_quota = mem_quota;
+    task->weight = weight > 0 ? weight : 1;
+    task->submitted = host_clock();
+
+    pthread_mutex_lock(&host->lock);
+    host->live++;
+    pthread_mutex_unlock(&host->lock);
+    line_push(host, atomic_fetch_add(&host->next_line, 1) % host->num_threads, task);
+    return 0;
+} //end tasim_host_submit
+
+//Waits until every simulation submitted so far is done
+void tasim_host_wait(tasim_host_t* host) {
+    pthread_mutex_lock(&host->lock);
+    while (host->live > 0) {
+        pthread_cond_wait(&host->done, &host->lock);
+    }
+    pthread_mutex_unlock(&host->lock);
+}
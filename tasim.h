@@ -0,0 +1,79 @@
+//tasim.h
+#ifndef TASIM_H
+#define TASIM_H
+
+#include <stdint.h>
+#include "office_model.h"
+
+/****************************************************************************
+* libtasim: office simulations as a library
+* Everything one simulation needs lives in its tasim_t, so any number of
+* them can exist in one process and run on any thread. tasim_run_batch
+* runs many configurations at once on a pool of threads that is created
+* once and reused, so a sweep or a planner can call it over and over
+* without starting processes or threads each time.
+*
+* Runs are in virtual time (office_model.c). A run's result depends only
+* on its configuration, never on which thread ran it or what ran beside it.
+*
+* tasim_host is for many independent simulations that come and go: each
+* one is run a slice of events at a time and put back in line, so every
+* simulation keeps moving no matter how big the others are. Idle threads
+* steal simulations from busy ones. A simulation that outgrows its memory
+* quota is stopped.
+****************************************************************************/
+
+//What to simulate
+typedef struct {
+    office_params_t params;
+    int num_students;                   //students programming at the start
+    uint64_t seed;                      //seed for every student's stream
+    double until;                       //stop after this time (INFINITY = to the end)
+    const office_t* start;              //if not NULL: go on from a copy of this
+                                        //office (params applied on the spot,
+                                        //num_students and seed unused)
+} tasim_config_t;
+
+//How it went (counts are since the start, or since `start` if one was given)
+typedef struct {
+    office_stats_t stats;
+    double end_time;                    //virtual time the run stopped at
+    double line_area;                   //integral of hallway length over time
+    int pending;                        //events left (0 if the run finished)
+    int ok;                             //0 if the run could not be set up
+    int over_quota;                     //stopped for using too much memory (host)
+    double wall_time;                   //seconds from submit to done (host)
+} tasim_result_t;
+
+//One simulation
+typedef struct {
+    office_t office;
+    office_stats_t base;                //stats when the run was set up
+    double line_area;
+} tasim_t;
+
+typedef struct tasim_pool tasim_pool_t;
+typedef struct tasim_host tasim_host_t;
+
+/****************************************************************************
+* Function prototypes
+****************************************************************************/
+int tasim_init(tasim_t* sim, const tasim_config_t* config);
+long tasim_run(tasim_t* sim, double until);
+long tasim_step(tasim_t* sim, long max_events, double until);
+size_t tasim_memory(const tasim_t* sim);
+void tasim_result(const tasim_t* sim, tasim_result_t* result);
+void tasim_free(tasim_t* sim);
+
+tasim_pool_t* tasim_pool_create(int threads);
+void tasim_pool_destroy(tasim_pool_t* pool);
+int tasim_run_batch(tasim_pool_t* pool, const tasim_config_t* configs,
+                    tasim_result_t* results, int count);
+
+tasim_host_t* tasim_host_create(int threads, long quantum);
+int tasim_host_submit(tasim_host_t* host, const tasim_config_t* config, int weight,
+                      size_t mem_quota, tasim_result_t* result);
+void tasim_host_wait(tasim_host_t* host);
+void tasim_host_destroy(tasim_host_t* host);
+
+#endif